@@ -1,14 +1,23 @@
+#include "fmacros.h"
 #include "redislite.h"
 #include "core.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "page.h"
 #include "page_index.h"
 #include "page_first.h"
 #include "page_string.h"
 #include "page_freelist.h"
 #include "page_list.h"
+#include "page_cache.h"
+#include "wal.h"
+#include "flusher.h"
+#include "vacuum.h"
 #include "util.h"
 
 int redislite_set_root(redislite *db, redislite_page_index_first *page)
@@ -29,6 +38,23 @@ int redislite_set_root(redislite *db, redislite_page_index_first *page)
 	return ret;
 }
 
+int redislite_valid_page_size(size_t page_size)
+{
+	return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE && (page_size & (page_size - 1)) == 0;
+}
+
+// the header has two bytes for the page size, 65536 is stored as 1
+void redislite_put_page_size(unsigned char *p, size_t page_size)
+{
+	redislite_put_2bytes(p, page_size == MAX_PAGE_SIZE ? 1 : (int)page_size);
+}
+
+size_t redislite_get_page_size(const unsigned char *p)
+{
+	size_t page_size = ((size_t)p[0] << 8) | p[1];
+	return page_size == 1 ? MAX_PAGE_SIZE : page_size;
+}
+
 changeset *redislite_create_changeset(redislite *db)
 {
 	changeset *cs = redislite_malloc(sizeof(changeset));
@@ -42,32 +68,96 @@ changeset *redislite_create_changeset(redislite *db)
 	cs->opened_pages_length = 0;
 	cs->opened_pages_free = 0;
 	cs->opened_pages = NULL;
+	cs->index_alloced = 0;
+	cs->index_used = 0;
+	cs->index = NULL;
+	cs->saved = 0;
 	return cs;
 }
 
-redislite_page *redislite_modified_page(changeset *cs, int page_number)
+static changeset_slot *index_slot(changeset *cs, int page_number)
 {
-	size_t i;
-	for (i = 0; i < cs->modified_pages_length; i++) {
-		if (((redislite_page *)cs->modified_pages[i])->number == page_number) {
-			return ((redislite_page *)cs->modified_pages[i]);
-		}
+	size_t mask = cs->index_alloced - 1;
+	size_t i = ((size_t)(unsigned int)page_number * 2654435761U) & mask;
+	while (cs->index[i].number != -1 && cs->index[i].number != page_number) {
+		i = (i + 1) & mask;
+	}
+	return &cs->index[i];
+}
 
-		if (((redislite_page *)cs->modified_pages[i])->number > page_number) {
-			break;
+static changeset_slot *index_find(changeset *cs, int page_number)
+{
+	if (cs->index_used == 0) {
+		return NULL;
+	}
+	changeset_slot *slot = index_slot(cs, page_number);
+	return slot->number == -1 ? NULL : slot;
+}
+
+/*
+ * Returns the slot for `page_number`, a new one if it had none. Slots are
+ * never removed, and the pointer is valid until the next call.
+ */
+static changeset_slot *index_add(changeset *cs, int page_number)
+{
+	if ((cs->index_used + 1) * 2 > cs->index_alloced) {
+		size_t alloced = cs->index_alloced ? cs->index_alloced * 2 : DEFAULT_CHANGESET_INDEX_SIZE;
+		changeset_slot *index = redislite_malloc(sizeof(changeset_slot) * alloced);
+		if (index == NULL) {
+			return NULL;
 		}
+		size_t i;
+		for (i = 0; i < alloced; i++) {
+			index[i].number = -1;
+		}
+		changeset_slot *old_index = cs->index;
+		size_t old_alloced = cs->index_alloced;
+		cs->index = index;
+		cs->index_alloced = alloced;
+		for (i = 0; i < old_alloced; i++) {
+			if (old_index[i].number != -1) {
+				*index_slot(cs, old_index[i].number) = old_index[i];
+			}
+		}
+		redislite_free(old_index);
+	}
+	changeset_slot *slot = index_slot(cs, page_number);
+	if (slot->number == -1) {
+		slot->number = page_number;
+		slot->opened = -1;
+		slot->modified = -1;
+		cs->index_used++;
 	}
-	return NULL;
+	return slot;
+}
+
+redislite_page *redislite_modified_page(changeset *cs, int page_number)
+{
+	changeset_slot *slot = index_find(cs, page_number);
+	if (slot == NULL || slot->modified == -1) {
+		return NULL;
+	}
+	return cs->modified_pages[slot->modified];
+}
+
+redislite_page *redislite_opened_page(changeset *cs, int page_number)
+{
+	changeset_slot *slot = index_find(cs, page_number);
+	if (slot == NULL || slot->opened == -1) {
+		return NULL;
+	}
+	return cs->opened_pages[slot->opened];
 }
 
 void redislite_free_changeset(changeset *cs)
 {
 	size_t i;
 	redislite_page *page;
+	redislite_page_cache *cache = cs->db->page_cache;
 	for (i = 0; i < cs->opened_pages_length; i++) {
 		page = cs->opened_pages[i];
 		redislite_page *_page = redislite_modified_page(cs, page->number);
-		if (_page == NULL || _page->data != page->data) {
+		if ((_page == NULL || _page->data != page->data) && !redislite_page_cache_owns(cache, page->number, page->data)) {
 			page->type->free_function(cs->db, page->data);
 		}
 		redislite_free(page);
@@ -76,82 +166,280 @@ void redislite_free_changeset(changeset *cs)
 	for (i = 0; i < cs->modified_pages_length; i++) {
 		page = cs->modified_pages[i];
 		if (page->data != cs->db->root) {
-			page->type->free_function(cs->db, page->data);
+			int status = REDISLITE_SKIP;
+			if (cs->saved && page->number != 0 && page->number < cs->db->number_of_pages) {
+				status = redislite_page_cache_put(cache, page->number, page->type->identifier, page->data);
+			}
+			if (status != REDISLITE_OK && !redislite_page_cache_owns(cache, page->number, page->data)) {
+				page->type->free_function(cs->db, page->data);
+			}
 		}
 		redislite_free(page);
 	}
+	if (!cs->saved && cs->modified_pages_length > 0) {
+		// cached pages may have been changed in place and never written
+		redislite_page_cache_clear(cache);
+	}
+	else {
+		redislite_page_cache_trim(cache);
+	}
 	redislite_free(cs->modified_pages);
+	redislite_free(cs->index);
 	redislite_free(cs);
 }
 
-int redislite_save_changeset(changeset *cs)
+static void encode_page(changeset *cs, redislite_page *page, unsigned char *data)
 {
-	FILE *file = fopen(cs->db->filename, "rb+");
-	if (!file) {
-		file = fopen(cs->db->filename, "wb+");
+	memset(&data[0], '\0', cs->db->page_size); // TODO: we could allow garbage on unused bytes
+	if (page->number == 0) {
+		memcpy(data, HEADER_STRING, sizeof(HEADER_STRING));
+		redislite_put_page_size(&data[20], cs->db->page_size);
+		data[22] = WRITE_FORMAT_VERSION; // write format version
+		data[23] = READ_FORMAT_VERSION; // read format version
+		redislite_put_4bytes(&data[24], 0); // reserved
+		redislite_put_4bytes(&data[28], cs->db->number_of_pages);
+		redislite_put_4bytes(&data[32], cs->db->first_freelist_page);
+		redislite_put_4bytes(&data[36], cs->db->number_of_freelist_pages);
+		redislite_put_4bytes(&data[40], cs->db->heap_page);
+		redislite_write_first(cs->db, &data[100], (redislite_page_index_first *)cs->db->root);
+	}
+	else {
+		page->type->write_function(cs->db, &data[0], page->data);
 	}
+}
 
-	if (!file) {
-		fprintf(stderr, "Unable to write to file '%s'\n", cs->db->filename);
-		return REDISLITE_ERR;
+/*
+ * Returns the database's write buffer, grown to at least `size` bytes.
+ * It is kept between commits and aligned for the benefit of the kernel.
+ */
+static unsigned char *write_buffer(redislite *db, size_t size)
+{
+	if (db->write_buffer_size < size) {
+		size_t alloced = db->write_buffer_size ? db->write_buffer_size : WRITE_BUFFER_ALIGNMENT;
+		while (alloced < size) {
+			alloced *= 2;
+		}
+		void *buffer;
+		if (posix_memalign(&buffer, WRITE_BUFFER_ALIGNMENT, alloced) != 0) {
+			return NULL;
+		}
+		redislite_free(db->write_buffer);
+		db->write_buffer = buffer;
+		db->write_buffer_size = alloced;
 	}
+	return db->write_buffer;
+}
 
-	size_t i;
-	unsigned char *data = (unsigned char *)redislite_malloc(sizeof(unsigned char) * cs->db->page_size);
-	if (data == NULL) {
-		fclose(file);
+static void trim_write_buffer(redislite *db)
+{
+	// a huge changeset should not pin its buffer forever
+	if (db->write_buffer_size > MAX_WRITE_BUFFER_SIZE) {
+		redislite_free(db->write_buffer);
+		db->write_buffer = NULL;
+		db->write_buffer_size = 0;
+	}
+}
+
+/*
+ * A vacuum step can leave pages it moved listed as modified past the new
+ * end of the database; they are not written. modified_pages is sorted, so
+ * they are the last ones.
+ */
+static size_t pages_to_save(changeset *cs)
+{
+	size_t length = cs->modified_pages_length;
+	while (length > 0 && ((redislite_page *)cs->modified_pages[length - 1])->number >= cs->db->number_of_pages) {
+		length--;
+	}
+	return length;
+}
+
+static int save_changeset_wal(changeset *cs)
+{
+	redislite_wal *wal = cs->db->wal;
+	size_t length = pages_to_save(cs);
+	if (length == 0) {
+		return REDISLITE_OK;
+	}
+	size_t frame_size = redislite_wal_frame_size(wal);
+	unsigned char *frames = write_buffer(cs->db, frame_size * length);
+	if (frames == NULL) {
 		return REDISLITE_OOM;
 	}
 
-	int status = REDISLITE_OK;
-	for (i = 0; i < cs->modified_pages_length; ++i) {
+	size_t i;
+	for (i = 0; i < length; ++i) {
 		redislite_page *page = cs->modified_pages[i];
+		unsigned char *frame = &frames[frame_size * i];
+		encode_page(cs, page, &frame[WAL_FRAME_HEADER_SIZE]);
+		redislite_wal_frame(wal, frame, page->number, i == length - 1 ? cs->db->number_of_pages : 0);
+	}
+	int status = redislite_wal_append(wal, frames, length);
 
-		memset(&data[0], '\0', cs->db->page_size); // TODO: we could allow garbage on unused bytes
-		if (i == 0 && page->number == 0) {
-			memcpy(data, HEADER_STRING, sizeof(HEADER_STRING));
-			data[20] = (cs->db->page_size >> 8); // page size
-			data[21] = (cs->db->page_size); // page size
-			data[22] = WRITE_FORMAT_VERSION; // write format version
-			data[23] = READ_FORMAT_VERSION; // read format version
-			redislite_put_4bytes(&data[24], 0); // reserved
-			redislite_put_4bytes(&data[28], cs->db->number_of_pages);
-			redislite_put_4bytes(&data[32], cs->db->first_freelist_page);
-			redislite_put_4bytes(&data[36], cs->db->number_of_freelist_pages);
-			redislite_write_first(cs->db, &data[100], (redislite_page_index_first *)cs->db->root);
+	if (status == REDISLITE_OK && redislite_wal_needs_checkpoint(wal)) {
+		// the commit is already safe in the log, a failed checkpoint is retried on the next one
+		redislite_wal_checkpoint(wal, cs->db->fd);
+	}
+	return status;
+}
+
+/*
+ * Grows the file by whole extents, so a bulk load does not extend it (and
+ * update its metadata) on every commit. The preallocated tail is only
+ * used as number_of_pages catches up with it.
+ */
+static void reserve_pages(redislite *db)
+{
+	if (db->extent_size == 0 || db->number_of_pages <= db->allocated_pages) {
+		return;
+	}
+	off_t extent = (off_t)db->extent_size;
+	off_t size = ((off_t)db->page_size * db->number_of_pages + extent - 1) / extent * extent;
+	off_t allocated = (off_t)db->page_size * db->allocated_pages;
+#ifdef __linux__
+	int status = posix_fallocate(db->fd, allocated, size - allocated);
+#else
+	int status = ftruncate(db->fd, size); // no preallocation, but still one size update per extent
+#endif
+	// on failure the writes below still grow the file, a page at a time
+	if (status == 0) {
+		db->allocated_pages = (int)(size / db->page_size);
+	}
+}
+
+/*
+ * modified_pages is sorted by page number, so pages that sit next to each
+ * other on disk are encoded next to each other in the write buffer and go
+ * out with a single write.
+ */
+static int save_changeset_pages(changeset *cs)
+{
+	redislite *db = cs->db;
+	size_t max_run = MAX_WRITE_BUFFER_SIZE / db->page_size;
+	if (max_run == 0) {
+		max_run = 1;
+	}
+
+	reserve_pages(db);
+	size_t length = pages_to_save(cs);
+	size_t i = 0, j, k;
+	while (i < length) {
+		int first = ((redislite_page *)cs->modified_pages[i])->number;
+		j = i + 1;
+		while (j < length && j - i < max_run &&
+		        ((redislite_page *)cs->modified_pages[j])->number == first + (int)(j - i)) {
+			j++;
 		}
-		else {
-			page->type->write_function(cs->db, &data[0], page->data);
+
+		unsigned char *data = write_buffer(db, db->page_size * (j - i));
+		if (data == NULL) {
+			return REDISLITE_OOM;
+		}
+		for (k = i; k < j; k++) {
+			encode_page(cs, cs->modified_pages[k], &data[db->page_size * (k - i)]);
 		}
-		fseek(file, cs->db->page_size * page->number, SEEK_SET);
-		if (fwrite(data, sizeof(unsigned char), cs->db->page_size, file) < cs->db->page_size) {
-			fprintf(stderr, "Unable to write to file '%s'\n", cs->db->filename);
-			status = REDISLITE_ERR;
-			break;
+		if (redislite_write_fully(db->fd, data, db->page_size * (j - i), (off_t)db->page_size * first) != REDISLITE_OK) {
+			fprintf(stderr, "Unable to write to file '%s'\n", db->filename);
+			return REDISLITE_ERR;
 		}
+		i = j;
+	}
+	if (db->number_of_pages > db->allocated_pages) {
+		db->allocated_pages = db->number_of_pages;
+	}
+	return REDISLITE_OK;
+}
+
+/*
+ * FULL syncs every commit. NORMAL leaves it to the background flusher when
+ * there is one, and otherwise syncs the write-ahead log once every
+ * group_commit commits (without a log, once the database is closed).
+ * OFF never syncs.
+ */
+static int sync_commit(redislite *db)
+{
+	redislite_wal *wal = db->wal;
+	if (db->synchronous == REDISLITE_SYNCHRONOUS_OFF) {
+		return REDISLITE_OK;
+	}
+	if (db->synchronous == REDISLITE_SYNCHRONOUS_NORMAL) {
+		if (db->flusher) {
+			redislite_flusher_mark_dirty(db->flusher);
+			return REDISLITE_OK;
+		}
+		if (wal == NULL || wal->pending_commits < wal->group_commit) {
+			return REDISLITE_OK;
+		}
+	}
+	if (wal) {
+		return redislite_wal_sync(wal);
+	}
+	return fsync(db->fd) == 0 ? REDISLITE_OK : REDISLITE_ERR;
+}
+
+static int compare_pages(const void *a, const void *b)
+{
+	return (*(redislite_page *const *)a)->number - (*(redislite_page *const *)b)->number;
+}
+
+/*
+ * Pages are appended to modified_pages as they are changed and only sorted
+ * here, so runs of adjacent pages can be written together.
+ */
+static void sort_modified_pages(changeset *cs)
+{
+	qsort(cs->modified_pages, cs->modified_pages_length, sizeof(void *), compare_pages);
+	size_t i;
+	for (i = 0; i < cs->modified_pages_length; i++) {
+		index_find(cs, ((redislite_page *)cs->modified_pages[i])->number)->modified = (int)i;
+	}
+}
+
+// a VACUUM of another handle renamed a new file over the one `db` has open
+static int replaced(redislite *db)
+{
+	struct stat st;
+	return db->fd != -1 && fstat(db->fd, &st) == 0 && st.st_nlink == 0;
+}
+
+int redislite_save_changeset(changeset *cs)
+{
+	int status;
+	if (cs->modified_pages_length > 0 && replaced(cs->db)) {
+		return REDISLITE_ERR;
+	}
+	if (cs->modified_pages_length > 0 && cs->db->format_version < READ_FORMAT_VERSION) {
+		// older readers would misread the pages written now, the header tells them not to
+		status = redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, cs->db->root);
+		if (status < 0) {
+			return status;
+		}
+	}
+	if (cs->modified_pages_length > 1) {
+		sort_modified_pages(cs);
+	}
+	if (cs->db->wal) {
+		status = save_changeset_wal(cs);
+	}
+	else {
+		status = save_changeset_pages(cs);
+	}
+	trim_write_buffer(cs->db);
+	if (status == REDISLITE_OK && cs->modified_pages_length > 0) {
+		status = sync_commit(cs->db);
+	}
+	if (status == REDISLITE_OK) {
+		cs->saved = 1;
+		cs->db->format_version = READ_FORMAT_VERSION;
+		redislite_vacuum_track(cs);
 	}
-	redislite_free(data);
-	fclose(file);
 	return status;
 }
 
 int redislite_add_opened_page(changeset *cs, int page_number, char type, void *page_data)
 {
-	// TODO: verify binary search
-	if (page_number != -1) {
-		int min = 0, max = cs->opened_pages_length - 1, i;
-		while (min < max) {
-			i = (min + max) / 2;
-			if (((redislite_page *)cs->opened_pages[i])->number > page_number) {
-				max = i - 1;
-			}
-			else if (((redislite_page *)cs->opened_pages[i])->number < page_number) {
-				min = i + 1;
-			}
-			else {
-				return i;
-			}
-		}
+	if (page_number != -1 && redislite_opened_page(cs, page_number) != NULL) {
+		return page_number;
 	}
 
 	if (cs->opened_pages == NULL || (cs->opened_pages_length == 0 && cs->opened_pages_free == 0)) {
@@ -170,6 +458,13 @@ int redislite_add_opened_page(changeset *cs, int page_number, char type, void *p
 		cs->opened_pages = opened_pages;
 		cs->opened_pages_free = cs->opened_pages_length;
 	}
+	changeset_slot *slot = NULL;
+	if (page_number != -1) {
+		slot = index_add(cs, page_number);
+		if (slot == NULL) {
+			return REDISLITE_OOM;
+		}
+	}
 	redislite_page *page = (redislite_page *)redislite_malloc(sizeof(redislite_page));
 	if (page == NULL) {
 		return REDISLITE_OOM;
@@ -177,37 +472,11 @@ int redislite_add_opened_page(changeset *cs, int page_number, char type, void *p
 	page->type = redislite_page_get_type(cs->db, type);
 	page->number = page_number;
 	page->data = page_data;
-	size_t pos;
-
-	// TODO: verify binary search
-	{
-		int min = 0, max = cs->opened_pages_length - 1, i;
-		while (min < max) {
-			i = (min + max) / 2;
-			if (((redislite_page *)cs->opened_pages[i])->number > page_number) {
-				max = i - 1;
-			}
-			else if (((redislite_page *)cs->opened_pages[i])->number < page_number) {
-				min = i + 1;
-			}
-			else {
-				min = max = i;
-			}
-		}
-		pos = min;
-	}
 
-	size_t i;
-	if (cs->opened_pages_length > 0) {
-		for (i = cs->opened_pages_length - 1; i >= pos; i--) {
-			cs->opened_pages[i + 1] = cs->opened_pages[i];
-			if (i == 0) {
-				break;
-			}
-		}
+	if (slot) {
+		slot->opened = (int)cs->opened_pages_length;
 	}
-
-	cs->opened_pages[pos] = page;
+	cs->opened_pages[cs->opened_pages_length] = page;
 	cs->opened_pages_length++;
 	cs->opened_pages_free--;
 
@@ -216,22 +485,28 @@ int redislite_add_opened_page(changeset *cs, int page_number, char type, void *p
 
 int redislite_close_opened_page(changeset *cs, int page_number)
 {
-	size_t i;
-	redislite_page *page;
-	for (i = 0; i < cs->opened_pages_length; i++) {
-		page = cs->opened_pages[i];
-		if (page->number == page_number) {
-			page->type->free_function(cs->db, page->data);
-			redislite_free(page);
-			for (; i < cs->opened_pages_length - 1; i++) {
-				cs->opened_pages[i] = cs->opened_pages[i + 1];
-			}
-			cs->opened_pages_length--;
-			cs->opened_pages_free++;
-			break;
-		}
-		if (page->number > page_number) {
-			break;
+	changeset_slot *slot = index_find(cs, page_number);
+	if (slot == NULL || slot->opened == -1) {
+		return REDISLITE_OK;
+	}
+	size_t pos = (size_t)slot->opened;
+	redislite_page *page = cs->opened_pages[pos];
+	// the same object may also be listed as modified, its owner frees it
+	redislite_page *modified = redislite_modified_page(cs, page_number);
+	if ((modified == NULL || modified->data != page->data) && !redislite_page_cache_owns(cs->db->page_cache, page->number, page->data)) {
+		page->type->free_function(cs->db, page->data);
+	}
+	redislite_free(page);
+	slot->opened = -1;
+
+	// the last page takes its place
+	cs->opened_pages_length--;
+	cs->opened_pages_free++;
+	if (pos != cs->opened_pages_length) {
+		redislite_page *last = cs->opened_pages[cs->opened_pages_length];
+		cs->opened_pages[pos] = last;
+		if (last->number != -1) {
+			index_find(cs, last->number)->opened = (int)pos;
 		}
 	}
 	return REDISLITE_OK;
@@ -243,32 +518,28 @@ int redislite_add_modified_page(changeset *cs, int page_number, char type, void
 		return REDISLITE_READONLY;
 	}
 
-	if (page_number != -1) {
-		redislite_page *page = redislite_modified_page(cs, page_number);
-		if (page) {
-			if (page->data != page_data) {
-				redislite_close_opened_page(cs, page_number);
-				page->type->free_function(cs->db, page->data);
-				page->type = redislite_page_get_type(cs->db, type);
-				page->data = page_data;
-			}
+	if (page_number == -1) {
+		page_number = redislite_freelist_pop(cs);
+		if (page_number < 0) {
 			return page_number;
 		}
+		if (page_number == 0) {
+			page_number = cs->db->number_of_pages;
+		}
 	}
 
-	if (page_number == -1) {
-		if (cs->db->first_freelist_page) {
-			page_number = cs->db->first_freelist_page;
-			redislite_page_freelist *freelist_page = redislite_page_get(cs->db, cs, page_number, REDISLITE_PAGE_TYPE_FREELIST);
-			if (freelist_page == NULL) {
-				return REDISLITE_OOM;
+	// also catches a page freed and reused by the same changeset
+	redislite_page *modified = redislite_modified_page(cs, page_number);
+	if (modified) {
+		if (modified->data != page_data) {
+			redislite_close_opened_page(cs, page_number);
+			if (!redislite_page_cache_owns(cs->db->page_cache, page_number, modified->data)) {
+				modified->type->free_function(cs->db, modified->data);
 			}
-			cs->db->first_freelist_page = freelist_page->right_page;
-			redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, cs->db->root);
-		}
-		else {
-			page_number = cs->db->number_of_pages;
+			modified->type = redislite_page_get_type(cs->db, type);
+			modified->data = page_data;
 		}
+		return page_number;
 	}
 
 	if (cs->modified_pages == NULL || (cs->modified_pages_length == 0 && cs->modified_pages_free == 0)) {
@@ -287,6 +558,10 @@ int redislite_add_modified_page(changeset *cs, int page_number, char type, void
 		cs->modified_pages = modified_pages;
 		cs->modified_pages_free = cs->modified_pages_length;
 	}
+	changeset_slot *slot = index_add(cs, page_number);
+	if (slot == NULL) {
+		return REDISLITE_OOM;
+	}
 	redislite_page *page = (redislite_page *)redislite_malloc(sizeof(redislite_page));
 	if (page == NULL) {
 		return REDISLITE_OOM;
@@ -294,29 +569,10 @@ int redislite_add_modified_page(changeset *cs, int page_number, char type, void
 	page->type = redislite_page_get_type(cs->db, type);
 	page->number = page_number;
 	page->data = page_data;
-	size_t pos = 0;
-
-	// TODO: binary search
-	size_t i;
-	for (i = 0; i < cs->modified_pages_length; i++) {
-		if (((redislite_page *)cs->modified_pages[i])->number > page_number) {
-			break;
-		}
-		else {
-			pos = i + 1;
-		}
-	}
-
-	if (cs->modified_pages_length > 0) {
-		for (i = cs->modified_pages_length - 1; i >= pos; i--) {
-			cs->modified_pages[i + 1] = cs->modified_pages[i];
-			if (i == 0) {
-				break;
-			}
-		}
-	}
 
-	cs->modified_pages[pos] = page;
+	// sorted when the changeset is saved
+	slot->modified = (int)cs->modified_pages_length;
+	cs->modified_pages[cs->modified_pages_length] = page;
 	cs->modified_pages_length++;
 	cs->modified_pages_free--;
 	if (page_number >= cs->db->number_of_pages) {
@@ -326,61 +582,164 @@ int redislite_add_modified_page(changeset *cs, int page_number, char type, void
 	return page_number;
 }
 
-unsigned char *redislite_read_page(redislite *db, changeset *cs, int num)
+int redislite_map_database(redislite *db)
 {
-	unsigned char *data = redislite_malloc(sizeof(unsigned char) * db->page_size);
-	if (data == NULL) {
-		return NULL;
+	redislite_unmap_database(db);
+
+	struct stat st;
+	if (fstat(db->fd, &st) != 0) {
+		return REDISLITE_ERR;
 	}
-	// TODO: binary search
-	size_t i;
-	if (cs) {
-		for (i = 0; i < cs->modified_pages_length; i++) {
-			redislite_page *page = cs->modified_pages[i];
-			if (page->number == num) {
-				redislite_write_index(db, &data[0], page->data);
-				return data;
-			}
+	if (st.st_size == 0) {
+		return REDISLITE_OK;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, db->fd, 0);
+	if (map == MAP_FAILED) {
+		return REDISLITE_ERR;
+	}
+	db->map = map;
+	db->map_size = st.st_size;
+	return REDISLITE_OK;
+}
+
+void redislite_unmap_database(redislite *db)
+{
+	if (db->map != NULL) {
+		munmap(db->map, db->map_size);
+		db->map = NULL;
+		db->map_size = 0;
+	}
+}
+
+/*
+ * Pages returned by redislite_read_page may point into the mapping;
+ * use this instead of redislite_free to give them back.
+ */
+void redislite_release_page(redislite *db, unsigned char *data)
+{
+	if (db->map == NULL || data < db->map || data >= db->map + db->map_size) {
+		redislite_free(data);
+	}
+}
+
+unsigned char *redislite_read_page(redislite *db, changeset *cs, int num)
+{
+	unsigned char *data = NULL;
+	redislite_page *page = cs ? redislite_modified_page(cs, num) : NULL;
+	if (page) {
+		data = redislite_malloc(sizeof(unsigned char) * db->page_size);
+		if (data == NULL) {
+			return NULL;
 		}
+		redislite_write_index(db, &data[0], page->data);
+		return data;
 	}
 
-	FILE *fp = fopen(db->filename, "rb");
-	if (!fp) {
-		fprintf(stderr, "Unable to open file '%s'\n", db->filename);
-		return NULL;
+	if (db->wal) {
+		// committed pages that were not checkpointed yet live in the log
+		data = redislite_malloc(sizeof(unsigned char) * db->page_size);
+		if (data == NULL) {
+			return NULL;
+		}
+		int status = redislite_wal_read_page(db->wal, num, data);
+		if (status == REDISLITE_OK) {
+			return data;
+		}
+		if (status != REDISLITE_NOT_FOUND) {
+			redislite_free(data);
+			return NULL;
+		}
 	}
-#ifdef DEBUG
-	fseek(fp, 0L, SEEK_END);
-	long size = ftell(fp);
-	/*
-		if (size < db->page_size * (num + 1)) {
+
+	if (db->flags & REDISLITE_OPEN_MMAP) {
+		size_t end = (size_t)db->page_size * (num + 1);
+		if (end > db->map_size) {
+			// the file grew since it was mapped
+			redislite_map_database(db);
+		}
+		if (end <= db->map_size) {
 			redislite_free(data);
+			return &db->map[(size_t)db->page_size * num];
+		}
+	}
+
+	if (data == NULL) {
+		data = redislite_malloc(sizeof(unsigned char) * db->page_size);
+		if (data == NULL) {
 			return NULL;
 		}
-	*/
-#endif
-	i = fseek(fp, (long)db->page_size * num, SEEK_SET);
-	if (i != 0) {
-		fprintf(stdout, "fseek returned %lu\n", (unsigned long)i);
 	}
-	size_t read = fread(data, sizeof(unsigned char), db->page_size, fp);
-	if (read < db->page_size && ferror(fp)) {
+
+	ssize_t bytes_read = redislite_read_fully(db->fd, data, db->page_size, (off_t)db->page_size * num);
+	if (bytes_read < 0) {
 		printf("Error reading\n");
 	}
-#ifdef DEBUG
-	if (read < db->page_size && feof(fp)) {
-		printf("Early EOF (seek to pos %ld, size was %ld, attempt to read %d)\n", (long)db->page_size * num, size, db->page_size);
-	}
-#else
-	if (read < db->page_size && feof(fp)) {
+	else if ((size_t)bytes_read < db->page_size) {
 		printf("Early EOF (seek to pos %lu, attempt to read %lu)\n", (unsigned long)db->page_size * num, (unsigned long)db->page_size);
 	}
-#endif
-	fclose(fp);
-	if (read < db->page_size) {
+	if (bytes_read < 0 || (size_t)bytes_read < db->page_size) {
 		redislite_free(data);
 		return NULL;
 	}
 
 	return data;
 }
+
+/*
+ * Copies `length` bytes from `offset` of the run of pages starting at `num`,
+ * at once unless a page of the run has a newer image than the file.
+ */
+int redislite_read_run(redislite *db, changeset *cs, int num, size_t offset, size_t length, char *data)
+{
+	int first = num + offset / db->page_size;
+	int last = num + (offset + length - 1) / db->page_size;
+	int i, direct = db->wal == NULL || ((redislite_wal *)db->wal)->index_used == 0;
+	for (i = first; direct && cs && i <= last; i++) {
+		direct = redislite_modified_page(cs, i) == NULL;
+	}
+
+	off_t start = (off_t)db->page_size * num + offset;
+	if (direct && db->flags & REDISLITE_OPEN_MMAP) {
+		if ((size_t)start + length > db->map_size) {
+			redislite_map_database(db);
+		}
+		if ((size_t)start + length <= db->map_size) {
+			memcpy(data, &db->map[start], length);
+			return REDISLITE_OK;
+		}
+	}
+	if (direct) {
+		ssize_t bytes_read = redislite_read_fully(db->fd, (unsigned char *)data, length, start);
+		return bytes_read >= 0 && (size_t)bytes_read == length ? REDISLITE_OK : REDISLITE_ERR;
+	}
+
+	unsigned char *page_data = redislite_malloc(sizeof(unsigned char) * db->page_size);
+	if (page_data == NULL) {
+		return REDISLITE_OOM;
+	}
+	size_t pos = offset % db->page_size, size;
+	for (i = first; i <= last; i++) {
+		redislite_page *page = cs ? redislite_modified_page(cs, i) : NULL;
+		unsigned char *read = page_data;
+		if (page) {
+			page->type->write_function(db, page_data, page->data);
+		}
+		else {
+			read = redislite_read_page(db, cs, i);
+			if (read == NULL) {
+				redislite_free(page_data);
+				return REDISLITE_ERR;
+			}
+		}
+		size = MIN(length, db->page_size - pos);
+		memcpy(data, &read[pos], size);
+		if (read != page_data) {
+			redislite_release_page(db, read);
+		}
+		data += size;
+		length -= size;
+		pos = 0;
+	}
+	redislite_free(page_data);
+	return REDISLITE_OK;
+}
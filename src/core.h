@@ -4,10 +4,22 @@
 
 #define HEADER_STRING "Redislite format 1"
 #define DEFAULT_PAGE_SIZE 512
+#define MIN_PAGE_SIZE 512
+#define MAX_PAGE_SIZE 65536
 #define DEFAULT_MODIFIED_PAGE_SIZE 4
 #define DEFAULT_OPENED_PAGE_SIZE 32
-#define WRITE_FORMAT_VERSION 1
-#define READ_FORMAT_VERSION 1
+#define DEFAULT_CHANGESET_INDEX_SIZE 16
+#define WRITE_BUFFER_ALIGNMENT 4096
+#define MAX_WRITE_BUFFER_SIZE (1024 * 1024)
+// 2: front coded index pages, strings inline, on heap pages, in extents and as integers
+#define WRITE_FORMAT_VERSION 2
+#define READ_FORMAT_VERSION 2
+
+typedef struct {
+	int number; // -1 for an empty slot
+	int opened; // position in opened_pages, -1 if it is not there
+	int modified; // position in modified_pages, -1 if it is not there
+} changeset_slot;
 
 typedef struct {
 	redislite *db;
@@ -18,15 +30,30 @@ typedef struct {
 
 	size_t modified_pages_length;
 	size_t modified_pages_free;
-	void **modified_pages;
+	void **modified_pages; // sorted by page number once saved
+
+	// page number to its positions in both arrays, open addressing
+	size_t index_alloced;
+	size_t index_used;
+	changeset_slot *index;
+
+	int saved; // modified pages reached the disk and can be handed to the page cache
 } changeset;
 
 changeset *redislite_create_changeset(redislite *db);
 void redislite_free_changeset(changeset *cs);
 int redislite_save_changeset(changeset *cs);
 unsigned char *redislite_read_page(redislite *db, changeset *cs, int num);
+void redislite_release_page(redislite *db, unsigned char *data);
+int redislite_map_database(redislite *db);
+void redislite_unmap_database(redislite *db);
 redislite_page *redislite_modified_page(changeset *cs, int page_number);
+redislite_page *redislite_opened_page(changeset *cs, int page_number);
 int redislite_add_modified_page(changeset *cs, int page_number, char type, void *page_data);
 int redislite_add_opened_page(changeset *cs, int page_number, char type, void *page_data);
+int redislite_valid_page_size(size_t page_size);
+void redislite_put_page_size(unsigned char *p, size_t page_size);
+size_t redislite_get_page_size(const unsigned char *p);
 int redislite_set_root(redislite *db, redislite_page_index_first *page);
 int redislite_close_opened_page(changeset *cs, int page_number);
+int redislite_read_run(redislite *db, changeset *cs, int num, size_t offset, size_t length, char *data);
@@ -0,0 +1,90 @@
+#include "fmacros.h"
+#include "redislite.h"
+#include "flusher.h"
+#include <time.h>
+#include <unistd.h>
+
+static void flush(redislite_flusher *flusher)
+{
+	fsync(flusher->fd);
+	if (flusher->wal_fd != -1) {
+		fsync(flusher->wal_fd);
+	}
+}
+
+static void *flusher_main(void *arg)
+{
+	redislite_flusher *flusher = (redislite_flusher *)arg;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&flusher->lock);
+	while (!flusher->stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += flusher->interval / 1000;
+		deadline.tv_nsec += (long)(flusher->interval % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while (!flusher->stop && pthread_cond_timedwait(&flusher->cond, &flusher->lock, &deadline) == 0);
+
+		if (flusher->dirty) {
+			flusher->dirty = 0;
+			// commits keep going while we wait on the disk
+			pthread_mutex_unlock(&flusher->lock);
+			flush(flusher);
+			pthread_mutex_lock(&flusher->lock);
+		}
+	}
+	pthread_mutex_unlock(&flusher->lock);
+	return NULL;
+}
+
+redislite_flusher *redislite_flusher_start(int fd, int wal_fd, int interval)
+{
+	redislite_flusher *flusher = redislite_malloc(sizeof(redislite_flusher));
+	if (flusher == NULL) {
+		return NULL;
+	}
+	flusher->interval = interval;
+	flusher->fd = fd;
+	flusher->wal_fd = wal_fd;
+	flusher->dirty = 0;
+	flusher->stop = 0;
+	pthread_mutex_init(&flusher->lock, NULL);
+	pthread_cond_init(&flusher->cond, NULL);
+	if (pthread_create(&flusher->thread, NULL, flusher_main, flusher) != 0) {
+		pthread_mutex_destroy(&flusher->lock);
+		pthread_cond_destroy(&flusher->cond);
+		redislite_free(flusher);
+		return NULL;
+	}
+	return flusher;
+}
+
+void redislite_flusher_mark_dirty(redislite_flusher *flusher)
+{
+	pthread_mutex_lock(&flusher->lock);
+	flusher->dirty = 1;
+	pthread_mutex_unlock(&flusher->lock);
+}
+
+// flushes whatever is still pending and waits for the thread to exit
+void redislite_flusher_stop(redislite_flusher *flusher)
+{
+	if (flusher == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&flusher->lock);
+	flusher->stop = 1;
+	pthread_cond_signal(&flusher->cond);
+	pthread_mutex_unlock(&flusher->lock);
+	pthread_join(flusher->thread, NULL);
+
+	if (flusher->dirty) {
+		flush(flusher);
+	}
+	pthread_mutex_destroy(&flusher->lock);
+	pthread_cond_destroy(&flusher->cond);
+	redislite_free(flusher);
+}
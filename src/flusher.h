@@ -0,0 +1,25 @@
+#ifndef _FLUSHER_H
+#define _FLUSHER_H
+
+#include <pthread.h>
+
+/*
+ * Background thread that fsyncs the database (and its write-ahead log) at
+ * most `interval` milliseconds after a commit marked it dirty, so a burst
+ * of commits shares a single fsync.
+ */
+typedef struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int interval; // milliseconds
+	int fd;
+	int wal_fd; // -1 without a write-ahead log
+	int dirty;
+	int stop;
+} redislite_flusher;
+
+redislite_flusher *redislite_flusher_start(int fd, int wal_fd, int interval);
+void redislite_flusher_mark_dirty(redislite_flusher *flusher);
+void redislite_flusher_stop(redislite_flusher *flusher);
+#endif
@@ -758,6 +758,13 @@ struct commandHelp {
 		7,
 		"2.1.0"
 	},
+	{
+		"VACUUM",
+		"[STEP pages]",
+		"Rebuild the database file without its free pages, or with STEP move at most that many pages from its end",
+		9,
+		"0.0"
+	},
 	{
 		"WATCH",
 		"key [key ...]",
@@ -3,6 +3,7 @@
 #include "core.h"
 #include "page_index.h"
 #include "page_freelist.h"
+#include "page_cache.h"
 
 void *redislite_page_get(void *_db, void *_cs, int num, char type)
 {
@@ -10,14 +11,16 @@ void *redislite_page_get(void *_db, void *_cs, int num, char type)
 	redislite *db = (redislite *)_db;
 	if (cs) {
 		redislite_page *page = redislite_modified_page(cs, num);
+		if (page == NULL) {
+			page = redislite_opened_page(cs, num);
+		}
 		if (page != NULL) {
 			return page->data;
 		}
-		size_t i;
-		for (i = 0; i < cs->opened_pages_length; i++) {
-			redislite_page *page = cs->opened_pages[i];
-			if (page->number == num) {
-				return page->data;
+		if (num != 0) {
+			void *cached = redislite_page_cache_get(db->page_cache, num, type);
+			if (cached != NULL) {
+				return cached;
 			}
 		}
 	}
@@ -30,11 +33,15 @@ void *redislite_page_get(void *_db, void *_cs, int num, char type)
 	redislite_page_type *page_type = redislite_page_get_type(db, type);
 	if (page_type) {
 		result = page_type->read_function(db, data);
-		if (cs) {
-			redislite_add_opened_page(cs, num, type, result);
+		// without a changeset the caller owns the result; otherwise it is
+		// kept by the shared cache or, if the cache refuses it, by the changeset
+		if (cs && result) {
+			if (num == 0 || redislite_page_cache_add(db->page_cache, num, type, result) != REDISLITE_OK) {
+				redislite_add_opened_page(cs, num, type, result);
+			}
 		}
 	}
-	redislite_free(data);
+	redislite_release_page(db, data);
 	return result;
 }
 
@@ -59,23 +66,7 @@ int redislite_page_delete(void *_cs, int num, char type)
 		page_type->delete_function(cs, data);
 	}
 
-	redislite_page_freelist *page = redislite_malloc(sizeof(redislite_page_freelist));
-	if (page == NULL) {
-		return REDISLITE_OOM;
-	}
-	page->right_page = db->first_freelist_page;
-	db->first_freelist_page = num; // TODO: multithread safeness
-	int status = redislite_add_modified_page(cs, num, REDISLITE_PAGE_TYPE_FREELIST, page);
-	if (status < 0) {
-		redislite_free(page);
-	}
-	else {
-		status = redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, db->root);
-		if (status < 0) {
-			redislite_free(page);
-		}
-	}
-	return status;
+	return redislite_freelist_push(cs, num);
 }
 
 int redislite_page_register_type(void *_db, redislite_page_type *type)
@@ -84,7 +75,6 @@ int redislite_page_register_type(void *_db, redislite_page_type *type)
 	if (db->types == NULL) {
 		db->types = redislite_malloc(sizeof(redislite_page_type *) * 256);
 		if (db->types == NULL) {
-			redislite_close_database(db);
 			return REDISLITE_OOM;
 		}
 		int i;
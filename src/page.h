@@ -5,10 +5,19 @@
 #define REDISLITE_PAGE_TYPE_INDEX 'I'
 #define REDISLITE_PAGE_TYPE_STRING 'S'
 #define REDISLITE_PAGE_TYPE_STRING_OVERFLOW 'O'
+// the rest of a long string, on consecutive pages
+#define REDISLITE_PAGE_TYPE_STRING_EXTENT 'X'
+#define REDISLITE_PAGE_TYPE_STRING_DIRECTORY 'D'
 #define REDISLITE_PAGE_TYPE_FREELIST 'R'
 #define REDISLITE_PAGE_TYPE_LIST 'L'
 #define REDISLITE_PAGE_TYPE_LIST_FIRST 'M'
 #define REDISLITE_PAGE_TYPE_SET 'E'
+// only a key type: the string is in the key's entry, there is no page
+#define REDISLITE_PAGE_TYPE_STRING_INLINE 'T'
+// strings too long to be inline, packed many to a page
+#define REDISLITE_PAGE_TYPE_HEAP 'H'
+// only a key type: a 64 bit integer in the key's entry, written as text when read
+#define REDISLITE_PAGE_TYPE_STRING_INTEGER 'N'
 
 typedef struct {
 	char identifier;
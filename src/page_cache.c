@@ -0,0 +1,258 @@
+#include "redislite.h"
+#include "page_cache.h"
+
+#define DEFAULT_PAGE_CACHE_BUCKETS 16
+
+static size_t bucket_for_number(redislite_page_cache *cache, int number)
+{
+	return (size_t)(unsigned int)number & (cache->buckets_length - 1);
+}
+
+static int find_entry(redislite_page_cache *cache, int number)
+{
+	int i = cache->buckets[bucket_for_number(cache, number)];
+	while (i != -1 && cache->entries[i].number != number) {
+		i = cache->entries[i].next;
+	}
+	return i;
+}
+
+static int *link_to_entry(redislite_page_cache *cache, int pos)
+{
+	int *link = &cache->buckets[bucket_for_number(cache, cache->entries[pos].number)];
+	while (*link != pos) {
+		link = &cache->entries[*link].next;
+	}
+	return link;
+}
+
+static void rehash(redislite_page_cache *cache)
+{
+	size_t i;
+	for (i = 0; i < cache->buckets_length; i++) {
+		cache->buckets[i] = -1;
+	}
+	for (i = 0; i < cache->length; i++) {
+		size_t bucket = bucket_for_number(cache, cache->entries[i].number);
+		cache->entries[i].next = cache->buckets[bucket];
+		cache->buckets[bucket] = (int)i;
+	}
+}
+
+static int grow(redislite_page_cache *cache)
+{
+	if (cache->length == cache->alloced) {
+		size_t alloced = cache->alloced * 2;
+		redislite_page_cache_entry *entries = redislite_realloc(cache->entries, sizeof(redislite_page_cache_entry) * alloced);
+		if (entries == NULL) {
+			return REDISLITE_OOM;
+		}
+		cache->entries = entries;
+		cache->alloced = alloced;
+	}
+	if (cache->length == cache->buckets_length) {
+		size_t buckets_length = cache->buckets_length * 2;
+		int *buckets = redislite_realloc(cache->buckets, sizeof(int) * buckets_length);
+		if (buckets == NULL) {
+			return REDISLITE_OOM;
+		}
+		cache->buckets = buckets;
+		cache->buckets_length = buckets_length;
+		rehash(cache);
+	}
+	return REDISLITE_OK;
+}
+
+static void evict(redislite_page_cache *cache, int pos)
+{
+	redislite_page_cache_entry *entry = &cache->entries[pos];
+	entry->type->free_function(cache->db, entry->data);
+	*link_to_entry(cache, pos) = entry->next;
+
+	int last = (int)cache->length - 1;
+	if (pos != last) {
+		*link_to_entry(cache, last) = pos;
+		cache->entries[pos] = cache->entries[last];
+	}
+	cache->length--;
+}
+
+redislite_page_cache *redislite_page_cache_create(void *db, size_t size)
+{
+	redislite_page_cache *cache = redislite_malloc(sizeof(redislite_page_cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->db = db;
+	cache->size = size;
+	cache->length = 0;
+	cache->hand = 0;
+	cache->alloced = DEFAULT_PAGE_CACHE_BUCKETS;
+	cache->buckets_length = DEFAULT_PAGE_CACHE_BUCKETS;
+	cache->entries = redislite_malloc(sizeof(redislite_page_cache_entry) * cache->alloced);
+	cache->buckets = redislite_malloc(sizeof(int) * cache->buckets_length);
+	if (cache->entries == NULL || cache->buckets == NULL) {
+		redislite_free(cache->entries);
+		redislite_free(cache->buckets);
+		redislite_free(cache);
+		return NULL;
+	}
+	rehash(cache);
+	return cache;
+}
+
+void redislite_page_cache_free(redislite_page_cache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+	redislite_page_cache_clear(cache);
+	redislite_free(cache->entries);
+	redislite_free(cache->buckets);
+	redislite_free(cache);
+}
+
+void *redislite_page_cache_get(redislite_page_cache *cache, int number, char type)
+{
+	if (cache == NULL) {
+		return NULL;
+	}
+	int pos = find_entry(cache, number);
+	if (pos == -1 || cache->entries[pos].type->identifier != type) {
+		return NULL;
+	}
+	cache->entries[pos].referenced = 1;
+	return cache->entries[pos].data;
+}
+
+static int insert(redislite_page_cache *cache, int number, redislite_page_type *page_type, void *data)
+{
+	int status = grow(cache);
+	if (status != REDISLITE_OK) {
+		return status;
+	}
+	size_t bucket = bucket_for_number(cache, number);
+	redislite_page_cache_entry *entry = &cache->entries[cache->length];
+	entry->number = number;
+	entry->type = page_type;
+	entry->data = data;
+	entry->referenced = 1;
+	entry->next = cache->buckets[bucket];
+	cache->buckets[bucket] = (int)cache->length;
+	cache->length++;
+	return REDISLITE_OK;
+}
+
+/*
+ * Hands `data` over to the cache unless the page is already cached.
+ * On any status other than REDISLITE_OK the caller keeps ownership.
+ */
+int redislite_page_cache_add(redislite_page_cache *cache, int number, char type, void *data)
+{
+	if (cache == NULL || cache->size == 0) {
+		return REDISLITE_SKIP;
+	}
+	redislite_page_type *page_type = redislite_page_get_type(cache->db, type);
+	if (page_type == NULL) {
+		return REDISLITE_SKIP;
+	}
+	if (find_entry(cache, number) != -1) {
+		return REDISLITE_ALREADY_EXISTS;
+	}
+	return insert(cache, number, page_type, data);
+}
+
+/*
+ * Like redislite_page_cache_add, but replaces (and frees) any other object
+ * cached for the same page. Used to write committed pages through.
+ */
+int redislite_page_cache_put(redislite_page_cache *cache, int number, char type, void *data)
+{
+	if (cache == NULL || cache->size == 0) {
+		return REDISLITE_SKIP;
+	}
+	redislite_page_type *page_type = redislite_page_get_type(cache->db, type);
+	if (page_type == NULL) {
+		return REDISLITE_SKIP;
+	}
+	int pos = find_entry(cache, number);
+	if (pos != -1) {
+		redislite_page_cache_entry *entry = &cache->entries[pos];
+		if (entry->data != data) {
+			entry->type->free_function(cache->db, entry->data);
+			entry->data = data;
+		}
+		entry->type = page_type;
+		entry->referenced = 1;
+		return REDISLITE_OK;
+	}
+	return insert(cache, number, page_type, data);
+}
+
+int redislite_page_cache_owns(redislite_page_cache *cache, int number, void *data)
+{
+	if (cache == NULL) {
+		return 0;
+	}
+	int pos = find_entry(cache, number);
+	return pos != -1 && cache->entries[pos].data == data;
+}
+
+void redislite_page_cache_trim(redislite_page_cache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+	while (cache->length > cache->size) {
+		if (cache->hand >= cache->length) {
+			cache->hand = 0;
+		}
+		redislite_page_cache_entry *entry = &cache->entries[cache->hand];
+		if (entry->referenced) {
+			entry->referenced = 0;
+			cache->hand++;
+		}
+		else {
+			evict(cache, (int)cache->hand);
+		}
+	}
+}
+
+void redislite_page_cache_clear(redislite_page_cache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+	size_t i;
+	for (i = 0; i < cache->length; i++) {
+		cache->entries[i].type->free_function(cache->db, cache->entries[i].data);
+	}
+	cache->length = 0;
+	cache->hand = 0;
+	rehash(cache);
+}
+
+// drops the pages past the end of a database that shrank
+void redislite_page_cache_truncate(redislite_page_cache *cache, int number_of_pages)
+{
+	if (cache == NULL) {
+		return;
+	}
+	// evict moves the last entry into the hole, walking down visits it first
+	size_t i = cache->length;
+	while (i > 0) {
+		i--;
+		if (cache->entries[i].number >= number_of_pages) {
+			evict(cache, (int)i);
+		}
+	}
+}
+
+void redislite_page_cache_resize(redislite_page_cache *cache, size_t size)
+{
+	if (cache == NULL) {
+		return;
+	}
+	cache->size = size;
+	redislite_page_cache_trim(cache);
+}
@@ -0,0 +1,45 @@
+#ifndef _PAGE_CACHE_H
+#define _PAGE_CACHE_H
+
+#include <stddef.h>
+#include "page.h"
+
+#define DEFAULT_PAGE_CACHE_SIZE 1024
+
+typedef struct {
+	int number;
+	redislite_page_type *type;
+	void *data;
+	int referenced;
+	int next; // next entry on the same bucket, -1 ends the chain
+} redislite_page_cache_entry;
+
+/*
+ * Decoded pages shared by every changeset of a database.
+ * Pages returned by redislite_page_cache_get are owned by the cache; a
+ * changeset must not free them. Eviction only happens on
+ * redislite_page_cache_trim, which is called once no changeset is using
+ * the cached objects anymore.
+ */
+typedef struct {
+	void *db;
+	size_t size; // maximum number of pages kept after a trim
+	size_t length;
+	size_t alloced;
+	size_t hand; // CLOCK hand, position on entries
+	size_t buckets_length; // always a power of two
+	int *buckets;
+	redislite_page_cache_entry *entries;
+} redislite_page_cache;
+
+redislite_page_cache *redislite_page_cache_create(void *db, size_t size);
+void redislite_page_cache_free(redislite_page_cache *cache);
+void *redislite_page_cache_get(redislite_page_cache *cache, int number, char type);
+int redislite_page_cache_add(redislite_page_cache *cache, int number, char type, void *data);
+int redislite_page_cache_put(redislite_page_cache *cache, int number, char type, void *data);
+int redislite_page_cache_owns(redislite_page_cache *cache, int number, void *data);
+void redislite_page_cache_trim(redislite_page_cache *cache);
+void redislite_page_cache_clear(redislite_page_cache *cache);
+void redislite_page_cache_truncate(redislite_page_cache *cache, int number_of_pages);
+void redislite_page_cache_resize(redislite_page_cache *cache, size_t size);
+#endif
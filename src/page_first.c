@@ -26,6 +26,9 @@ redislite_page_index_first *create_page_index_first(void *db)
 void redislite_free_first(void *_db, void *_page)
 {
 	redislite_page_index_first *page = (redislite_page_index_first *)_page;
+	if (page == NULL) {
+		return;
+	}
 	redislite_free_index(_db, page->page);
 	redislite_free(page);
 }
@@ -1,44 +1,358 @@
 #include "core.h"
-#include "page_string.h"
+#include "page.h"
+#include "page_freelist.h"
 #include "util.h"
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
 
+#define FREELIST_HEADER_SIZE 12
+// trunks looked at for a run of free pages
+#define FREELIST_RUN_TRUNKS 16
+
+// leaf page numbers that fit in a trunk page
+size_t redislite_freelist_capacity(void *_db)
+{
+	redislite *db = (redislite *)_db;
+	return (db->page_size - FREELIST_HEADER_SIZE) / 4;
+}
+
+redislite_page_freelist *redislite_create_freelist(void *_db, int right_page)
+{
+	redislite_page_freelist *page = redislite_malloc(sizeof(redislite_page_freelist));
+	if (page == NULL) {
+		return NULL;
+	}
+	// allocated at full capacity so freeing a page never reallocates
+	page->pages = redislite_malloc(sizeof(int) * redislite_freelist_capacity(_db));
+	if (page->pages == NULL) {
+		redislite_free(page);
+		return NULL;
+	}
+	page->db = _db;
+	page->right_page = right_page;
+	page->number_of_pages = 0;
+	return page;
+}
 
 void redislite_free_freelist(void *_db, void *_page)
 {
 	_db = _db; // XXX: avoid unused-parameter warning; we are implementing a prototype
-	redislite_page_string *page = (redislite_page_string *)_page;
+	redislite_page_freelist *page = (redislite_page_freelist *)_page;
 	if (page == NULL) {
 		return;
 	}
+	redislite_free(page->pages);
 	redislite_free(page);
 }
 
 void redislite_write_freelist(void *_db, unsigned char *data, void *_page)
 {
 	redislite *db = (redislite *)_db;
-	redislite_page_string *page = (redislite_page_string *)_page;
+	redislite_page_freelist *page = (redislite_page_freelist *)_page;
 	if (page == NULL) {
 		return;
 	}
 
 	redislite_put_4bytes(&data[0], 0); // reserverd
 	redislite_put_4bytes(&data[4], page->right_page);
-	size_t size = db->page_size - 8;
-	memset(&data[8], 0, size);
+	redislite_put_4bytes(&data[8], page->number_of_pages);
+	size_t i;
+	for (i = 0; i < page->number_of_pages; i++) {
+		redislite_put_4bytes(&data[FREELIST_HEADER_SIZE + i * 4], page->pages[i]);
+	}
+	size_t size = db->page_size - FREELIST_HEADER_SIZE - page->number_of_pages * 4;
+	memset(&data[FREELIST_HEADER_SIZE + page->number_of_pages * 4], 0, size);
 }
 
 void *redislite_read_freelist(void *_db, unsigned char *data)
 {
-	_db = _db; // XXX: avoid unused-parameter warning; we are implementing a prototype
-	redislite_page_string *page = redislite_malloc(sizeof(redislite_page_string));
+	redislite_page_freelist *page = redislite_create_freelist(_db, redislite_get_4bytes(&data[4]));
 	if (page == NULL) {
 		return NULL;
 	}
 
-	page->right_page = redislite_get_4bytes(&data[4]);
+	// pages freed before trunks existed were written with zeros here
+	page->number_of_pages = redislite_get_4bytes(&data[8]);
+	if (page->number_of_pages > redislite_freelist_capacity(_db)) {
+		page->number_of_pages = 0; // XXX: corrupted trunk, leak its leaves rather than reuse garbage
+	}
+	size_t i;
+	for (i = 0; i < page->number_of_pages; i++) {
+		page->pages[i] = redislite_get_4bytes(&data[FREELIST_HEADER_SIZE + i * 4]);
+	}
 
 	return page;
 }
+
+/*
+ * Adds a page to the freelist. It is listed in the first trunk when there is
+ * room, so only the trunk and the header are written; otherwise the page
+ * becomes the new first trunk.
+ */
+int redislite_freelist_push(void *_cs, int num)
+{
+	changeset *cs = (changeset *)_cs;
+	redislite *db = cs->db;
+	redislite_page_freelist *trunk = NULL;
+	int status;
+
+	if (db->first_freelist_page) {
+		trunk = redislite_page_get(db, cs, db->first_freelist_page, REDISLITE_PAGE_TYPE_FREELIST);
+		if (trunk == NULL) {
+			return REDISLITE_OOM;
+		}
+	}
+
+	if (trunk && trunk->number_of_pages < redislite_freelist_capacity(db)) {
+		trunk->pages[trunk->number_of_pages++] = num;
+		status = redislite_add_modified_page(cs, db->first_freelist_page, REDISLITE_PAGE_TYPE_FREELIST, trunk);
+		if (status < 0) {
+			trunk->number_of_pages--;
+			return status;
+		}
+	}
+	else {
+		redislite_page_freelist *page = redislite_create_freelist(db, db->first_freelist_page);
+		if (page == NULL) {
+			return REDISLITE_OOM;
+		}
+		status = redislite_add_modified_page(cs, num, REDISLITE_PAGE_TYPE_FREELIST, page);
+		if (status < 0) {
+			redislite_free_freelist(db, page);
+			return status;
+		}
+		db->first_freelist_page = num; // TODO: multithread safeness
+	}
+	db->number_of_freelist_pages++;
+	return redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, db->root);
+}
+
+/*
+ * Takes a page out of the freelist, 0 if it is empty. The last leaf of the
+ * first trunk is used first; a trunk without leaves is handed out itself.
+ */
+int redislite_freelist_pop(void *_cs)
+{
+	changeset *cs = (changeset *)_cs;
+	redislite *db = cs->db;
+	int page_number = db->first_freelist_page;
+	if (page_number == 0) {
+		return 0;
+	}
+
+	redislite_page_freelist *trunk = redislite_page_get(db, cs, page_number, REDISLITE_PAGE_TYPE_FREELIST);
+	if (trunk == NULL) {
+		return REDISLITE_OOM;
+	}
+	if (trunk->number_of_pages > 0) {
+		int status = redislite_add_modified_page(cs, page_number, REDISLITE_PAGE_TYPE_FREELIST, trunk);
+		if (status < 0) {
+			return status;
+		}
+		page_number = trunk->pages[--trunk->number_of_pages];
+	}
+	else {
+		db->first_freelist_page = trunk->right_page;
+	}
+	if (db->number_of_freelist_pages > 0) {
+		// databases written before trunks existed did not keep count
+		db->number_of_freelist_pages--;
+	}
+	int status = redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, db->root);
+	if (status < 0) {
+		return status;
+	}
+	return page_number;
+}
+
+static int compare_pages(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * The shortest run of consecutive pages listed in `trunk` that has `count`
+ * pages, or the longest one if none has. Returns its length and sets
+ * `start` to its first page.
+ */
+static int best_run(redislite_page_freelist *trunk, int count, int *start)
+{
+	if (trunk->number_of_pages == 0) {
+		return 0;
+	}
+	int *sorted = redislite_malloc(sizeof(int) * trunk->number_of_pages);
+	if (sorted == NULL) {
+		return REDISLITE_OOM;
+	}
+	memcpy(sorted, trunk->pages, sizeof(int) * trunk->number_of_pages);
+	qsort(sorted, trunk->number_of_pages, sizeof(int), compare_pages);
+	size_t i;
+	int run = 1, best = 0;
+	for (i = 1; i <= trunk->number_of_pages; i++) {
+		if (i < trunk->number_of_pages && sorted[i] == sorted[i - 1] + 1) {
+			run++;
+			continue;
+		}
+		// a run ends at i - 1
+		if ((best < count && run > best) || (run >= count && run < best)) {
+			best = run;
+			*start = sorted[i - 1] - run + 1;
+		}
+		run = 1;
+	}
+	redislite_free(sorted);
+	return best;
+}
+
+/*
+ * Takes a run of consecutive pages listed in one of the first trunks, for
+ * a string stored in runs: `count` pages of one that is long enough if
+ * there is, or the longest. A run is taken whole when fewer than `min`
+ * pages would be left of it, along with its trunk when that lists nothing
+ * else. Returns its first page and sets `length`; 0
+ * if none of `min` pages is listed.
+ */
+int redislite_freelist_pop_run(void *_cs, int count, int min, int *length)
+{
+	changeset *cs = (changeset *)_cs;
+	redislite *db = cs->db;
+	redislite_page_freelist *trunk;
+	int i, run, start = 0, num = db->first_freelist_page, previous = 0;
+	int best = 0, best_start = 0, best_num = 0, best_previous = 0;
+	for (i = 0; num != 0 && i < FREELIST_RUN_TRUNKS && best < count; i++) {
+		trunk = redislite_page_get(db, cs, num, REDISLITE_PAGE_TYPE_FREELIST);
+		if (trunk == NULL) {
+			return REDISLITE_OOM;
+		}
+		run = best_run(trunk, count, &start);
+		if (run < 0) {
+			return run;
+		}
+		if (run > best) {
+			best = run;
+			best_start = start;
+			best_num = num;
+			best_previous = previous;
+		}
+		previous = num;
+		num = trunk->right_page;
+	}
+	if (best < min) {
+		return 0;
+	}
+	if (best - count >= min) {
+		best = count; // what is left of a shorter run would not be taken
+	}
+
+	trunk = redislite_page_get(db, cs, best_num, REDISLITE_PAGE_TYPE_FREELIST);
+	if (trunk == NULL) {
+		return REDISLITE_OOM;
+	}
+	int status = redislite_add_modified_page(cs, best_num, REDISLITE_PAGE_TYPE_FREELIST, trunk);
+	if (status < 0) {
+		return status;
+	}
+	size_t j, kept = 0;
+	for (j = 0; j < trunk->number_of_pages; j++) {
+		if (trunk->pages[j] < best_start || trunk->pages[j] >= best_start + best) {
+			trunk->pages[kept++] = trunk->pages[j];
+		}
+	}
+	trunk->number_of_pages = kept;
+	db->number_of_freelist_pages = db->number_of_freelist_pages > best ? db->number_of_freelist_pages - best : 0;
+	status = redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, db->root);
+	if (status < 0) {
+		return status;
+	}
+
+	if (kept == 0 && (best_num == best_start - 1 || best_previous != 0)) {
+		// an empty trunk past the first one is never reused
+		if (best_previous == 0) {
+			db->first_freelist_page = trunk->right_page;
+		}
+		else {
+			redislite_page_freelist *previous_trunk = redislite_page_get(db, cs, best_previous, REDISLITE_PAGE_TYPE_FREELIST);
+			if (previous_trunk == NULL) {
+				return REDISLITE_OOM;
+			}
+			previous_trunk->right_page = trunk->right_page;
+			status = redislite_add_modified_page(cs, best_previous, REDISLITE_PAGE_TYPE_FREELIST, previous_trunk);
+			if (status < 0) {
+				return status;
+			}
+		}
+		db->number_of_freelist_pages--;
+		if (best_num == best_start - 1) {
+			// it only listed the pages after it, it goes with them
+			best_start--;
+			best++;
+		}
+		else {
+			status = redislite_freelist_push(cs, best_num);
+			if (status < 0) {
+				return status;
+			}
+		}
+	}
+	*length = best;
+	return best_start;
+}
+
+/*
+ * Adds `count` consecutive pages to the freelist, keeping them in the same
+ * trunk when they fit in one, so they can be taken as a run again. Those
+ * that do not fit in the first trunk get their own ones.
+ */
+int redislite_freelist_push_run(void *_cs, int page, int count)
+{
+	changeset *cs = (changeset *)_cs;
+	redislite *db = cs->db;
+	size_t capacity = redislite_freelist_capacity(db);
+	redislite_page_freelist *trunk = NULL;
+	int status, num;
+	while (count > 0) {
+		trunk = NULL;
+		if (db->first_freelist_page) {
+			trunk = redislite_page_get(db, cs, db->first_freelist_page, REDISLITE_PAGE_TYPE_FREELIST);
+			if (trunk == NULL) {
+				return REDISLITE_OOM;
+			}
+		}
+		if (trunk == NULL || trunk->number_of_pages + count > capacity) {
+			// the first page of the run lists the ones after it
+			redislite_page_freelist *first = trunk;
+			trunk = redislite_create_freelist(db, first ? first->right_page : 0);
+			if (trunk == NULL) {
+				return REDISLITE_OOM;
+			}
+			if (first && first->number_of_pages > 0) {
+				trunk->right_page = db->first_freelist_page;
+			}
+			else if (first) {
+				// an empty trunk would not be reused past the first one
+				trunk->pages[trunk->number_of_pages++] = db->first_freelist_page;
+			}
+			status = redislite_add_modified_page(cs, page, REDISLITE_PAGE_TYPE_FREELIST, trunk);
+			if (status < 0) {
+				redislite_free_freelist(db, trunk);
+				return status;
+			}
+			db->first_freelist_page = page;
+			db->number_of_freelist_pages++;
+			page++;
+			count--;
+		}
+		for (num = 0; num < count && trunk->number_of_pages < capacity; num++) {
+			trunk->pages[trunk->number_of_pages++] = page + num;
+		}
+		status = redislite_add_modified_page(cs, db->first_freelist_page, REDISLITE_PAGE_TYPE_FREELIST, trunk);
+		if (status < 0) {
+			return status;
+		}
+		db->number_of_freelist_pages += num;
+		page += num;
+		count -= num;
+	}
+	return redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, db->root);
+}
@@ -1,9 +1,16 @@
 typedef struct {
 	void *db;
-	int right_page;
-	size_t size;
+	int right_page; // next trunk
+	size_t number_of_pages; // leaves listed in this trunk
+	int *pages;
 } redislite_page_freelist;
 
+size_t redislite_freelist_capacity(void *_db);
 void redislite_write_freelist(void *_db, unsigned char *data, void *page);
 void *redislite_read_freelist(void *_db, unsigned char *data);
 void redislite_free_freelist(void *_db, void *page);
+redislite_page_freelist *redislite_create_freelist(void *_db, int right_page);
+int redislite_freelist_push(void *_cs, int num);
+int redislite_freelist_pop(void *_cs);
+int redislite_freelist_pop_run(void *_cs, int count, int min, int *length);
+int redislite_freelist_push_run(void *_cs, int page, int count);
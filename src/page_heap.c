@@ -0,0 +1,329 @@
+#include "core.h"
+#include "page.h"
+#include "page_heap.h"
+#include "page_index.h"
+#include "page_freelist.h"
+#include "util.h"
+#include <string.h>
+#include <stdlib.h>
+
+// the slots follow the header, two bytes each with the offset of their cell
+#define HEAP_HEADER_SIZE 16
+
+static size_t number_of_slots(unsigned char *data)
+{
+	return redislite_get_4bytes(&data[4]);
+}
+
+static size_t slot_offset(unsigned char *data, size_t slot)
+{
+	return redislite_get_2bytes(&data[HEAP_HEADER_SIZE + slot * 2]);
+}
+
+// cells hold the key, so the page can be moved without a walk of the index
+static size_t cell_size(unsigned char *cell)
+{
+	int key_length, value_length;
+	size_t pos = getVarint32(cell, key_length);
+	pos += key_length;
+	pos += getVarint32(&cell[pos], value_length);
+	return pos + value_length;
+}
+
+static size_t new_cell_size(size_t key_length, size_t value_length)
+{
+	unsigned char varint[9];
+	size_t size = putVarint32(varint, key_length) + key_length;
+	return size + putVarint32(varint, value_length) + value_length;
+}
+
+// a string shares its page with at least another one, or it is not worth it
+int redislite_value_fits_heap(void *_db, size_t key_length, size_t value_length)
+{
+	redislite *db = (redislite *)_db;
+	return new_cell_size(key_length, value_length) + 2 <= (db->page_size - HEAP_HEADER_SIZE) / 2;
+}
+
+void redislite_write_heap(void *_db, unsigned char *data, void *_page)
+{
+	redislite *db = (redislite *)_db;
+	redislite_page_heap *page = (redislite_page_heap *)_page;
+	memcpy(data, page->data, db->page_size);
+}
+
+void *redislite_read_heap(void *_db, unsigned char *data)
+{
+	redislite *db = (redislite *)_db;
+	redislite_page_heap *page = redislite_malloc(sizeof(redislite_page_heap));
+	if (page == NULL) {
+		return NULL;
+	}
+	page->data = redislite_malloc(sizeof(unsigned char) * db->page_size);
+	if (page->data == NULL) {
+		redislite_free(page);
+		return NULL;
+	}
+	memcpy(page->data, data, db->page_size);
+	page->db = db;
+	return page;
+}
+
+void redislite_free_heap(void *_db, void *_page)
+{
+	_db = _db; // XXX: avoid unused-parameter warning; we are implementing a prototype
+	redislite_page_heap *page = (redislite_page_heap *)_page;
+	if (page == NULL) {
+		return;
+	}
+	redislite_free(page->data);
+	redislite_free(page);
+}
+
+static redislite_page_heap *create_heap(redislite *db)
+{
+	redislite_page_heap *page = redislite_malloc(sizeof(redislite_page_heap));
+	if (page == NULL) {
+		return NULL;
+	}
+	page->data = redislite_malloc(sizeof(unsigned char) * db->page_size);
+	if (page->data == NULL) {
+		redislite_free(page);
+		return NULL;
+	}
+	memset(page->data, 0, db->page_size);
+	redislite_put_4bytes(&page->data[8], db->page_size);
+	redislite_put_4bytes(&page->data[12], db->page_size - HEAP_HEADER_SIZE);
+	page->db = db;
+	return page;
+}
+
+/*
+ * Packs the cells at the end of the page, so the space freed by deleted
+ * ones is between them and the slots.
+ */
+static int compact(redislite *db, unsigned char *data)
+{
+	unsigned char *copy = redislite_malloc(sizeof(unsigned char) * db->page_size);
+	if (copy == NULL) {
+		return REDISLITE_OOM;
+	}
+	memcpy(copy, data, db->page_size);
+	size_t i, offset, size, end = db->page_size, slots = number_of_slots(data);
+	for (i = 0; i < slots; i++) {
+		offset = slot_offset(copy, i);
+		if (offset == 0) {
+			continue;
+		}
+		size = cell_size(&copy[offset]);
+		end -= size;
+		memcpy(&data[end], &copy[offset], size);
+		redislite_put_2bytes(&data[HEAP_HEADER_SIZE + i * 2], end);
+	}
+	redislite_put_4bytes(&data[8], end);
+	redislite_free(copy);
+	return REDISLITE_OK;
+}
+
+/*
+ * Puts a cell on a page with room for it and a new slot. Returns its slot,
+ * the first free one.
+ */
+static int put_cell(redislite *db, unsigned char *data, char *key, size_t key_length, char *value, size_t value_length)
+{
+	size_t slot, slots = number_of_slots(data), size = new_cell_size(key_length, value_length);
+	for (slot = 0; slot < slots && slot_offset(data, slot) != 0; slot++);
+	size_t slots_end = HEAP_HEADER_SIZE + (slot == slots ? slots + 1 : slots) * 2;
+	size_t cells = redislite_get_4bytes(&data[8]);
+	if (cells < slots_end + size) {
+		int status = compact(db, data);
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+		cells = redislite_get_4bytes(&data[8]);
+	}
+	cells -= size;
+	size_t pos = cells;
+	pos += putVarint32(&data[pos], key_length);
+	memcpy(&data[pos], key, key_length);
+	pos += key_length;
+	pos += putVarint32(&data[pos], value_length);
+	memcpy(&data[pos], value, value_length);
+
+	redislite_put_2bytes(&data[HEAP_HEADER_SIZE + slot * 2], cells);
+	redislite_put_4bytes(&data[8], cells);
+	if (slot == slots) {
+		redislite_put_4bytes(&data[4], slots + 1);
+		size += 2;
+	}
+	redislite_put_4bytes(&data[12], redislite_get_4bytes(&data[12]) - size);
+	return slot;
+}
+
+static int set_heap_page(changeset *cs, int num)
+{
+	if (cs->db->heap_page == num) {
+		return REDISLITE_OK;
+	}
+	cs->db->heap_page = num;
+	int status = redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, cs->db->root);
+	return status < 0 ? status : REDISLITE_OK;
+}
+
+/*
+ * Stores a string on the page strings go to first, or on a new one if it
+ * has no room, and tells its page and slot.
+ */
+int redislite_heap_insert(void *_cs, char *key, size_t key_length, char *value, size_t value_length, int *page_num, int *slot)
+{
+	changeset *cs = (changeset *)_cs;
+	redislite *db = cs->db;
+	redislite_page_heap *page = NULL;
+	int num = db->heap_page, status;
+	if (num > 0 && num < db->number_of_pages) {
+		page = redislite_page_get(db, cs, num, REDISLITE_PAGE_TYPE_HEAP);
+		if (page == NULL) {
+			return REDISLITE_OOM;
+		}
+		// a slot may be free, but it is not worth looking
+		if ((size_t)redislite_get_4bytes(&page->data[12]) < new_cell_size(key_length, value_length) + 2) {
+			page = NULL;
+		}
+	}
+	if (page == NULL) {
+		page = create_heap(db);
+		if (page == NULL) {
+			return REDISLITE_OOM;
+		}
+		num = redislite_add_modified_page(cs, -1, REDISLITE_PAGE_TYPE_HEAP, page);
+		if (num < 0) {
+			redislite_free_heap(db, page);
+			return num;
+		}
+		status = set_heap_page(cs, num);
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+	}
+
+	status = put_cell(db, page->data, key, key_length, value, value_length);
+	if (status < 0) {
+		return status;
+	}
+	*slot = status;
+	*page_num = num;
+	status = redislite_add_modified_page(cs, num, REDISLITE_PAGE_TYPE_HEAP, page);
+	return status < 0 ? status : REDISLITE_OK;
+}
+
+/*
+ * Copies the string in `slot`, NUL terminated for the callers parsing
+ * numbers.
+ */
+int redislite_heap_get(void *_db, void *_cs, int page_num, int slot, char **value, size_t *value_length)
+{
+	redislite *db = (redislite *)_db;
+	redislite_page_heap *page = redislite_page_get(db, _cs, page_num, REDISLITE_PAGE_TYPE_HEAP);
+	if (page == NULL) {
+		return REDISLITE_OOM;
+	}
+	int status = REDISLITE_OK, key_length, length;
+	size_t pos = (size_t)slot < number_of_slots(page->data) ? slot_offset(page->data, slot) : 0;
+	if (pos == 0) {
+		status = REDISLITE_ERR; // a key pointing to a free slot, the file is corrupted
+	}
+	else {
+		pos += getVarint32(&page->data[pos], key_length);
+		pos += key_length;
+		pos += getVarint32(&page->data[pos], length);
+		char *copy = redislite_malloc(sizeof(char) * (length + 1));
+		if (copy == NULL) {
+			status = REDISLITE_OOM;
+		}
+		else {
+			memcpy(copy, &page->data[pos], length);
+			copy[length] = '\0';
+			*value = copy;
+			*value_length = length;
+		}
+	}
+	if (_cs == NULL) {
+		redislite_free_heap(db, page);
+	}
+	return status;
+}
+
+/*
+ * Frees `slot` and the slots after it that are free too. A page left with
+ * no strings goes to the freelist; one left half empty takes the next ones.
+ */
+int redislite_heap_delete(void *_cs, int page_num, int slot)
+{
+	changeset *cs = (changeset *)_cs;
+	redislite *db = cs->db;
+	redislite_page_heap *page = redislite_page_get(db, cs, page_num, REDISLITE_PAGE_TYPE_HEAP);
+	if (page == NULL) {
+		return REDISLITE_OOM;
+	}
+	unsigned char *data = page->data;
+	size_t slots = number_of_slots(data);
+	size_t offset = (size_t)slot < slots ? slot_offset(data, slot) : 0;
+	if (offset == 0) {
+		return REDISLITE_ERR;
+	}
+	size_t free_bytes = redislite_get_4bytes(&data[12]) + cell_size(&data[offset]);
+	redislite_put_2bytes(&data[HEAP_HEADER_SIZE + slot * 2], 0);
+	while (slots > 0 && slot_offset(data, slots - 1) == 0) {
+		slots--;
+		free_bytes += 2;
+	}
+	redislite_put_4bytes(&data[4], slots);
+	redislite_put_4bytes(&data[12], free_bytes);
+
+	int status;
+	if (slots == 0) {
+		if (db->heap_page == page_num) {
+			status = set_heap_page(cs, 0);
+			if (status != REDISLITE_OK) {
+				return status;
+			}
+		}
+		return redislite_freelist_push(cs, page_num);
+	}
+	status = redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_HEAP, page);
+	if (status >= 0 && free_bytes >= (db->page_size - HEAP_HEADER_SIZE) / 2) {
+		status = set_heap_page(cs, page_num);
+	}
+	return status < 0 ? status : REDISLITE_OK;
+}
+
+/*
+ * Points the keys of the strings on `page` to `to` where they pointed to
+ * `from`, for VACUUM STEP. Returns how many did; with `from` equal to `to`
+ * it only counts them.
+ */
+int redislite_heap_repoint(void *_cs, void *_page, int from, int to)
+{
+	changeset *cs = (changeset *)_cs;
+	unsigned char *data = ((redislite_page_heap *)_page)->data;
+	size_t i, pos, slots = number_of_slots(data);
+	int key_length, status, count = 0;
+	for (i = 0; i < slots; i++) {
+		pos = slot_offset(data, i);
+		if (pos == 0) {
+			continue;
+		}
+		pos += getVarint32(&data[pos], key_length);
+		status = redislite_page_index_repoint_key(cs, cs->db->root, (char *)&data[pos], key_length, from, to);
+		if (status < 0) {
+			return status;
+		}
+		count += status;
+	}
+	if (from != to && cs->db->heap_page == from) {
+		status = set_heap_page(cs, to);
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+	}
+	return count;
+}
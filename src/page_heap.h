@@ -0,0 +1,23 @@
+#ifndef _PAGE_HEAP_H
+#define _PAGE_HEAP_H
+#include <stddef.h>
+
+/*
+ * A page shared by small strings, each in a cell pointed to by a slot. Keys
+ * name the page and the slot of their string; the slot keeps its number
+ * when the cells are moved around the page.
+ */
+typedef struct {
+	void *db;
+	unsigned char *data; // the page as it is written
+} redislite_page_heap;
+
+void redislite_write_heap(void *_db, unsigned char *data, void *page);
+void *redislite_read_heap(void *_db, unsigned char *data);
+void redislite_free_heap(void *_db, void *page);
+int redislite_value_fits_heap(void *_db, size_t key_length, size_t value_length);
+int redislite_heap_insert(void *_cs, char *key, size_t key_length, char *value, size_t value_length, int *page_num, int *slot);
+int redislite_heap_get(void *_db, void *_cs, int page_num, int slot, char **value, size_t *value_length);
+int redislite_heap_delete(void *_cs, int page_num, int slot);
+int redislite_heap_repoint(void *_cs, void *page, int from, int to);
+#endif
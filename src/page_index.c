@@ -6,13 +6,18 @@
 #include "core.h"
 #include "page.h"
 #include "util.h"
+#include "page_cache.h"
+#include "page_freelist.h"
+#include "page_heap.h"
+#include "page_string.h"
 
 void redislite_free_key(redislite_page_index_key *key)
 {
-	if (key == NULL) {
+	if (key == NULL || key->in_block) {
 		return;
 	}
 	redislite_free(key->keyname);
+	redislite_free(key->value);
 	redislite_free(key);
 }
 
@@ -28,31 +33,152 @@ void redislite_free_index(void *db, void *_page)
 		redislite_free_key(page->keys[i]);
 	}
 	redislite_free(page->keys);
+	redislite_free(page->block);
 	redislite_free(page);
 }
 
+// keys with their value in the entry, instead of a page number
+static int value_in_entry(char type)
+{
+	return type == REDISLITE_PAGE_TYPE_STRING_INLINE || type == REDISLITE_PAGE_TYPE_STRING_INTEGER;
+}
+
+// bytes following the name of a key: its page number, or its inline value
+static size_t payload_size(redislite_page_index_key *key)
+{
+	unsigned char varint[9];
+	if (key->type == REDISLITE_PAGE_TYPE_HEAP) {
+		return 6;
+	}
+	if (key->type == REDISLITE_PAGE_TYPE_STRING_INTEGER) {
+		return 8;
+	}
+	if (key->type != REDISLITE_PAGE_TYPE_STRING_INLINE) {
+		return 4;
+	}
+	return putVarint32(varint, key->value_size) + key->value_size;
+}
+
+static size_t inline_payload_size(size_t value_length)
+{
+	unsigned char varint[9];
+	return putVarint32(varint, value_length) + value_length;
+}
+
+// bytes taken by a key stored in full
+static size_t entry_size(size_t length, size_t payload)
+{
+	unsigned char length_str[9];
+	return putVarint32(length_str, length) + 1 + length + payload;
+}
+
+// skips the page number or inline value of a key as read from disk
+static size_t skip_payload(char type, unsigned char *data)
+{
+	int value_size;
+	if (type == REDISLITE_PAGE_TYPE_HEAP) {
+		return 6;
+	}
+	if (type == REDISLITE_PAGE_TYPE_STRING_INTEGER) {
+		return 8;
+	}
+	if (type != REDISLITE_PAGE_TYPE_STRING_INLINE) {
+		return 4;
+	}
+	size_t size = getVarint32(data, value_size);
+	return size + value_size;
+}
+
+static size_t shared_prefix(redislite_page_index_key *key1, redislite_page_index_key *key2)
+{
+	size_t i, size = MIN(key1->keyname_size, key2->keyname_size);
+	for (i = 0; i < size && key1->keyname[i] == key2->keyname[i]; i++);
+	return i;
+}
+
+static size_t plain_size(redislite_page_index *page)
+{
+	size_t i, size = 0;
+	for (i = 0; i < page->number_of_keys; i++) {
+		size += entry_size(page->keys[i]->keyname_size, payload_size(page->keys[i]));
+	}
+	return size;
+}
+
+// bytes taken by `key` front coded after `previous`, NULL for the first key
+static size_t coded_entry_size(redislite_page_index_key *previous, redislite_page_index_key *key)
+{
+	unsigned char varint[9];
+	size_t prefix = previous ? shared_prefix(previous, key) : 0;
+	return putVarint32(varint, prefix) + entry_size(key->keyname_size - prefix, payload_size(key));
+}
+
+/*
+ * Bytes taken by the keys of `page` front coded: each one only stores
+ * what follows the prefix it shares with the key before it.
+ */
+static size_t coded_size(redislite_page_index *page)
+{
+	size_t i, size = 0;
+	for (i = 0; i < page->number_of_keys; i++) {
+		size += coded_entry_size(i > 0 ? page->keys[i - 1] : NULL, page->keys[i]);
+	}
+	return size;
+}
+
+// pages are written in whichever format is smaller
+static size_t used_space(redislite_page_index *page)
+{
+	return MIN(plain_size(page), coded_size(page));
+}
+
 void redislite_write_index(void *db, unsigned char *data, void *_page)
 {
 	db = db; // XXX: avoid unused-parameter warning; we are implementing a prototype
 	redislite_page_index *page = (redislite_page_index *)_page;
-	redislite_put_4bytes(&data[0], 0); // reserved
+	int front_coded = coded_size(page) < plain_size(page);
+	redislite_put_4bytes(&data[0], front_coded ? REDISLITE_INDEX_FRONT_CODED : REDISLITE_INDEX_PLAIN);
 	redislite_put_4bytes(&data[4], page->free_space);
 	redislite_put_2bytes(&data[8], page->number_of_keys);
 	redislite_put_4bytes(&data[10], page->right_page);
-	size_t i;
+	size_t i, prefix = 0;
 	size_t pos = 14;
 	for (i = 0; i < page->number_of_keys; i++) {
 		redislite_page_index_key *key = page->keys[i];
-		pos += putVarint32(&data[pos], key->keyname_size);
+		if (front_coded) {
+			prefix = i > 0 ? shared_prefix(page->keys[i - 1], key) : 0;
+			pos += putVarint32(&data[pos], prefix);
+		}
+		pos += putVarint32(&data[pos], key->keyname_size - prefix);
 		data[pos] = key->type;
 		pos += 1;
-		memcpy(&data[pos], key->keyname, key->keyname_size);
-		pos += key->keyname_size;
-		redislite_put_4bytes(&data[pos], key->left_page);
-		pos += 4;
+		memcpy(&data[pos], &key->keyname[prefix], key->keyname_size - prefix);
+		pos += key->keyname_size - prefix;
+		if (key->type == REDISLITE_PAGE_TYPE_STRING_INLINE) {
+			pos += putVarint32(&data[pos], key->value_size);
+			memcpy(&data[pos], key->value, key->value_size);
+			pos += key->value_size;
+		}
+		else if (key->type == REDISLITE_PAGE_TYPE_STRING_INTEGER) {
+			memcpy(&data[pos], key->value, 8);
+			pos += 8;
+		}
+		else {
+			redislite_put_4bytes(&data[pos], key->left_page);
+			pos += 4;
+		}
+		if (key->type == REDISLITE_PAGE_TYPE_HEAP) {
+			redislite_put_2bytes(&data[pos], key->slot);
+			pos += 2;
+		}
 	}
 }
 
+/*
+ * Keys are decoded into a single block along with their names and inline
+ * values, instead of allocations per key. Keys added later are allocated
+ * on their own.
+ */
 void *redislite_read_index(void *db, unsigned char *data)
 {
 	redislite_page_index *page = redislite_malloc(sizeof(redislite_page_index));
@@ -64,51 +190,93 @@ void *redislite_read_index(void *db, unsigned char *data)
 	page->alloced_keys = page->number_of_keys;
 	page->right_page = redislite_get_4bytes(&data[10]);
 	page->db = db;
+	page->block = NULL;
 	if (page->alloced_keys == 0) {
 		page->keys = NULL;
 		return page;
 	}
 
-	page->keys = redislite_malloc(sizeof(redislite_page_index_key) * page->alloced_keys);
-	if (page->keys == NULL) {
-		goto cleanup;
-	}
-	size_t i, pos = 14;
+	int front_coded = redislite_get_4bytes(&data[0]) == REDISLITE_INDEX_FRONT_CODED;
+	int prefix = 0, suffix_size, value_size;
+	size_t i, pos = 14, names_size = 0;
+	char type;
 	for (i = 0; i < page->number_of_keys; i++) {
-		page->keys[i] = redislite_malloc(sizeof(redislite_page_index_key));
-		if (page->keys[i] == NULL) {
-			goto cleanup;
+		if (front_coded) {
+			pos += getVarint32(&data[pos], prefix);
 		}
-		pos += getVarint32(&data[pos], page->keys[i]->keyname_size);
-		page->keys[i]->type = data[pos];
-		pos += 1;
-		page->keys[i]->keyname = redislite_malloc(sizeof(char) * page->keys[i]->keyname_size);
-		if (page->keys[i]->keyname == NULL) {
-			goto cleanup;
+		pos += getVarint32(&data[pos], suffix_size);
+		names_size += prefix + suffix_size;
+		type = data[pos];
+		pos += 1 + suffix_size;
+		if (type == REDISLITE_PAGE_TYPE_STRING_INLINE) {
+			pos += getVarint32(&data[pos], value_size);
+			names_size += value_size;
+			pos += value_size;
 		}
-		memcpy(page->keys[i]->keyname, &data[pos], page->keys[i]->keyname_size);
-		pos += page->keys[i]->keyname_size;
-		page->keys[i]->left_page = redislite_get_4bytes(&data[pos]);
-		pos += 4;
-	}
-	return page;
-cleanup:
-	if (page->keys) {
-		for (;; i--) {
-			if (page->keys[i] && page->keys[i]->keyname) {
-				redislite_free(page->keys[i]->keyname);
-			}
-			if (page->keys[i]) {
-				redislite_free(page->keys[i]);
-			}
-			if (i == 0) {
-				break;
-			}
+		else {
+			names_size += type == REDISLITE_PAGE_TYPE_STRING_INTEGER ? 8 : 0;
+			pos += skip_payload(type, &data[pos]);
 		}
+	}
+	page->keys = redislite_malloc(sizeof(redislite_page_index_key *) * page->alloced_keys);
+	page->block = redislite_malloc(sizeof(redislite_page_index_key) * page->number_of_keys + names_size);
+	if (page->keys == NULL || page->block == NULL) {
 		redislite_free(page->keys);
+		redislite_free(page->block);
+		redislite_free(page);
+		return NULL;
 	}
-	redislite_free(page);
-	return NULL;
+	redislite_page_index_key *key = page->block;
+	char *name = (char *)&key[page->number_of_keys];
+	for (i = 0, pos = 14; i < page->number_of_keys; i++, key++) {
+		if (front_coded) {
+			pos += getVarint32(&data[pos], prefix);
+		}
+		pos += getVarint32(&data[pos], suffix_size);
+		key->in_block = 1;
+		key->page = page;
+		key->keyname_size = prefix + suffix_size;
+		key->type = data[pos];
+		pos += 1;
+		key->keyname = name;
+		if (prefix > 0) {
+			memcpy(name, key[-1].keyname, prefix);
+		}
+		memcpy(&name[prefix], &data[pos], suffix_size);
+		name += key->keyname_size;
+		pos += suffix_size;
+		if (key->type == REDISLITE_PAGE_TYPE_STRING_INLINE) {
+			pos += getVarint32(&data[pos], value_size);
+			key->left_page = 0;
+			key->value_size = value_size;
+			key->value = name;
+			memcpy(name, &data[pos], value_size);
+			name += value_size;
+			pos += value_size;
+		}
+		else if (key->type == REDISLITE_PAGE_TYPE_STRING_INTEGER) {
+			// kept as written, like the value of an inline string
+			key->left_page = 0;
+			key->value_size = 8;
+			key->value = name;
+			memcpy(name, &data[pos], 8);
+			name += 8;
+			pos += 8;
+		}
+		else {
+			key->left_page = redislite_get_4bytes(&data[pos]);
+			key->value_size = 0;
+			key->value = NULL;
+			pos += 4;
+		}
+		key->slot = 0;
+		if (key->type == REDISLITE_PAGE_TYPE_HEAP) {
+			key->slot = redislite_get_2bytes(&data[pos]);
+			pos += 2;
+		}
+		page->keys[i] = key;
+	}
+	return page;
 }
 
 redislite_page_index *redislite_page_index_create(void *db)
@@ -123,18 +291,11 @@ redislite_page_index *redislite_page_index_create(void *db)
 	page->right_page = 0;
 	page->keys = NULL;
 	page->alloced_keys = 0;
+	page->block = NULL;
 	page->db = _db;
 	return page;
 }
 
-static int redislite_keys_are_equal(redislite_page_index_key *key1, redislite_page_index_key *key2)
-{
-	if (key1->keyname_size != key2->keyname_size) {
-		return 0;
-	}
-	return 0 ==  memcmp(key1->keyname, key2->keyname, MIN(key1->keyname_size, key2->keyname_size));
-}
-
 /*
 static int redislite_keys_cmp(redislite_page_index_key* key1, redislite_page_index_key* key2) {
 	int cmp_result = memcmp(key1->keyname, key2->keyname, MIN(key1->keyname_size, key2->keyname_size));
@@ -148,35 +309,502 @@ static int redislite_keys_cmp(redislite_page_index_key* key1, redislite_page_ind
 }
 */
 
-static int redislite_remove_key(void *_cs, void *_key, int page_num)
+static int compare_name(char *name, size_t name_size, char *key, size_t length)
 {
-	redislite_page_index_key *key = (redislite_page_index_key *)_key;
-	redislite_page_index *page = (redislite_page_index *)key->page;
-	if (page == NULL) {
-		return REDISLITE_NOT_FOUND;
+	int cmp_result = memcmp(name, key, MIN(name_size, length));
+	if (cmp_result == 0 && name_size != length) {
+		cmp_result = name_size > length ? 1 : -1;
 	}
-	size_t i, j;
-	// TODO: binary search
-	for (i = 0; i < page->number_of_keys; i++) {
-		if (redislite_keys_are_equal(page->keys[i], key)) {
-			redislite_free_key(page->keys[i]);
-			for (j = 1 + i; j < page->number_of_keys; j++) {
-				page->keys[j - 1] = page->keys[j];
+	return cmp_result;
+}
+
+/*
+ * Position of the first key on `page` not lower than `key`, or
+ * number_of_keys if there is none; `found` tells if it is that key.
+ */
+static size_t search_page(redislite_page_index *page, char *key, size_t length, int *found)
+{
+	size_t low = 0, high = page->number_of_keys, mid;
+	int cmp_result;
+	*found = 0;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		cmp_result = compare_name(page->keys[mid]->keyname, page->keys[mid]->keyname_size, key, length);
+		if (cmp_result < 0) {
+			low = mid + 1;
+		}
+		else if (cmp_result > 0) {
+			high = mid;
+		}
+		else {
+			*found = 1;
+			return mid;
+		}
+	}
+	return low;
+}
+
+/*
+ * Bytes available for keys on `page`; a first page also keeps its number
+ * of keys, and the database's one the file header.
+ */
+static size_t page_capacity(redislite *db, void *first_page, redislite_page_index *page)
+{
+	size_t capacity = db->page_size - 14;
+	if (page == ((redislite_page_index_first *)first_page)->page) {
+		capacity -= 4;
+		if (first_page == db->root) {
+			capacity -= 100;
+		}
+	}
+	return capacity;
+}
+
+/*
+ * Puts a copy of `key` at `pos` regardless of the space left on the page;
+ * the caller splits it if it overflows.
+ */
+static int insert_entry(redislite_page_index *page, size_t pos, int left, char *key, size_t length, char type, char *value, size_t value_size)
+{
+	if (page->alloced_keys == page->number_of_keys) {
+		size_t alloced_keys = page->alloced_keys ? page->alloced_keys * 2 : 10;
+		redislite_page_index_key **keys = redislite_realloc(page->keys, sizeof(redislite_page_index_key *) * alloced_keys);
+		if (keys == NULL) {
+			return REDISLITE_OOM;
+		}
+		page->keys = keys;
+		page->alloced_keys = alloced_keys;
+	}
+	redislite_page_index_key *index_key = redislite_malloc(sizeof(redislite_page_index_key));
+	if (index_key == NULL) {
+		return REDISLITE_OOM;
+	}
+	index_key->keyname = redislite_malloc(sizeof(char) * length);
+	if (index_key->keyname == NULL) {
+		redislite_free(index_key);
+		return REDISLITE_OOM;
+	}
+	memcpy(index_key->keyname, key, length);
+	index_key->value = NULL;
+	if (value_in_entry(type)) {
+		index_key->value = redislite_malloc(sizeof(char) * (value_size ? value_size : 1));
+		if (index_key->value == NULL) {
+			redislite_free(index_key->keyname);
+			redislite_free(index_key);
+			return REDISLITE_OOM;
+		}
+		memcpy(index_key->value, value, value_size);
+	}
+	index_key->value_size = value_size;
+	index_key->keyname_size = length;
+	index_key->type = type;
+	index_key->in_block = 0;
+	index_key->page = page;
+	index_key->left_page = left;
+	index_key->slot = 0;
+
+	memmove(&page->keys[pos + 1], &page->keys[pos], sizeof(redislite_page_index_key *) * (page->number_of_keys - pos));
+	page->keys[pos] = index_key;
+	page->number_of_keys++;
+	return REDISLITE_OK;
+}
+
+static void remove_entry(redislite_page_index *page, size_t pos)
+{
+	redislite_free_key(page->keys[pos]);
+	memmove(&page->keys[pos], &page->keys[pos + 1], sizeof(redislite_page_index_key *) * (page->number_of_keys - pos - 1));
+	page->number_of_keys--;
+}
+
+/*
+ * Moves `count` keys of `from`, starting at `start`, to `to` at `to_pos`.
+ * Keys read from disk live in their page's block, they are copied first.
+ */
+static int move_keys(redislite_page_index *from, size_t start, size_t count, redislite_page_index *to, size_t to_pos)
+{
+	size_t i;
+	for (i = start; i < start + count; i++) {
+		redislite_page_index_key *key = from->keys[i];
+		if (key->in_block) {
+			redislite_page_index_key *copy = redislite_malloc(sizeof(redislite_page_index_key));
+			if (copy == NULL) {
+				return REDISLITE_OOM;
 			}
-			page->number_of_keys--;
-			if (key != page->keys[i]) {
-				redislite_free_key(key);
+			*copy = *key;
+			copy->in_block = 0;
+			copy->keyname = redislite_malloc(sizeof(char) * key->keyname_size);
+			if (copy->keyname == NULL) {
+				redislite_free(copy);
+				return REDISLITE_OOM;
 			}
-			if (page_num > 0) {
-				int status = redislite_add_modified_page(_cs, page_num, REDISLITE_PAGE_TYPE_INDEX, page);
-				if (status < 0) {
-					return status;
+			memcpy(copy->keyname, key->keyname, key->keyname_size);
+			if (key->value != NULL) {
+				copy->value = redislite_malloc(sizeof(char) * (key->value_size ? key->value_size : 1));
+				if (copy->value == NULL) {
+					redislite_free(copy->keyname);
+					redislite_free(copy);
+					return REDISLITE_OOM;
 				}
+				memcpy(copy->value, key->value, key->value_size);
+			}
+			from->keys[i] = copy;
+		}
+	}
+	if (to->alloced_keys < to->number_of_keys + count) {
+		redislite_page_index_key **keys = redislite_realloc(to->keys, sizeof(redislite_page_index_key *) * (to->number_of_keys + count));
+		if (keys == NULL) {
+			return REDISLITE_OOM;
+		}
+		to->keys = keys;
+		to->alloced_keys = to->number_of_keys + count;
+	}
+	memmove(&to->keys[to_pos + count], &to->keys[to_pos], sizeof(redislite_page_index_key *) * (to->number_of_keys - to_pos));
+	memcpy(&to->keys[to_pos], &from->keys[start], sizeof(redislite_page_index_key *) * count);
+	to->number_of_keys += count;
+	for (i = to_pos; i < to_pos + count; i++) {
+		to->keys[i]->page = to;
+	}
+	memmove(&from->keys[start], &from->keys[start + count], sizeof(redislite_page_index_key *) * (from->number_of_keys - start - count));
+	from->number_of_keys -= count;
+	return REDISLITE_OK;
+}
+
+typedef struct {
+	redislite_page_index *page;
+	int number; // -1 for a first page the caller marks as modified
+	size_t pos; // of the key followed down, or where the key is
+} index_level;
+
+static int mark_modified(changeset *cs, void *first_page, index_level *level)
+{
+	int status = REDISLITE_OK;
+	if (level->page != ((redislite_page_index_first *)first_page)->page) {
+		status = redislite_add_modified_page(cs, level->number, REDISLITE_PAGE_TYPE_INDEX, level->page);
+	}
+	else if (level->number >= 0) {
+		status = redislite_add_modified_page(cs, level->number, REDISLITE_PAGE_TYPE_FIRST, first_page);
+	}
+	return status < 0 ? status : REDISLITE_OK;
+}
+
+/*
+ * Records the pages from `first_page` down to the one where `key` is, or
+ * would be inserted.
+ */
+static int descend(changeset *cs, void *first_page, int first_page_num, char *key, size_t length, index_level **levels_p, size_t *depth_p, int *found)
+{
+	size_t depth = 0, alloced = 8, pos;
+	index_level *levels = redislite_malloc(sizeof(index_level) * alloced);
+	if (levels == NULL) {
+		return REDISLITE_OOM;
+	}
+	redislite_page_index *page = ((redislite_page_index_first *)first_page)->page;
+	int number = first_page_num;
+	while (1) {
+		if (depth == alloced) {
+			index_level *new_levels = redislite_realloc(levels, sizeof(index_level) * alloced * 2);
+			if (new_levels == NULL) {
+				redislite_free(levels);
+				return REDISLITE_OOM;
+			}
+			levels = new_levels;
+			alloced *= 2;
+		}
+		pos = search_page(page, key, length, found);
+		levels[depth].page = page;
+		levels[depth].number = number;
+		levels[depth].pos = pos;
+		depth++;
+		if (*found && page->keys[pos]->type != REDISLITE_PAGE_TYPE_INDEX) {
+			break;
+		}
+		if (pos == page->number_of_keys) {
+			number = page->right_page;
+		}
+		else {
+			number = page->keys[pos]->type == REDISLITE_PAGE_TYPE_INDEX ? page->keys[pos]->left_page : 0;
+		}
+		if (number == 0) {
+			*found = 0;
+			break;
+		}
+		page = redislite_page_get(cs->db, cs, number, REDISLITE_PAGE_TYPE_INDEX);
+		if (page == NULL) {
+			redislite_free(levels);
+			return REDISLITE_OOM;
+		}
+	}
+	*levels_p = levels;
+	*depth_p = depth;
+	return REDISLITE_OK;
+}
+
+/*
+ * Where to split a page that overflows: the key at the returned position
+ * names the separator, and stays on the left page unless it is one
+ * itself. Picks the most even split that fits both pages, -1 if none.
+ */
+static int split_point(redislite_page_index *page, size_t left_capacity, size_t right_capacity)
+{
+	redislite_page_index_key **keys = page->keys;
+	size_t i, plain, coded, left, right, diff, best_diff = 0;
+	size_t left_plain = 0, left_coded = 0, right_plain, right_coded;
+	size_t total_plain = plain_size(page), total_coded = coded_size(page);
+	int best = -1;
+	for (i = 0; i < page->number_of_keys; i++) {
+		plain = entry_size(keys[i]->keyname_size, payload_size(keys[i]));
+		coded = coded_entry_size(i > 0 ? keys[i - 1] : NULL, keys[i]);
+		if (keys[i]->type == REDISLITE_PAGE_TYPE_INDEX) {
+			left = MIN(left_plain, left_coded);
+		}
+		else {
+			left = MIN(left_plain + plain, left_coded + coded);
+		}
+		right_plain = total_plain - left_plain - plain;
+		right_coded = total_coded - left_coded - coded;
+		if (i + 1 < page->number_of_keys) {
+			// the first key of the right page has nothing to share
+			right_coded -= coded_entry_size(keys[i], keys[i + 1]);
+			right_coded += coded_entry_size(NULL, keys[i + 1]);
+		}
+		right = MIN(right_plain, right_coded);
+		if (left <= left_capacity && right <= right_capacity) {
+			diff = left > right ? left - right : right - left;
+			if (best == -1 || diff < best_diff) {
+				best = i;
+				best_diff = diff;
+			}
+		}
+		left_plain += plain;
+		left_coded += coded;
+	}
+	return best;
+}
+
+/*
+ * Moves the keys of `page` before `pos` to a new page and adds the
+ * separator pointing to it to `parent`, at `parent_pos`.
+ */
+static int split_page(changeset *cs, redislite_page_index *page, size_t pos, redislite_page_index *parent, size_t parent_pos)
+{
+	redislite *db = cs->db;
+	redislite_page_index_key *separator = page->keys[pos];
+	int is_index = separator->type == REDISLITE_PAGE_TYPE_INDEX;
+	redislite_page_index *left = redislite_page_index_create(db);
+	if (left == NULL) {
+		return REDISLITE_OOM;
+	}
+	int status = move_keys(page, 0, is_index ? pos : pos + 1, left, 0);
+	if (status != REDISLITE_OK) {
+		redislite_free_index(db, left);
+		return status;
+	}
+	left->right_page = is_index ? separator->left_page : 0;
+	left->free_space = db->page_size - 14 - used_space(left);
+	int left_num = redislite_add_modified_page(cs, -1, REDISLITE_PAGE_TYPE_INDEX, left);
+	if (left_num < 0) {
+		return left_num;
+	}
+	status = insert_entry(parent, parent_pos, left_num, separator->keyname, separator->keyname_size, REDISLITE_PAGE_TYPE_INDEX, NULL, 0);
+	if (status == REDISLITE_OK && is_index) {
+		remove_entry(page, 0);
+	}
+	return status;
+}
+
+/*
+ * Splits the overflowing pages on the way back up from an insertion. The
+ * first page keeps its number, so when it overflows its keys move down to
+ * a new page that is split instead.
+ */
+static int split_pages(changeset *cs, void *first_page, index_level *levels, size_t depth)
+{
+	redislite *db = cs->db;
+	size_t d = depth, capacity, used;
+	int pos, status;
+	while (d-- > 0) {
+		index_level *level = &levels[d];
+		capacity = page_capacity(db, first_page, level->page);
+		used = used_space(level->page);
+		if (used <= capacity) {
+			level->page->free_space = capacity - used;
+			return mark_modified(cs, first_page, level);
+		}
+		if (d == 0) {
+			redislite_page_index *root = level->page;
+			redislite_page_index *child = redislite_page_index_create(db);
+			if (child == NULL) {
+				return REDISLITE_OOM;
+			}
+			status = move_keys(root, 0, root->number_of_keys, child, 0);
+			if (status != REDISLITE_OK) {
+				redislite_free_index(db, child);
+				return status;
+			}
+			child->right_page = root->right_page;
+			root->right_page = redislite_add_modified_page(cs, -1, REDISLITE_PAGE_TYPE_INDEX, child);
+			if (root->right_page < 0) {
+				return root->right_page;
+			}
+			capacity = db->page_size - 14;
+			pos = split_point(child, capacity, capacity);
+			if (pos < 0) {
+				return REDISLITE_ERR;
+			}
+			status = split_page(cs, child, pos, root, 0);
+			if (status != REDISLITE_OK) {
+				return status;
 			}
+			child->free_space = capacity - used_space(child);
+			root->free_space = page_capacity(db, first_page, root) - used_space(root);
+			return mark_modified(cs, first_page, level);
+		}
+		pos = split_point(level->page, db->page_size - 14, capacity);
+		if (pos < 0) {
+			return REDISLITE_ERR;
+		}
+		status = split_page(cs, level->page, pos, levels[d - 1].page, levels[d - 1].pos);
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+		level->page->free_space = capacity - used_space(level->page);
+		status = mark_modified(cs, first_page, level);
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+	}
+	return REDISLITE_OK;
+}
+
+/*
+ * Merges `page`, the child followed from `parent`, with the page next to
+ * it if both fit in one. Returns 1 if they were merged, 0 if not.
+ */
+static int merge_sibling(changeset *cs, index_level *parent, redislite_page_index *page, int number)
+{
+	redislite *db = cs->db;
+	redislite_page_index *up = parent->page, *left, *right;
+	size_t separator_pos;
+	int left_num, right_num, status;
+	if (parent->pos > 0 && up->keys[parent->pos - 1]->type == REDISLITE_PAGE_TYPE_INDEX) {
+		separator_pos = parent->pos - 1;
+		left_num = up->keys[separator_pos]->left_page;
+		right_num = number;
+		left = redislite_page_get(db, cs, left_num, REDISLITE_PAGE_TYPE_INDEX);
+		right = page;
+	}
+	else if (parent->pos < up->number_of_keys) {
+		separator_pos = parent->pos;
+		if (parent->pos + 1 == up->number_of_keys) {
+			right_num = up->right_page;
+		}
+		else {
+			right_num = up->keys[parent->pos + 1]->type == REDISLITE_PAGE_TYPE_INDEX ? up->keys[parent->pos + 1]->left_page : 0;
+		}
+		if (right_num == 0) {
+			return 0;
+		}
+		left_num = number;
+		left = page;
+		right = redislite_page_get(db, cs, right_num, REDISLITE_PAGE_TYPE_INDEX);
+	}
+	else {
+		return 0;
+	}
+	if (left == NULL || right == NULL) {
+		return REDISLITE_OOM;
+	}
+
+	// what both would take on one page, in either format
+	redislite_page_index_key *separator = up->keys[separator_pos];
+	redislite_page_index_key *previous = left->number_of_keys ? left->keys[left->number_of_keys - 1] : NULL;
+	size_t plain = plain_size(left) + plain_size(right);
+	size_t coded = coded_size(left) + coded_size(right);
+	if (left->right_page) {
+		plain += entry_size(separator->keyname_size, 4);
+		coded += coded_entry_size(previous, separator);
+		previous = separator;
+	}
+	if (right->number_of_keys > 0) {
+		coded -= coded_entry_size(NULL, right->keys[0]);
+		coded += coded_entry_size(previous, right->keys[0]);
+	}
+	if (MIN(plain, coded) > db->page_size - 14) {
+		return 0;
+	}
+
+	// the right page keeps its number, the parent already points to it
+	if (left->right_page) {
+		status = insert_entry(right, 0, left->right_page, separator->keyname, separator->keyname_size, REDISLITE_PAGE_TYPE_INDEX, NULL, 0);
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+		left->right_page = 0;
+	}
+	status = move_keys(left, 0, left->number_of_keys, right, 0);
+	if (status != REDISLITE_OK) {
+		return status;
+	}
+	right->free_space = db->page_size - 14 - used_space(right);
+	remove_entry(up, separator_pos);
+	status = redislite_add_modified_page(cs, right_num, REDISLITE_PAGE_TYPE_INDEX, right);
+	if (status < 0) {
+		return status;
+	}
+	status = redislite_freelist_push(cs, left_num);
+	return status < 0 ? status : 1;
+}
+
+/*
+ * Merges the pages that fell under half full on the way back up from a
+ * deletion, and moves the only child of the first page up into it.
+ */
+static int merge_pages(changeset *cs, void *first_page, index_level *levels, size_t depth)
+{
+	redislite *db = cs->db;
+	size_t d, capacity, used;
+	int status;
+	for (d = depth - 1; d > 0; d--) {
+		index_level *level = &levels[d];
+		capacity = page_capacity(db, first_page, level->page);
+		used = used_space(level->page);
+		level->page->free_space = capacity - used;
+		status = mark_modified(cs, first_page, level);
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+		if (used >= capacity / 2) {
 			return REDISLITE_OK;
 		}
+		status = merge_sibling(cs, &levels[d - 1], level->page, level->number);
+		if (status <= 0) {
+			return status;
+		}
 	}
-	return REDISLITE_NOT_FOUND;
+
+	redislite_page_index *root = levels[0].page;
+	capacity = page_capacity(db, first_page, root);
+	if (root->number_of_keys == 0 && root->right_page) {
+		int child_num = root->right_page;
+		redislite_page_index *child = redislite_page_get(db, cs, child_num, REDISLITE_PAGE_TYPE_INDEX);
+		if (child == NULL) {
+			return REDISLITE_OOM;
+		}
+		if (used_space(child) <= capacity) {
+			status = move_keys(child, 0, child->number_of_keys, root, 0);
+			if (status != REDISLITE_OK) {
+				return status;
+			}
+			root->right_page = child->right_page;
+			child->right_page = 0;
+			status = redislite_freelist_push(cs, child_num);
+			if (status < 0) {
+				return status;
+			}
+		}
+	}
+	root->free_space = capacity - used_space(root);
+	return mark_modified(cs, first_page, &levels[0]);
 }
 
 static redislite_page_index_key *redislite_index_key_for_index_name(void *_db, void *_cs, void *first_page, char *key, size_t length, int *status, int *page_num)
@@ -184,8 +812,7 @@ static redislite_page_index_key *redislite_index_key_for_index_name(void *_db, v
 	changeset *cs = (changeset *)_cs;
 	redislite *db = (redislite *)_db;
 	int found;
-	size_t pos, i;
-	int cmp_result;
+	size_t pos;
 	redislite_page_index *page = ((redislite_page_index_first *)first_page)->page;
 	if (page == NULL) {
 		page = ((redislite_page_index_first *)db->root)->page;
@@ -196,69 +823,60 @@ static redislite_page_index_key *redislite_index_key_for_index_name(void *_db, v
 	*status = REDISLITE_OK;
 
 	while (page != NULL) {
-		found = pos = 0;
-		for (i = 0; i < page->number_of_keys; i++) {
-			cmp_result = (memcmp(page->keys[i]->keyname, key, MIN(page->keys[i]->keyname_size, length)));
-			if (cmp_result == 0) {
-				if (page->keys[i]->keyname_size == length) {
-					redislite_page_index *new_page = redislite_page_get(db, cs, page->keys[i]->left_page, page->keys[i]->type);
-					if (new_page == NULL) {
-						*status = REDISLITE_OOM;
-						return NULL;
-					}
-					if (page->keys[i]->type == REDISLITE_PAGE_TYPE_INDEX) {
-						found = 1;
-						_page_num = page->keys[i]->left_page;
-						if (_cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-							redislite_free_index(db, page);
-						}
-						page = new_page;
-						break;
-					}
+		pos = search_page(page, key, length, &found);
+		if (found) {
+			if (page->keys[pos]->type == REDISLITE_PAGE_TYPE_INDEX) {
+				redislite_page_index *new_page = redislite_page_get(db, cs, page->keys[pos]->left_page, REDISLITE_PAGE_TYPE_INDEX);
+				if (new_page == NULL) {
+					*status = REDISLITE_OOM;
+					return NULL;
+				}
+				_page_num = page->keys[pos]->left_page;
+				if (_cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
+					redislite_free_index(db, page);
+				}
+				page = new_page;
+				continue;
+			}
 
-					redislite_page_index_key *ret = redislite_malloc(sizeof(redislite_page_index_key));
-					if (ret == NULL) {
-						*status = REDISLITE_OOM;
-						return NULL;
-					}
-					ret->type = page->keys[i]->type;
-					ret->page = page;
-					ret->keyname_size = page->keys[i]->keyname_size;
-					ret->left_page = page->keys[i]->left_page;
-					ret->keyname = redislite_malloc(sizeof(char) * ret->keyname_size);
-					if (ret->keyname == NULL) {
-						redislite_free(ret);
-						*status = REDISLITE_OOM;
-						return NULL;
-					}
-					memcpy(ret->keyname, page->keys[i]->keyname, ret->keyname_size);
-
-					if (_cs == NULL) {
-						redislite_page_type *page_type = redislite_page_get_type(db, page->keys[i]->type);
-						if (page_type->free_function) {
-							page_type->free_function(db, new_page);
-						}
-						if (page != ((redislite_page_index_first *)db->root)->page) {
-							redislite_free_index(db, page);
-						}
-					}
-					if (page_num) {
-						*page_num = _page_num;
-					}
-					return ret;
+			redislite_page_index_key *ret = redislite_malloc(sizeof(redislite_page_index_key));
+			if (ret == NULL) {
+				*status = REDISLITE_OOM;
+				return NULL;
+			}
+			ret->type = page->keys[pos]->type;
+			ret->in_block = 0;
+			ret->page = page;
+			ret->keyname_size = page->keys[pos]->keyname_size;
+			ret->left_page = page->keys[pos]->left_page;
+			ret->slot = page->keys[pos]->slot;
+			ret->keyname = redislite_malloc(sizeof(char) * ret->keyname_size);
+			if (ret->keyname == NULL) {
+				redislite_free(ret);
+				*status = REDISLITE_OOM;
+				return NULL;
+			}
+			memcpy(ret->keyname, page->keys[pos]->keyname, ret->keyname_size);
+			ret->value_size = page->keys[pos]->value_size;
+			ret->value = NULL;
+			if (page->keys[pos]->value != NULL) {
+				ret->value = redislite_malloc(sizeof(char) * (ret->value_size ? ret->value_size : 1));
+				if (ret->value == NULL) {
+					redislite_free(ret->keyname);
+					redislite_free(ret);
+					*status = REDISLITE_OOM;
+					return NULL;
 				}
-				cmp_result = (page->keys[i]->keyname_size > length ? 1 : -1);
+				memcpy(ret->value, page->keys[pos]->value, ret->value_size);
 			}
 
-			if (cmp_result < 0) {
-				pos = i + 1;
+			if (_cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
+				redislite_free_index(db, page);
 			}
-			else {
-				break;
+			if (page_num) {
+				*page_num = _page_num;
 			}
-		}
-		if (found) {
-			continue;
+			return ret;
 		}
 
 		char type;
@@ -267,124 +885,322 @@ static redislite_page_index_key *redislite_index_key_for_index_name(void *_db, v
 			type = REDISLITE_PAGE_TYPE_INDEX;
 		}
 		else {
-			_page_num = page->keys[pos]->left_page;
-			type = page->keys[pos]->type;
-		}
-
-		if (_page_num == 0) {
-			if (_cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-				redislite_free_index(db, page);
+			_page_num = page->keys[pos]->left_page;
+			type = page->keys[pos]->type;
+		}
+
+		if (_page_num == 0) {
+			if (_cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
+				redislite_free_index(db, page);
+			}
+			*status = REDISLITE_NOT_FOUND;
+			return NULL;
+		}
+
+		void *new_page = redislite_page_get(db, cs, _page_num, type);
+		if (new_page == NULL) {
+			*status = REDISLITE_OOM;
+			return NULL;
+		}
+		if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
+			redislite_free_index(db, page);
+		}
+		if (type == REDISLITE_PAGE_TYPE_INDEX) {
+			page = (redislite_page_index *)new_page;
+		}
+		else {
+			if (cs == NULL) {
+				redislite_page_type *page_type = redislite_page_get_type(db, type);
+				if (page_type->free_function) {
+					page_type->free_function(db, new_page);
+				}
+			}
+			*status = REDISLITE_NOT_FOUND;
+			return NULL;
+		}
+	}
+	*status = REDISLITE_NOT_FOUND;
+	return NULL;
+}
+
+/*
+ * Index page `num` decoded if the changeset or the shared cache can keep
+ * it; NULL if it has to be read and searched in place.
+ */
+static redislite_page_index *decoded_index(redislite *db, changeset *cs, int num)
+{
+	if (cs == NULL) {
+		return NULL;
+	}
+	redislite_page_cache *cache = (redislite_page_cache *)db->page_cache;
+	if (cache != NULL && cache->size > 0) {
+		// decoded once, the next lookups through this page need no read at all
+		return redislite_page_get(db, cs, num, REDISLITE_PAGE_TYPE_INDEX);
+	}
+	redislite_page *page = redislite_modified_page(cs, num);
+	if (page == NULL) {
+		page = redislite_opened_page(cs, num);
+	}
+	return page ? page->data : NULL;
+}
+
+/*
+ * Like search_page, on an index page as read from disk. Front coded keys
+ * are not rebuilt: `matched` bytes of the previous key are equal to `key`,
+ * so the next one is higher if it shares fewer with it, and lower if it
+ * shares more. Returns how the key found compares to `key`, and where its
+ * page number or inline value is in `payload`.
+ */
+static int search_data(unsigned char *data, char *key, size_t length, char *type, int *num, unsigned char **payload)
+{
+	int front_coded = redislite_get_4bytes(&data[0]) == REDISLITE_INDEX_FRONT_CODED;
+	size_t i, j, pos = 14, matched = 0, number_of_keys = redislite_get_2bytes(&data[8]);
+	int prefix = 0, suffix_size, cmp_result;
+	unsigned char *suffix;
+	for (i = 0; i < number_of_keys; i++) {
+		if (front_coded) {
+			pos += getVarint32(&data[pos], prefix);
+		}
+		else {
+			matched = 0;
+		}
+		pos += getVarint32(&data[pos], suffix_size);
+		suffix = &data[pos + 1];
+		if ((size_t)prefix == matched) {
+			for (j = 0; j < (size_t)suffix_size && matched < length && suffix[j] == (unsigned char)key[matched]; j++) {
+				matched++;
+			}
+			if (j < (size_t)suffix_size) {
+				cmp_result = matched < length && suffix[j] < (unsigned char)key[matched] ? -1 : 1;
+			}
+			else {
+				cmp_result = matched < length ? -1 : 0;
+			}
+		}
+		else {
+			cmp_result = (size_t)prefix < matched ? 1 : -1;
+		}
+		if (cmp_result >= 0) {
+			*type = data[pos];
+			*num = value_in_entry(*type) ? 0 : redislite_get_4bytes(&suffix[suffix_size]);
+			*payload = &suffix[suffix_size];
+			return cmp_result;
+		}
+		pos += 1 + suffix_size + skip_payload(data[pos], &suffix[suffix_size]);
+	}
+	*num = redislite_get_4bytes(&data[10]);
+	return 1;
+}
+
+// a copy of an inline value, NUL terminated for the callers parsing numbers
+static int copy_value(char *value, size_t value_size, char **value_p, size_t *value_length_p)
+{
+	char *copy = redislite_malloc(sizeof(char) * (value_size + 1));
+	if (copy == NULL) {
+		return REDISLITE_OOM;
+	}
+	memcpy(copy, value, value_size);
+	copy[value_size] = '\0';
+	*value_p = copy;
+	*value_length_p = value_size;
+	return REDISLITE_OK;
+}
+
+/*
+ * Copies the value in the entry of a key. An integer is given as it is to
+ * `integer`, or written as text to `value` when `integer` is NULL.
+ */
+static int entry_value(char type, char *data, size_t size, char **value, size_t *value_length, long long *integer)
+{
+	if (type == REDISLITE_PAGE_TYPE_STRING_INTEGER) {
+		long long number = redislite_get_8bytes((unsigned char *)data);
+		char text[21];
+		if (integer != NULL) {
+			*integer = number;
+			return REDISLITE_OK;
+		}
+		return value == NULL ? REDISLITE_OK : copy_value(text, sprintf(text, "%lld", number), value, value_length);
+	}
+	return value == NULL ? REDISLITE_OK : copy_value(data, size, value, value_length);
+}
+
+/*
+ * Looks a key up without copying it: decoded pages are searched as they
+ * are and, when nothing would keep a decoded page, the bytes read are
+ * compared in place. Neither the key nor its value page are read into
+ * new objects. Returns 1 and sets `type` and `left_page` if found, 0 if
+ * not; an inline string, or one on a heap page, is copied to `value` when
+ * it is not NULL, and so is an integer unless `integer` takes it.
+ */
+static int lookup_key(redislite *db, changeset *cs, void *first_page, char *key, size_t length, char *type, int *left_page, char **value, size_t *value_length, long long *integer)
+{
+	redislite_page_index *page = ((redislite_page_index_first *)first_page)->page;
+	if (page == NULL) {
+		page = ((redislite_page_index_first *)db->root)->page;
+	}
+	unsigned char *data = NULL, *payload;
+	size_t pos;
+	int cmp_result, found, num, slot, value_size, status;
+	char key_type;
+
+	while (1) {
+		num = 0;
+		slot = 0;
+		cmp_result = 1;
+		key_type = REDISLITE_PAGE_TYPE_INDEX;
+		status = 1;
+		if (page != NULL) {
+			pos = search_page(page, key, length, &found);
+			cmp_result = !found;
+			if (pos < page->number_of_keys) {
+				num = page->keys[pos]->left_page;
+				slot = page->keys[pos]->slot;
+				key_type = page->keys[pos]->type;
+				if (found && value_in_entry(key_type) && entry_value(key_type, page->keys[pos]->value, page->keys[pos]->value_size, value, value_length, integer) != REDISLITE_OK) {
+					status = REDISLITE_OOM;
+				}
+			}
+			else {
+				num = page->right_page;
+			}
+		}
+		else {
+			cmp_result = search_data(data, key, length, &key_type, &num, &payload);
+			if (cmp_result == 0 && value_in_entry(key_type)) {
+				value_size = 8;
+				if (key_type == REDISLITE_PAGE_TYPE_STRING_INLINE) {
+					payload += getVarint32(payload, value_size);
+				}
+				if (entry_value(key_type, (char *)payload, value_size, value, value_length, integer) != REDISLITE_OK) {
+					status = REDISLITE_OOM;
+				}
 			}
-			*status = REDISLITE_NOT_FOUND;
-			return NULL;
+			else if (cmp_result == 0 && key_type == REDISLITE_PAGE_TYPE_HEAP) {
+				slot = redislite_get_2bytes(&payload[4]);
+			}
+			redislite_release_page(db, data);
 		}
 
-		void *new_page = redislite_page_get(db, cs, _page_num, type);
-		if (new_page == NULL) {
-			*status = REDISLITE_OOM;
-			return NULL;
+		if (cmp_result == 0 && key_type == REDISLITE_PAGE_TYPE_HEAP && value != NULL) {
+			status = redislite_heap_get(db, cs, num, slot, value, value_length);
+			status = status == REDISLITE_OK ? 1 : status;
 		}
-		if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-			redislite_free_index(db, page);
+		if (cmp_result == 0 && key_type != REDISLITE_PAGE_TYPE_INDEX) {
+			*type = key_type;
+			*left_page = num;
+			return status;
 		}
-		if (type == REDISLITE_PAGE_TYPE_INDEX) {
-			page = (redislite_page_index *)new_page;
+		if (num == 0 || key_type != REDISLITE_PAGE_TYPE_INDEX) {
+			return 0;
 		}
-		else {
-			if (cs == NULL) {
-				redislite_page_type *page_type = redislite_page_get_type(db, type);
-				if (page_type->free_function) {
-					page_type->free_function(db, new_page);
-				}
+		page = decoded_index(db, cs, num);
+		if (page == NULL) {
+			data = redislite_read_page(db, cs, num);
+			if (data == NULL) {
+				return REDISLITE_OOM;
 			}
-			*status = REDISLITE_NOT_FOUND;
-			return NULL;
 		}
 	}
-	*status = REDISLITE_NOT_FOUND;
-	return NULL;
 }
 
 int redislite_page_index_type(void *_db, void *_cs, void *first_page, char *key, size_t length, char *type)
 {
-	redislite *db = (redislite *)_db;
-	int status;
-	redislite_page_index_key *index_key = redislite_index_key_for_index_name(db, _cs, first_page, key, length, &status, NULL);
-	if (status == REDISLITE_OOM) {
-		return REDISLITE_OOM;
-	}
-	int ret = REDISLITE_NOT_FOUND;
-	if (index_key != NULL) {
-		ret = REDISLITE_OK;
-		*type = index_key->type;
+	int left_page;
+	int status = lookup_key(_db, _cs, first_page, key, length, type, &left_page, NULL, NULL, NULL);
+	if (status < 0) {
+		return status;
 	}
-	redislite_free_key(index_key);
-	return ret;
+	return status ? REDISLITE_OK : REDISLITE_NOT_FOUND;
 }
 
 int redislite_value_page_for_key(void *_db, void *_cs, void *first_page, char *key, size_t length, char *type)
 {
-	redislite *db = (redislite *)_db;
-	int status;
-	redislite_page_index_key *index_key = redislite_index_key_for_index_name(db, _cs, first_page, key, length, &status, NULL);
-	if (status == REDISLITE_OOM) {
-		return REDISLITE_OOM;
+	return redislite_value_for_key(_db, _cs, first_page, key, length, type, NULL, NULL);
+}
+
+/*
+ * Like redislite_value_page_for_key, also copying the value of an inline
+ * string or integer, whose page number is 0, or of one on a heap page to
+ * `value`.
+ */
+int redislite_value_for_key(void *_db, void *_cs, void *first_page, char *key, size_t length, char *type, char **value, size_t *value_length)
+{
+	return redislite_integer_for_key(_db, _cs, first_page, key, length, type, NULL, value, value_length);
+}
+
+/*
+ * Like redislite_value_for_key, giving the value of a key with an integer
+ * in its entry to `integer` instead of writing it as text.
+ */
+int redislite_integer_for_key(void *_db, void *_cs, void *first_page, char *key, size_t length, char *type, long long *integer, char **value, size_t *value_length)
+{
+	char key_type;
+	int left_page;
+	int status = lookup_key(_db, _cs, first_page, key, length, &key_type, &left_page, value, value_length, integer);
+	if (status < 0) {
+		return status;
 	}
-	int ret = REDISLITE_NOT_FOUND;
-	if (index_key != NULL) {
-		ret = index_key->left_page;
-		if (type) {
-			*type = index_key->type;
-		}
+	if (status == 0) {
+		return REDISLITE_NOT_FOUND;
 	}
-	redislite_free_key(index_key);
-	return ret;
+	if (type) {
+		*type = key_type;
+	}
+	return left_page;
 }
 
 int redislite_exists_key(void *_db, void *_cs, void *first_page, char *key, size_t length)
 {
-	redislite *db = (redislite *)_db;
-	int status;
-	redislite_page_index_key *index_key = redislite_index_key_for_index_name(db, _cs, first_page, key, length, &status, NULL);
-	if (status != REDISLITE_OK) {
-		return status;
+	char type;
+	int left_page;
+	return lookup_key(_db, _cs, first_page, key, length, &type, &left_page, NULL, NULL, NULL);
+}
+
+// frees whatever the value of a key takes besides its entry
+static int delete_value(changeset *cs, char type, int left_page, int slot)
+{
+	if (value_in_entry(type)) {
+		return REDISLITE_OK;
 	}
-	if (index_key != NULL) {
-		redislite_free_key(index_key);
-		return 1;
+	if (type == REDISLITE_PAGE_TYPE_HEAP) {
+		return redislite_heap_delete(cs, left_page, slot);
 	}
-	return 0;
+	redislite_page_delete(cs, left_page, type);
+	return REDISLITE_OK;
 }
 
 int redislite_delete_key(void *_cs, void *first_page, char *key, size_t length, int delete_data)
 {
 	changeset *cs = (changeset *)_cs;
 	redislite *db = cs->db;
-	int status, page_num;
-	redislite_page_index_key *index_key = redislite_index_key_for_index_name(db, _cs, first_page, key, length, &status, &page_num);
+	index_level *levels;
+	size_t depth;
+	int found;
+	int status = descend(cs, first_page, first_page == db->root ? 0 : -1, key, length, &levels, &depth, &found);
 	if (status != REDISLITE_OK) {
 		return status;
 	}
-	if (index_key != NULL) {
-		if (index_key->page) {
-			int left_page = index_key->left_page;
-			char type = index_key->type;
-			status = redislite_remove_key(_cs, index_key, page_num);
-			if (first_page == db->root) {
-				((redislite_page_index_first *)first_page)->number_of_keys--;
-				status = redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, db->root);
-			}
-			index_key = NULL;
-			if (status == REDISLITE_OK && delete_data) {
-				redislite_page_delete(_cs, left_page, type);
-			}
-		}
-		else {
-			status = REDISLITE_ERR;
-		}
+	if (!found) {
+		redislite_free(levels);
+		return REDISLITE_NOT_FOUND;
+	}
+
+	redislite_page_index *page = levels[depth - 1].page;
+	int left_page = page->keys[levels[depth - 1].pos]->left_page;
+	int slot = page->keys[levels[depth - 1].pos]->slot;
+	char type = page->keys[levels[depth - 1].pos]->type;
+	remove_entry(page, levels[depth - 1].pos);
+	if (first_page == db->root) {
+		((redislite_page_index_first *)first_page)->number_of_keys--;
 	}
-	if (index_key) {
-		redislite_free_key(index_key);
+	status = merge_pages(cs, first_page, levels, depth);
+	if (status == REDISLITE_OK) {
+		// its number of keys changed even if no page was merged up to it
+		status = mark_modified(cs, first_page, &levels[0]);
+	}
+	redislite_free(levels);
+	if (status == REDISLITE_OK && delete_data) {
+		status = delete_value(cs, type, left_page, slot);
 	}
 	return status;
 }
@@ -408,240 +1224,143 @@ int redislite_delete_keys(void *_cs, int q, char **keys, size_t *lengths)
 	return counter;
 }
 
-int redislite_insert_key(void *_cs, void *first_page, int first_page_num, char *key, size_t length, int left, char type)
+/*
+ * Keys go in the leaf pages of a B+tree; pages that overflow are split in
+ * halves and their separator goes up to the parent.
+ */
+static int insert_key(changeset *cs, void *first_page, int first_page_num, char *key, size_t length, int left, int slot, char type, char *value, size_t value_size)
 {
-	changeset *cs = (changeset *)_cs;
 	redislite *db = cs->db;
 	if (db->readonly) {
 		return REDISLITE_READONLY;
 	}
+	// any two keys fit in a page, so splits always find a place; the
+	// separators naming them take a page number. The limit on the key
+	// takes the largest payload other than an inline value, so a key
+	// that was stored once can hold any kind of value later
+	if (entry_size(length, 8) > (db->page_size - 14) / 2) {
+		return REDISLITE_KEY_TOO_LONG;
+	}
+	size_t payload = type == REDISLITE_PAGE_TYPE_STRING_INLINE ? inline_payload_size(value_size) : type == REDISLITE_PAGE_TYPE_STRING_INTEGER ? 8 : type == REDISLITE_PAGE_TYPE_HEAP ? 6 : 4;
+	if (entry_size(length, MAX(payload, 4)) > (db->page_size - 14) / 2) {
+		return REDISLITE_ERR;
+	}
 
-	size_t i, pos;
-	int cmp_result, should_continue;
-	redislite_page_index *page = ((redislite_page_index_first *)first_page)->page;
-	((redislite_page_index_first *)first_page)->number_of_keys++;
-	int page_num = first_page_num;
-	int status = redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_FIRST, first_page);
-	if (status < 0) {
+	index_level *levels;
+	size_t depth;
+	int found;
+	int status = descend(cs, first_page, first_page_num, key, length, &levels, &depth, &found);
+	if (status != REDISLITE_OK) {
 		return status;
 	}
 
-	while (page != NULL) {
-		should_continue = 0;
-		pos = 0;
-		for (i = 0; i < page->number_of_keys; i++) {
-			cmp_result = (memcmp(page->keys[i]->keyname, key, MIN(page->keys[i]->keyname_size, length)));
-			if (cmp_result == 0) {
-				if (page->keys[i]->keyname_size == length) {
-					if (page->keys[i]->type == REDISLITE_PAGE_TYPE_INDEX) {
-						redislite_page_index *new_page = redislite_page_get(db, cs, page->keys[i]->left_page, REDISLITE_PAGE_TYPE_INDEX);
-						if (new_page == NULL) {
-							return REDISLITE_OOM;
-						}
-						page_num = page->keys[i]->left_page;
-						if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-							redislite_free_index(db, page);
-						}
-						page = new_page;
-						should_continue = 1;
-						break;
-					}
-					redislite_page_delete(_cs, page->keys[i]->left_page, page->keys[i]->type);
-					page->keys[i]->left_page = left;
-					page->keys[i]->type = type;
-					int result;
-					((redislite_page_index_first *)first_page)->number_of_keys--;
-					if (page != ((redislite_page_index_first *)first_page)->page) {
-						result = redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_INDEX, page);
-					}
-					else {
-						result = redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_FIRST, first_page);
-					}
-					if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-						redislite_free_index(db, page);
-					}
-					if (result < 0) {
-						return result;
-					}
-					return REDISLITE_OK;
-				}
-				cmp_result = (page->keys[i]->keyname_size > length ? 1 : -1);
-			}
-			if (cmp_result < 0) {
-				pos = i + 1;
-			}
-			else {
-				break;
-			}
-		}
-		if (should_continue) {
-			continue;
-		}
-		if (pos < page->number_of_keys) {
-			if (page->keys[pos]->type == REDISLITE_PAGE_TYPE_INDEX) {
-				redislite_page_index *new_page = redislite_page_get(db, cs, page->keys[pos]->left_page, REDISLITE_PAGE_TYPE_INDEX);
-				if (new_page == NULL) {
-					return REDISLITE_OOM;
-				}
-				page_num = page->keys[pos]->left_page;
-				if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-					redislite_free_index(db, page);
-				}
-				page = new_page;
-				continue;
-			}
-		}
-		else {
-			if (page->right_page > 0) {
-				redislite_page_index *new_page = redislite_page_get(db, cs, page->right_page, REDISLITE_PAGE_TYPE_INDEX);
-				if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-					redislite_free_index(db, page);
-				}
-				if (new_page == NULL) {
-					return REDISLITE_OOM;
-				}
-				page_num = page->right_page;
-				page = new_page;
-				continue;
-			}
-		}
-
-		int result = redislite_page_index_add_key(cs, page, pos, left, key, length, type);
-		if (result == REDISLITE_OK) {
-			if (page != ((redislite_page_index_first *)first_page)->page) {
-				result = redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_INDEX, page);
-			}
-			else {
-				result = redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_FIRST, first_page);
-			}
-			if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-				redislite_free_index(db, page);
-			}
-			if (result < 0) {
-				return -result;
-			}
-			return REDISLITE_OK;
+	index_level *level = &levels[depth - 1];
+	if (found) {
+		redislite_page_index_key *index_key = level->page->keys[level->pos];
+		status = delete_value(cs, index_key->type, index_key->left_page, index_key->slot);
+		if (status == REDISLITE_OK && index_key->type == REDISLITE_PAGE_TYPE_STRING_INTEGER && type == REDISLITE_PAGE_TYPE_STRING_INTEGER) {
+			// a counter changes in place
+			memcpy(index_key->value, value, 8);
+			status = mark_modified(cs, first_page, level);
+			redislite_free(levels);
+			return status;
 		}
-		if (result == REDISLITE_OOM || result == REDISLITE_OK) {
-			if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-				redislite_free_index(db, page);
-			}
-			return result;
+		if (status == REDISLITE_OK && !value_in_entry(index_key->type) && !value_in_entry(type) && payload_size(index_key) == payload) {
+			index_key->left_page = left;
+			index_key->slot = slot;
+			index_key->type = type;
+			status = mark_modified(cs, first_page, level);
+			redislite_free(levels);
+			return status;
 		}
-
-		int previous_page_num = page_num;
-		char next_type;
-		if (pos == page->number_of_keys) {
-			page_num = page->right_page;
-			next_type = REDISLITE_PAGE_TYPE_INDEX;
+		if (status != REDISLITE_OK) {
+			redislite_free(levels);
+			return status;
 		}
-		else {
-			page_num = page->keys[pos]->left_page;
-			next_type = page->keys[pos]->type;
+		// the entry changes its size, it may not fit anymore
+		remove_entry(level->page, level->pos);
+	}
+	status = insert_entry(level->page, level->pos, left, key, length, type, value, value_size);
+	if (status == REDISLITE_OK) {
+		level->page->keys[level->pos]->slot = slot;
+		if (!found) {
+			((redislite_page_index_first *)first_page)->number_of_keys++;
 		}
+		status = split_pages(cs, first_page, levels, depth);
+	}
+	if (status == REDISLITE_OK && !found) {
+		status = mark_modified(cs, first_page, &levels[0]);
+	}
+	redislite_free(levels);
+	return status;
+}
 
-		if (page_num == 0) {
-			redislite_page_index *new_page = redislite_page_index_create(db);
-			if (new_page == NULL) {
-				if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-					redislite_free_index(db, page);
-				}
-				return REDISLITE_OOM;
-			}
+int redislite_insert_key(void *_cs, void *first_page, int first_page_num, char *key, size_t length, int left, char type)
+{
+	return insert_key(_cs, first_page, first_page_num, key, length, left, 0, type, NULL, 0);
+}
 
-			int r = redislite_page_index_add_key(cs, new_page, 0, left, key, length, type);
-			if (r != REDISLITE_OK) {
-				redislite_free(new_page);
-				if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-					redislite_free_index(db, page);
-				}
-				return r;
-			}
+/*
+ * Stores a short string in the entry of its key, saving the page it would
+ * take and its read on every lookup.
+ */
+int redislite_insert_inline_key(void *_cs, void *first_page, int first_page_num, char *key, size_t length, char *value, size_t value_length)
+{
+	return insert_key(_cs, first_page, first_page_num, key, length, 0, 0, REDISLITE_PAGE_TYPE_STRING_INLINE, value, value_length);
+}
 
-			page_num = redislite_add_modified_page(cs, -1, REDISLITE_PAGE_TYPE_INDEX, new_page);
-			if (pos < page->number_of_keys) {
-				int r = redislite_page_index_add_key(cs, new_page, 0, page->keys[pos]->left_page, page->keys[pos]->keyname, page->keys[pos]->keyname_size, type);
-				if (r != REDISLITE_OK) {
-					redislite_free(new_page);
-					if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-						redislite_free_index(db, page);
-					}
-					return r;
-				}
-			}
+/*
+ * Stores an integer in the entry of its key, as 8 bytes; it is only
+ * written as text when it is read as a string.
+ */
+int redislite_insert_integer_key(void *_cs, void *first_page, int first_page_num, char *key, size_t length, long long value)
+{
+	unsigned char data[8];
+	redislite_put_8bytes(data, value);
+	return insert_key(_cs, first_page, first_page_num, key, length, 0, 0, REDISLITE_PAGE_TYPE_STRING_INTEGER, (char *)data, 8);
+}
 
-			if (pos == page->number_of_keys) {
-				page->right_page = page_num;
-			}
-			else {
-				page->keys[pos]->left_page = page_num;
-			}
-			if (page != ((redislite_page_index_first *)first_page)->page) {
-				result = redislite_add_modified_page(cs, previous_page_num, REDISLITE_PAGE_TYPE_INDEX, page);
-			}
-			else {
-				result = redislite_add_modified_page(cs, previous_page_num, REDISLITE_PAGE_TYPE_FIRST, first_page);
-			}
-			if (result < 0) {
-				return result;
-			}
-			if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-				redislite_free_index(db, page);
-			}
-			return REDISLITE_OK;
-		}
+int redislite_value_fits_inline(void *_db, size_t key_length, size_t value_length)
+{
+	redislite *db = (redislite *)_db;
+	if (value_length > REDISLITE_INLINE_VALUE_SIZE) {
+		return 0;
+	}
+	return entry_size(key_length, MAX(inline_payload_size(value_length), 4)) <= (db->page_size - 14) / 2;
+}
 
-		if (next_type == REDISLITE_PAGE_TYPE_INDEX) {
-			redislite_page_index *new_page = redislite_page_get(db, cs, page_num, REDISLITE_PAGE_TYPE_INDEX);
-			if (new_page == NULL) {
-				if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-					redislite_free_index(db, page);
-				}
-				return REDISLITE_OOM;
-			}
-			if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-				redislite_free_index(db, page);
-			}
-			page = new_page;
-		}
-		else {
-			redislite_page_index *new_index_page = redislite_page_index_create(db);
-			if (new_index_page == NULL) {
-				if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-					redislite_free_index(db, page);
-				}
-				return REDISLITE_OOM;
-			}
-			/* assert pos<size */
-			int r = redislite_page_index_add_key(cs, new_index_page, 0, page->keys[pos]->left_page, page->keys[pos]->keyname, page->keys[pos]->keyname_size, next_type);
-			if (r != REDISLITE_OK) {
-				redislite_free(new_index_page);
-				if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-					redislite_free_index(db, page);
-				}
-				return r;
-			}
-			page_num = page->keys[pos]->left_page = redislite_add_modified_page(cs, -1, REDISLITE_PAGE_TYPE_INDEX, new_index_page);
-			page->keys[pos]->page = new_index_page;
-			page->keys[pos]->type = REDISLITE_PAGE_TYPE_INDEX;
-			if (cs == NULL && page != ((redislite_page_index_first *)db->root)->page) {
-				redislite_free_index(db, page);
-			}
-			if (page != ((redislite_page_index_first *)first_page)->page) {
-				result = redislite_add_modified_page(cs, previous_page_num, REDISLITE_PAGE_TYPE_INDEX, page);
-			}
-			else {
-				result = redislite_add_modified_page(cs, previous_page_num, REDISLITE_PAGE_TYPE_FIRST, first_page);
-			}
-			if (result < 0) {
-				return result;
-			}
+// points a key to the string in `slot` of heap page `page_num`
+int redislite_insert_heap_key(void *_cs, void *first_page, int first_page_num, char *key, size_t length, int page_num, int slot)
+{
+	return insert_key(_cs, first_page, first_page_num, key, length, page_num, slot, REDISLITE_PAGE_TYPE_HEAP, NULL, 0);
+}
 
-			redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, db->root);
-			page = new_index_page;
-		}
+/*
+ * Points `key` to heap page `to` if it is on `from`, for VACUUM STEP.
+ * Returns 1 if it was, 0 if not; with `from` equal to `to` it only tells.
+ */
+int redislite_page_index_repoint_key(void *_cs, void *first_page, char *key, size_t length, int from, int to)
+{
+	changeset *cs = (changeset *)_cs;
+	index_level *levels;
+	size_t depth;
+	int found;
+	int status = descend(cs, first_page, first_page == cs->db->root ? 0 : -1, key, length, &levels, &depth, &found);
+	if (status != REDISLITE_OK) {
+		return status;
+	}
+	index_level *level = &levels[depth - 1];
+	redislite_page_index_key *index_key = found ? level->page->keys[level->pos] : NULL;
+	if (index_key == NULL || index_key->type != REDISLITE_PAGE_TYPE_HEAP || index_key->left_page != from) {
+		redislite_free(levels);
+		return 0;
 	}
-	return REDISLITE_NOT_FOUND;
+	if (from != to) {
+		index_key->left_page = to;
+		status = mark_modified(cs, first_page, level);
+	}
+	redislite_free(levels);
+	return status == REDISLITE_OK ? 1 : status;
 }
 
 int redislite_page_index_rename_key(void *_cs, void *first_page, char *src, size_t src_len, char *target, size_t target_len)
@@ -656,7 +1375,24 @@ int redislite_page_index_rename_key(void *_cs, void *first_page, char *src, size
 	if (status != REDISLITE_OK) {
 		return status;
 	}
-	status = redislite_insert_key(_cs, first_page, 0, target, target_len, key->left_page, key->type);
+	if (key->type == REDISLITE_PAGE_TYPE_HEAP) {
+		// the cell is named after its key, the string is stored again under the new one
+		char *value;
+		size_t value_length;
+		status = redislite_heap_get(cs->db, cs, key->left_page, key->slot, &value, &value_length);
+		redislite_free_key(key);
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+		status = redislite_page_string_set_key_string(cs, target, target_len, value, value_length);
+		redislite_free(value);
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+		return redislite_delete_key(_cs, cs->db->root, src, src_len, 1);
+	}
+	status = insert_key(cs, first_page, 0, target, target_len, key->left_page, 0, key->type, key->value, key->value_size);
+	redislite_free_key(key);
 	if (status != REDISLITE_OK) {
 		return status;
 	}
@@ -684,61 +1420,15 @@ int redislite_page_index_renamenx_key(void *_cs, void *first_page, char *src, si
 int redislite_page_index_add_key(void *_cs, redislite_page_index *page, int pos, int left, char *key, size_t length, char type)
 {
 	changeset *cs = (changeset *)_cs;
-	redislite_page_index_key *index_key = redislite_malloc(sizeof(redislite_page_index_key));
-	if (index_key == NULL) {
-		return REDISLITE_OOM;
-	}
-
-	unsigned char length_str[9];
-	size_t new_key_length = length + 5;
-	new_key_length += putVarint32(length_str, length);
+	size_t new_key_length = entry_size(length, 4);
 	if (page->free_space < new_key_length) {
-		redislite_free(index_key);
 		return REDISLITE_ERR;
 	}
 
-	if (page->alloced_keys == 0) {
-		page->alloced_keys = 10;
-		page->keys = redislite_malloc(sizeof(redislite_page_index_key) * page->alloced_keys);
-	}
-	else if (page->alloced_keys == page->number_of_keys) {
-		redislite_page_index_key **new_keys = redislite_realloc(page->keys, sizeof(redislite_page_index_key) * page->alloced_keys * 2);
-		if (new_keys == NULL) {
-			return REDISLITE_OOM;
-		}
-		page->keys = new_keys;
-		page->alloced_keys *= 2;
-	}
-
-	index_key->type = type;
-	index_key->page = page;
-	index_key->keyname_size = length;
-	index_key->keyname = redislite_malloc(length * sizeof(char));
-	if (index_key->keyname == NULL) {
-		redislite_free(index_key);
-		return REDISLITE_OOM;
-	}
-	memcpy(index_key->keyname, key, length);
-	index_key->left_page = left;
-
-	size_t i, target_pos;
-	if (pos < 0) {
-		target_pos = page->number_of_keys;
-	}
-	else {
-		target_pos = (size_t)pos;
-	}
-
-	if (page->number_of_keys > 0) {
-		for (i = page->number_of_keys - 1; i >= target_pos; --i) {
-			page->keys[i + 1] = page->keys[i];
-			if (i == 0) {
-				break;
-			}
-		}
+	int status = insert_entry(page, pos < 0 ? page->number_of_keys : (size_t)pos, left, key, length, type, NULL, 0);
+	if (status != REDISLITE_OK) {
+		return status;
 	}
-	page->keys[target_pos] = index_key;
-	page->number_of_keys++;
 	page->free_space -= new_key_length;
 	if (type != REDISLITE_PAGE_TYPE_INDEX) {
 		return redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, cs->db->root);
@@ -773,7 +1463,6 @@ int redislite_get_keys(void *_db, void *_cs, char *pattern, int pattern_len, int
 	pages[0] = 0;
 
 	redislite_page_index *page;
-	int current_page_num;
 	int allkeys = pattern_len == 2 && (pattern[0] == '*' && pattern[1] == '\0');
 	while (1) {
 		if (pages[pages_pos] == 0) {
@@ -782,16 +1471,16 @@ int redislite_get_keys(void *_db, void *_cs, char *pattern, int pattern_len, int
 		else {
 			page = redislite_page_get(db, _cs, pages[pages_pos], REDISLITE_PAGE_TYPE_INDEX);
 		}
-		current_page_num = pages[pages_pos];
 
 		if (page == NULL) {
 			goto cleanup;
 		}
 
-		if (pages_alloced < pages_pos + page->number_of_keys) {
+		// the right page is a child too
+		if (pages_alloced < pages_pos + page->number_of_keys + 1) {
 			pages_alloced *= 2;
-			if (pages_alloced < pages_pos + page->number_of_keys) {
-				pages_alloced = pages_pos + page->number_of_keys;
+			if (pages_alloced < pages_pos + page->number_of_keys + 1) {
+				pages_alloced = pages_pos + page->number_of_keys + 1;
 			}
 			int *pages_tmp = redislite_realloc(pages, sizeof(char *) * pages_alloced);
 			if (pages_tmp == NULL) {
@@ -821,50 +1510,24 @@ int redislite_get_keys(void *_db, void *_cs, char *pattern, int pattern_len, int
 		if (page->right_page) {
 			pages[pages_pos++] = page->right_page;
 		}
-		if (page == ((redislite_page_index_first *)db->root)->page || (_cs != NULL && (void *)page == redislite_modified_page(_cs, pages[pages_pos - 1])->data)) {
-			// should copy
-			for (i = 0; i < page->number_of_keys; i++) {
-				if (page->keys[i]->type == REDISLITE_PAGE_TYPE_INDEX) {
-					pages[pages_pos++] = page->keys[i]->left_page;
-				}
-				else if (allkeys || redislite_stringmatchlen(pattern, pattern_len, page->keys[i]->keyname, page->keys[i]->keyname_size, 0)) {
-					keys[keys_pos] = redislite_malloc(sizeof(char *) * page->keys[i]->keyname_size);
-					if (keys[keys_pos] == NULL) {
-						goto cleanup;
-					}
-					memcpy(keys[keys_pos], page->keys[i]->keyname, page->keys[i]->keyname_size);
-					keys_length[keys_pos] = page->keys[i]->keyname_size;
-					keys_pos++;
-				}
-			}
-		}
-		else {
-			// should NOT copy
-			for (i = 0; i < page->number_of_keys; i++) {
-				if (page->keys[i]->type == REDISLITE_PAGE_TYPE_INDEX) {
-					pages[pages_pos++] = page->keys[i]->left_page;
-				}
-				else if (allkeys || redislite_stringmatchlen(pattern, pattern_len, page->keys[i]->keyname, page->keys[i]->keyname_size, 0)) {
-					keys[keys_pos] = page->keys[i]->keyname;
-					keys_length[keys_pos] = page->keys[i]->keyname_size;
-					keys_pos++;
-				}
+		for (i = 0; i < page->number_of_keys; i++) {
+			if (page->keys[i]->type == REDISLITE_PAGE_TYPE_INDEX) {
+				pages[pages_pos++] = page->keys[i]->left_page;
 			}
-			if (page != ((redislite_page_index_first *)db->root)->page) {
-				for (i = 0; i < page->number_of_keys; i++) {
-					redislite_free(page->keys[i]); // not freeing the char*, only the key
-				}
-				if (_cs == NULL) {
-					redislite_free(page->keys);
-					redislite_free(page);
-				}
-				else {
-					// we are cheating here!
-					page->number_of_keys = 0;
-					redislite_close_opened_page(_cs, current_page_num);
+			else if (allkeys || redislite_stringmatchlen(pattern, pattern_len, page->keys[i]->keyname, page->keys[i]->keyname_size, 0)) {
+				// copied, names read from disk live in their page's block
+				keys[keys_pos] = redislite_malloc(sizeof(char) * page->keys[i]->keyname_size);
+				if (keys[keys_pos] == NULL) {
+					goto cleanup;
 				}
+				memcpy(keys[keys_pos], page->keys[i]->keyname, page->keys[i]->keyname_size);
+				keys_length[keys_pos] = page->keys[i]->keyname_size;
+				keys_pos++;
 			}
 		}
+		if (page != ((redislite_page_index_first *)db->root)->page && _cs == NULL) {
+			redislite_free_index(db, page);
+		}
 
 		if (pages_pos == 0) {
 			break;
@@ -903,7 +1566,7 @@ int redislite_get_keys(void *_db, void *_cs, char *pattern, int pattern_len, int
 cleanup:
 	if (keys) {
 		for (; keys_pos > 0; keys_pos--) {
-			redislite_free(keys[keys_pos] - 1);
+			redislite_free(keys[keys_pos - 1]);
 		}
 		redislite_free(keys);
 	}
@@ -932,7 +1595,6 @@ int redislite_get_random_key_name(void *_db, void *_cs, char **key_p, size_t *ke
 	pages[0] = 0;
 
 	redislite_page_index *page;
-	int current_page_num;
 	size_t number_of_keys = ((redislite_page_index_first *)db->root)->number_of_keys;
 	if (number_of_keys == 0) {
 		return REDISLITE_NOT_FOUND;
@@ -945,16 +1607,16 @@ int redislite_get_random_key_name(void *_db, void *_cs, char **key_p, size_t *ke
 		else {
 			page = redislite_page_get(db, _cs, pages[pages_pos], REDISLITE_PAGE_TYPE_INDEX);
 		}
-		current_page_num = pages[pages_pos];
 
 		if (page == NULL) {
 			goto cleanup;
 		}
 
-		if (pages_alloced < pages_pos + page->number_of_keys) {
+		// the right page is a child too
+		if (pages_alloced < pages_pos + page->number_of_keys + 1) {
 			pages_alloced *= 2;
-			if (pages_alloced < pages_pos + page->number_of_keys) {
-				pages_alloced = pages_pos + page->number_of_keys;
+			if (pages_alloced < pages_pos + page->number_of_keys + 1) {
+				pages_alloced = pages_pos + page->number_of_keys + 1;
 			}
 			int *pages_tmp = redislite_realloc(pages, sizeof(char *) * pages_alloced);
 			if (pages_tmp == NULL) {
@@ -1021,6 +1683,8 @@ int redislite_flush(void *_cs)
 	db->number_of_pages = 0;
 	db->first_freelist_page = 0;
 	db->number_of_freelist_pages = 0;
+	db->heap_page = 0;
+	redislite_page_cache_clear(db->page_cache); // every other page is garbage now
 	((redislite_page_index_first *)((redislite *)page->db)->root)->number_of_keys = 0;
 	redislite_add_modified_page(_cs, 0, REDISLITE_PAGE_TYPE_FIRST, (redislite_page_index_first *)db->root);
 	return REDISLITE_OK;
@@ -2,12 +2,23 @@
 #define _PAGE_INTERNAL_H
 #include <stddef.h>
 
+// formats of an index page, in its first bytes
+#define REDISLITE_INDEX_PLAIN 0
+#define REDISLITE_INDEX_FRONT_CODED 1
+
+// longest string value kept in its key's entry instead of a page of its own
+#define REDISLITE_INLINE_VALUE_SIZE 64
+
 typedef struct {
 	char type;
+	char in_block; // allocated along with its page by redislite_read_index, freed with it
 	void *page;
 	size_t keyname_size;
 	char *keyname;
 	int left_page;
+	int slot; // of the string on a heap page
+	size_t value_size;
+	char *value; // an inline string or integer as written, NULL for keys pointing to a page
 } redislite_page_index_key;
 
 typedef struct {
@@ -17,15 +28,23 @@ typedef struct {
 	int right_page;
 	size_t alloced_keys;
 	redislite_page_index_key **keys;
+	void *block; // the keys read from disk and their names, NULL if none
 } redislite_page_index;
 
 redislite_page_index *redislite_page_index_create(void *db);
 int redislite_insert_key(void *_cs, void *first_page, int first_page_num, char *key, size_t length, int left, char type);
+int redislite_insert_inline_key(void *_cs, void *first_page, int first_page_num, char *key, size_t length, char *value, size_t value_length);
+int redislite_value_fits_inline(void *_db, size_t key_length, size_t value_length);
+int redislite_insert_integer_key(void *_cs, void *first_page, int first_page_num, char *key, size_t length, long long value);
+int redislite_insert_heap_key(void *_cs, void *first_page, int first_page_num, char *key, size_t length, int page_num, int slot);
+int redislite_page_index_repoint_key(void *_cs, void *first_page, char *key, size_t length, int from, int to);
 int redislite_page_index_add_key(void *_cs, redislite_page_index *page, int pos, int left, char *key, size_t length, char type);
 void redislite_write_index(void *_db, unsigned char *data, void *page);
 void *redislite_read_index(void *db, unsigned char *data);
 int redislite_page_index_type(void *_db, void *_cs, void *first_page, char *key, size_t length, char *type);
 int redislite_value_page_for_key(void *_db, void *_cs, void *first_page, char *key, size_t length, char *type);
+int redislite_value_for_key(void *_db, void *_cs, void *first_page, char *key, size_t length, char *type, char **value, size_t *value_length);
+int redislite_integer_for_key(void *_db, void *_cs, void *first_page, char *key, size_t length, char *type, long long *integer, char **value, size_t *value_length);
 void redislite_free_index(void *db, void *_page);
 int redislite_delete_key(void *_cs, void *first_page, char *key, size_t length, int delete_data);
 int redislite_delete_keys(void *_cs, int q, char **keys, size_t *lengths);
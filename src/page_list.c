@@ -960,10 +960,12 @@ int redislite_lrange_by_keyname(void *_db, void *_cs, char *keyname, size_t keyn
 		}
 	}
 
-	if (_cs == NULL && page->list != list) {
-		redislite_free_list(_db, list);
+	if (_cs == NULL) {
+		if (page->list != list) {
+			redislite_free_list(_db, list);
+		}
+		redislite_free_list_first(_db, page);
 	}
-	redislite_free_list_first(_db, page);
 	*ret_list_p = ret_list;
 	*ret_list_len_p = ret_list_len;
 	*ret_list_count_p = ret_list_count;
@@ -1034,11 +1036,13 @@ int redislite_lindex_by_keyname(void *_db, void *_cs, char *keyname, size_t keyn
 	memcpy(ret_value, list->element[list->size - 1], list->element_len[list->size - 1]);
 	*value = ret_value;
 	*value_len = list->element_len[list->size - 1];
-	if (list != NULL && list != page->list) {
-		redislite_free_list(_db, list);
-	}
-	if (page != NULL) {
-		redislite_free_list_first(_db, page);
+	if (_cs == NULL) {
+		if (list != NULL && list != page->list) {
+			redislite_free_list(_db, list);
+		}
+		if (page != NULL) {
+			redislite_free_list_first(_db, page);
+		}
 	}
 	return REDISLITE_OK;
 
@@ -2,18 +2,57 @@
 #include "core.h"
 #include "page_string.h"
 #include "page_index.h"
+#include "page_heap.h"
+#include "page_freelist.h"
 #include "util.h"
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
 
+// shorter runs of free pages are not worth a place on the directory of a string
+#define MIN_RUN_PAGES 16
+
+// strings kept in their key's entry or on a heap page, `value_for_key` copies them
+static int is_small(char type)
+{
+	return type == REDISLITE_PAGE_TYPE_STRING_INLINE || type == REDISLITE_PAGE_TYPE_STRING_INTEGER || type == REDISLITE_PAGE_TYPE_HEAP;
+}
+
+// strings written back the same from the integer they parse to, so it can be kept instead
+static int is_integer(char *str, size_t length, long long *value)
+{
+	char text[21], *eptr;
+	if (length == 0 || length > 20) {
+		return 0;
+	}
+	memcpy(text, str, length);
+	text[length] = '\0';
+	*value = strtoll(text, &eptr, 10);
+	return eptr[0] == '\0' && (size_t)sprintf(text, "%lld", *value) == length && memcmp(text, str, length) == 0;
+}
+
 void redislite_delete_string(void *_cs, void *_page)
 {
 	redislite_page_string *page = (redislite_page_string *)_page;
 	if (page == NULL) {
 		return;
 	}
-	if (page->right_page != 0) {
+	if (page->extent > 0) {
+		redislite_freelist_push_run(_cs, page->right_page, page->extent);
+	}
+	else if (page->extent == REDISLITE_STRING_RUNS) {
+		changeset *cs = (changeset *)_cs;
+		redislite_page_string_directory *directory = redislite_page_get(cs->db, cs, page->right_page, REDISLITE_PAGE_TYPE_STRING_DIRECTORY);
+		if (directory == NULL) {
+			return;
+		}
+		size_t i;
+		for (i = 0; i < directory->number_of_runs; i++) {
+			redislite_freelist_push_run(_cs, directory->runs[i].page, directory->runs[i].count);
+		}
+		redislite_freelist_push(_cs, page->right_page);
+	}
+	else if (page->right_page != 0) {
 		redislite_page_delete(_cs, page->right_page, REDISLITE_PAGE_TYPE_STRING_OVERFLOW);
 	}
 }
@@ -37,7 +76,7 @@ void redislite_write_string(void *_db, unsigned char *data, void *_page)
 		return;
 	}
 
-	redislite_put_4bytes(&data[0], 0); // reserverd
+	redislite_put_4bytes(&data[0], page->extent);
 	redislite_put_4bytes(&data[4], page->size);
 	redislite_put_4bytes(&data[8], page->right_page);
 	size_t size = db->page_size - 12;
@@ -52,6 +91,7 @@ void *redislite_read_string(void *_db, unsigned char *data)
 	redislite *db = (redislite *)_db;
 	redislite_page_string *page = redislite_malloc(sizeof(redislite_page_string));
 
+	page->extent = redislite_get_4bytes(&data[0]);
 	page->size = redislite_get_4bytes(&data[4]);
 	page->right_page = redislite_get_4bytes(&data[8]);
 
@@ -104,42 +144,494 @@ void *redislite_read_string_overflow(void *_db, unsigned char *data)
 	return page;
 }
 
-static int add_extra_string(void *_cs, char *str, size_t length)
+static redislite_page_string_extent *create_extent(redislite *db)
+{
+	redislite_page_string_extent *page = redislite_malloc(sizeof(redislite_page_string_extent));
+	if (page == NULL) {
+		return NULL;
+	}
+	page->value = redislite_malloc(sizeof(char) * db->page_size);
+	if (page->value == NULL) {
+		redislite_free(page);
+		return NULL;
+	}
+	memset(page->value, 0, db->page_size);
+	page->db = db;
+	return page;
+}
+
+void redislite_free_string_extent(void *_db, void *_page)
+{
+	_db = _db; // XXX: avoid unused-parameter warning; we are implementing a prototype
+	redislite_page_string_extent *page = (redislite_page_string_extent *)_page;
+	if (page == NULL) {
+		return;
+	}
+	redislite_free(page->value);
+	redislite_free(page);
+}
+
+void redislite_write_string_extent(void *_db, unsigned char *data, void *_page)
+{
+	redislite *db = (redislite *)_db;
+	redislite_page_string_extent *page = (redislite_page_string_extent *)_page;
+	memcpy(data, page->value, db->page_size);
+}
+
+void *redislite_read_string_extent(void *_db, unsigned char *data)
+{
+	redislite *db = (redislite *)_db;
+	redislite_page_string_extent *page = create_extent(db);
+	if (page == NULL) {
+		return NULL;
+	}
+	memcpy(page->value, data, db->page_size);
+	return page;
+}
+
+// runs a directory page has room for
+static size_t directory_capacity(redislite *db)
+{
+	return (db->page_size - 8) / 8;
+}
+
+static redislite_page_string_directory *create_directory(redislite *db)
+{
+	redislite_page_string_directory *page = redislite_malloc(sizeof(redislite_page_string_directory));
+	if (page == NULL) {
+		return NULL;
+	}
+	page->runs = redislite_malloc(sizeof(redislite_page_string_run) * directory_capacity(db));
+	if (page->runs == NULL) {
+		redislite_free(page);
+		return NULL;
+	}
+	page->number_of_runs = 0;
+	page->db = db;
+	return page;
+}
+
+void redislite_free_string_directory(void *_db, void *_page)
+{
+	_db = _db; // XXX: avoid unused-parameter warning; we are implementing a prototype
+	redislite_page_string_directory *page = (redislite_page_string_directory *)_page;
+	if (page == NULL) {
+		return;
+	}
+	redislite_free(page->runs);
+	redislite_free(page);
+}
+
+void redislite_write_string_directory(void *_db, unsigned char *data, void *_page)
+{
+	_db = _db; // XXX: avoid unused-parameter warning; we are implementing a prototype
+	redislite_page_string_directory *page = (redislite_page_string_directory *)_page;
+	redislite_put_4bytes(&data[0], 0); // reserved
+	redislite_put_4bytes(&data[4], page->number_of_runs);
+	size_t i;
+	for (i = 0; i < page->number_of_runs; i++) {
+		redislite_put_4bytes(&data[8 + i * 8], page->runs[i].page);
+		redislite_put_4bytes(&data[12 + i * 8], page->runs[i].count);
+	}
+}
+
+void *redislite_read_string_directory(void *_db, unsigned char *data)
+{
+	redislite *db = (redislite *)_db;
+	redislite_page_string_directory *page = create_directory(db);
+	if (page == NULL) {
+		return NULL;
+	}
+	page->number_of_runs = MIN((size_t)redislite_get_4bytes(&data[4]), directory_capacity(db));
+	size_t i;
+	for (i = 0; i < page->number_of_runs; i++) {
+		page->runs[i].page = redislite_get_4bytes(&data[8 + i * 8]);
+		page->runs[i].count = redislite_get_4bytes(&data[12 + i * 8]);
+	}
+	return page;
+}
+
+/*
+ * Finds room for `count` pages of a string: runs freed before, when the
+ * freelist lists long enough ones, then the end of the file. Returns how
+ * many runs it took, at most `max`; their pages are not added yet.
+ */
+static int allocate_runs(changeset *cs, int count, redislite_page_string_run *runs, int max)
+{
+	int length = 0, page;
+	while (count > 0 && length < max - 1) {
+		page = redislite_freelist_pop_run(cs, count, MIN(count, MIN_RUN_PAGES), &runs[length].count);
+		if (page < 0) {
+			return page;
+		}
+		if (page == 0) {
+			break;
+		}
+		runs[length++].page = page;
+		count -= runs[length - 1].count;
+	}
+	if (count > 0) {
+		runs[length].page = cs->db->number_of_pages;
+		runs[length++].count = count;
+	}
+	return length;
+}
+
+/*
+ * Adds the pages of a run holding `length` bytes of `str`, or zeros
+ * after them.
+ */
+static int fill_run(changeset *cs, redislite_page_string_run *run, char *str, size_t length)
 {
-	changeset *cs = (changeset *)_cs;
 	redislite *db = cs->db;
-	size_t total_pages = (size_t)ceil((float)(length) / (db->page_size - 8));
-	size_t i, size;
-	int next_page = 0;
-	for (i = total_pages; i >= 1; i--) {
-		redislite_page_string_overflow *overflow_page = redislite_malloc(sizeof(redislite_page_string_overflow));
-		if (overflow_page == NULL) {
+	size_t pos = 0, size;
+	int i, status;
+	for (i = 0; i < run->count; i++) {
+		redislite_page_string_extent *page = create_extent(db);
+		if (page == NULL) {
 			return REDISLITE_OOM;
 		}
-		char *data = redislite_malloc(sizeof(char) * (db->page_size - 8));
-		if (data == NULL) {
-			redislite_free(overflow_page);
+		size = pos < length ? MIN(length - pos, db->page_size) : 0;
+		if (size > 0) {
+			memcpy(page->value, &str[pos], size);
+			pos += size;
+		}
+		status = redislite_add_modified_page(cs, run->page + i, REDISLITE_PAGE_TYPE_STRING_EXTENT, page);
+		if (status < 0) {
+			redislite_free_string_extent(db, page);
+			return status;
+		}
+	}
+	return REDISLITE_OK;
+}
+
+/*
+ * Gives a string `count` more pages holding `str`, after the ones it has.
+ * A string with no more pages than its first one takes a single run as its
+ * extent; otherwise the runs are listed on its directory. Returns
+ * REDISLITE_NOT_FOUND if the directory is full.
+ */
+static int add_runs(changeset *cs, redislite_page_string *page, int count, char *str, size_t length)
+{
+	redislite *db = cs->db;
+	redislite_page_string_directory *directory = NULL;
+	size_t max = directory_capacity(db);
+	int status;
+	if (page->extent == REDISLITE_STRING_RUNS) {
+		directory = redislite_page_get(db, cs, page->right_page, REDISLITE_PAGE_TYPE_STRING_DIRECTORY);
+		if (directory == NULL) {
+			return REDISLITE_OOM;
+		}
+		max -= directory->number_of_runs;
+	}
+	else if (page->extent > 0) {
+		max--;
+	}
+	else {
+		// room left for the runs it takes when it grows
+		max /= 2;
+	}
+	if (max == 0) {
+		return REDISLITE_NOT_FOUND;
+	}
+
+	redislite_page_string_run *runs = redislite_malloc(sizeof(redislite_page_string_run) * max);
+	if (runs == NULL) {
+		return REDISLITE_OOM;
+	}
+	int i, number_of_runs = allocate_runs(cs, count, runs, max);
+	size_t pos = 0, size;
+	for (i = 0, status = number_of_runs; i < number_of_runs && status >= 0; i++) {
+		size = pos < length ? MIN(length - pos, (size_t)runs[i].count * db->page_size) : 0;
+		status = fill_run(cs, &runs[i], str ? &str[pos] : NULL, size);
+		pos += size;
+	}
+	if (status >= 0 && page->extent == 0 && number_of_runs == 1) {
+		page->right_page = runs[0].page;
+		page->extent = runs[0].count;
+	}
+	else if (status >= 0) {
+		if (directory == NULL) {
+			directory = create_directory(db);
+			if (directory == NULL) {
+				redislite_free(runs);
+				return REDISLITE_OOM;
+			}
+			if (page->extent > 0) {
+				directory->runs[0].page = page->right_page;
+				directory->runs[0].count = page->extent;
+				directory->number_of_runs = 1;
+			}
+			status = redislite_add_modified_page(cs, -1, REDISLITE_PAGE_TYPE_STRING_DIRECTORY, directory);
+			if (status < 0) {
+				redislite_free_string_directory(db, directory);
+				redislite_free(runs);
+				return status;
+			}
+			page->right_page = status;
+			page->extent = REDISLITE_STRING_RUNS;
+		}
+		memcpy(&directory->runs[directory->number_of_runs], runs, sizeof(redislite_page_string_run) * number_of_runs);
+		directory->number_of_runs += number_of_runs;
+		status = redislite_add_modified_page(cs, page->right_page, REDISLITE_PAGE_TYPE_STRING_DIRECTORY, directory);
+	}
+	redislite_free(runs);
+	return status < 0 ? status : REDISLITE_OK;
+}
+
+/*
+ * The runs holding a string after its first page: its extent, or the ones
+ * listed on its directory, which the caller frees without a changeset.
+ * NULL for a chain of overflow pages or a string with no more pages.
+ */
+static redislite_page_string_run *string_runs(redislite *db, changeset *cs, redislite_page_string *page, redislite_page_string_run *extent, size_t *count, redislite_page_string_directory **directory)
+{
+	*directory = NULL;
+	*count = 0;
+	if (page->extent > 0) {
+		extent->page = page->right_page;
+		extent->count = page->extent;
+		*count = 1;
+		return extent;
+	}
+	if (page->extent != REDISLITE_STRING_RUNS) {
+		return NULL;
+	}
+	*directory = redislite_page_get(db, cs, page->right_page, REDISLITE_PAGE_TYPE_STRING_DIRECTORY);
+	if (*directory == NULL) {
+		return NULL;
+	}
+	*count = (*directory)->number_of_runs;
+	return (*directory)->runs;
+}
+
+static void release_directory(redislite *db, changeset *cs, redislite_page_string_directory *directory)
+{
+	if (cs == NULL) {
+		redislite_free_string_directory(db, directory);
+	}
+}
+
+// bytes the pages of a string hold, but for a chain of overflow pages
+static int capacity(redislite *db, changeset *cs, redislite_page_string *page, size_t *bytes)
+{
+	if (page->extent == 0) {
+		*bytes = db->page_size - 12;
+		return REDISLITE_OK;
+	}
+	redislite_page_string_run extent;
+	redislite_page_string_directory *directory;
+	size_t i, count;
+	redislite_page_string_run *runs = string_runs(db, cs, page, &extent, &count, &directory);
+	if (runs == NULL) {
+		return REDISLITE_OOM;
+	}
+	*bytes = db->page_size - 12;
+	for (i = 0; i < count; i++) {
+		*bytes += (size_t)runs[i].count * db->page_size;
+	}
+	release_directory(db, cs, directory);
+	return REDISLITE_OK;
+}
+
+/*
+ * Copies `length` bytes from `start` of a string on pages. Each run is
+ * read at once; a chain of overflow pages, from older files, is walked.
+ */
+static int read_range(redislite *db, changeset *cs, redislite_page_string *page, size_t start, size_t length, char *buffer)
+{
+	size_t size, first = db->page_size - 12;
+	int status = REDISLITE_OK;
+	if (start < first) {
+		size = MIN(length, first - start);
+		memcpy(buffer, &page->value[start], size);
+		buffer += size;
+		length -= size;
+		start = first;
+	}
+	if (length == 0) {
+		return REDISLITE_OK;
+	}
+	start -= first;
+	if (page->extent != 0) {
+		redislite_page_string_run extent;
+		redislite_page_string_directory *directory;
+		size_t i, count, run_size;
+		redislite_page_string_run *runs = string_runs(db, cs, page, &extent, &count, &directory);
+		if (runs == NULL) {
 			return REDISLITE_OOM;
 		}
-		memset(data, 0, db->page_size - 8);
-		if (i == total_pages) {
-			size = length - (db->page_size - 8) * (total_pages - 1);
+		for (i = 0; i < count && length > 0 && status == REDISLITE_OK; i++) {
+			run_size = (size_t)runs[i].count * db->page_size;
+			if (start >= run_size) {
+				start -= run_size;
+				continue;
+			}
+			size = MIN(length, run_size - start);
+			status = redislite_read_run(db, cs, runs[i].page, start, size, buffer);
+			buffer += size;
+			length -= size;
+			start = 0;
+		}
+		release_directory(db, cs, directory);
+		return status == REDISLITE_OK && length > 0 ? REDISLITE_ERR : status;
+	}
+
+	size_t overflow_size = db->page_size - 8;
+	int next = page->right_page;
+	while (length > 0) {
+		if (next == 0) {
+			return REDISLITE_ERR; // shorter than its size, the file is corrupted
+		}
+		redislite_page_string_overflow *overflow = redislite_page_get(db, cs, next, REDISLITE_PAGE_TYPE_STRING_OVERFLOW);
+		if (overflow == NULL) {
+			return REDISLITE_OOM;
+		}
+		if (start < overflow_size) {
+			size = MIN(length, overflow_size - start);
+			memcpy(buffer, &overflow->value[start], size);
+			buffer += size;
+			length -= size;
+			start = 0;
 		}
 		else {
-			size = db->page_size - 8;
+			start -= overflow_size;
+		}
+		next = overflow->right_page;
+		if (cs == NULL) {
+			redislite_free_string_overflow(db, overflow);
+		}
+	}
+	return REDISLITE_OK;
+}
+
+static int write_run(changeset *cs, int num, size_t start, char *str, size_t length)
+{
+	redislite *db = cs->db;
+	size_t size;
+	int status;
+	num += start / db->page_size;
+	start %= db->page_size;
+	while (length > 0) {
+		size = MIN(length, db->page_size - start);
+		// a page written whole does not need to be read
+		redislite_page_string_extent *extent = size == db->page_size ? create_extent(db) : redislite_page_get(db, cs, num, REDISLITE_PAGE_TYPE_STRING_EXTENT);
+		if (extent == NULL) {
+			return REDISLITE_OOM;
+		}
+		memcpy(&extent->value[start], str, size);
+		status = redislite_add_modified_page(cs, num, REDISLITE_PAGE_TYPE_STRING_EXTENT, extent);
+		if (status < 0) {
+			if (size == db->page_size) {
+				redislite_free_string_extent(db, extent);
+			}
+			return status;
+		}
+		str += size;
+		length -= size;
+		start = 0;
+		num++;
+	}
+	return REDISLITE_OK;
+}
+
+/*
+ * Writes `str` at `start` of a string on pages, within its capacity. The
+ * header page is left for the caller to mark as modified.
+ */
+static int write_range(changeset *cs, redislite_page_string *page, size_t start, char *str, size_t length)
+{
+	redislite *db = cs->db;
+	size_t size, first = db->page_size - 12;
+	int status = REDISLITE_OK;
+	if (start < first) {
+		size = MIN(length, first - start);
+		memcpy(&page->value[start], str, size);
+		str += size;
+		length -= size;
+		start = first;
+	}
+	if (length == 0) {
+		return REDISLITE_OK;
+	}
+	if (page->extent == 0) {
+		return REDISLITE_ERR; // a chain of overflow pages, stored again before it is written
+	}
+	start -= first;
+	redislite_page_string_run extent;
+	redislite_page_string_directory *directory;
+	size_t i, count, run_size;
+	redislite_page_string_run *runs = string_runs(db, cs, page, &extent, &count, &directory);
+	if (runs == NULL) {
+		return REDISLITE_OOM;
+	}
+	for (i = 0; i < count && length > 0 && status == REDISLITE_OK; i++) {
+		run_size = (size_t)runs[i].count * db->page_size;
+		if (start >= run_size) {
+			start -= run_size;
+			continue;
+		}
+		size = MIN(length, run_size - start);
+		status = write_run(cs, runs[i].page, start, str, size);
+		str += size;
+		length -= size;
+		start = 0;
+	}
+	return status == REDISLITE_OK && length > 0 ? REDISLITE_ERR : status;
+}
+
+// zeroed pages at the end of the file, to make a run there longer
+static int extend_run(changeset *cs, redislite_page_string_run *run, int count)
+{
+	int i, status;
+	for (i = 0; i < count; i++) {
+		redislite_page_string_extent *extent = create_extent(cs->db);
+		if (extent == NULL) {
+			return REDISLITE_OOM;
+		}
+		status = redislite_add_modified_page(cs, run->page + run->count, REDISLITE_PAGE_TYPE_STRING_EXTENT, extent);
+		if (status < 0) {
+			redislite_free_string_extent(cs->db, extent);
+			return status;
+		}
+		run->count++;
+	}
+	return REDISLITE_OK;
+}
+
+/*
+ * Adds pages to a string for it to hold `size` bytes, without moving the
+ * ones it has. The last run grows when it ends the file; otherwise new
+ * runs, as long as all the others together or longer, are listed on the
+ * directory of the string, so there are few of them. Returns
+ * REDISLITE_NOT_FOUND if the string has to be stored again instead.
+ */
+static int grow_string(changeset *cs, redislite_page_string *page, size_t size, size_t current)
+{
+	redislite *db = cs->db;
+	int count = (size - current + db->page_size - 1) / db->page_size, status;
+	if (page->extent != 0) {
+		redislite_page_string_run extent;
+		redislite_page_string_directory *directory;
+		size_t length;
+		redislite_page_string_run *runs = string_runs(db, cs, page, &extent, &length, &directory);
+		if (runs == NULL) {
+			return REDISLITE_OOM;
 		}
-		memcpy(data, &str[(db->page_size - 8) * (i - 1)], size);
-		overflow_page->db = db;
-		overflow_page->right_page = next_page;
-		overflow_page->value = data;
-		next_page = redislite_add_modified_page(cs, -1, REDISLITE_PAGE_TYPE_STRING_OVERFLOW, overflow_page);
-		if (next_page < 0) {
-			redislite_free(overflow_page);
-			redislite_free(data);
-			return next_page;
+		redislite_page_string_run *last = &runs[length - 1];
+		if (last->page + last->count == db->number_of_pages) {
+			status = extend_run(cs, last, count);
+			if (status == REDISLITE_OK && directory == NULL) {
+				page->extent = last->count;
+			}
+			else if (status == REDISLITE_OK) {
+				status = redislite_add_modified_page(cs, page->right_page, REDISLITE_PAGE_TYPE_STRING_DIRECTORY, directory);
+			}
+			return status < 0 ? status : REDISLITE_OK;
 		}
+		count = MAX(count, (int)((current - (db->page_size - 12)) / db->page_size));
 	}
-	return next_page;
+	return add_runs(cs, page, count, NULL, 0);
 }
 
 int redislite_insert_string(void *_cs, char *str, size_t length, int *num)
@@ -153,65 +645,111 @@ int redislite_insert_string(void *_cs, char *str, size_t length, int *num)
 	if (page == NULL) {
 		return REDISLITE_OOM;
 	}
-	page->size = length;
 	size_t first_page_size = db->page_size - 12;
+	char *data = redislite_malloc(sizeof(char) * first_page_size);
+	if (data == NULL) {
+		redislite_free(page);
+		return REDISLITE_OOM;
+	}
+	memcpy(data, str, MIN(length, first_page_size));
+	if (length < first_page_size) {
+		// the page stays cached, bytes past the end are read when it grows
+		memset(&data[length], '\0', first_page_size - length);
+	}
+	page->value = data;
+	page->size = length;
+	page->right_page = 0;
+	page->extent = 0;
 	if (first_page_size < length) {
-		page->right_page = add_extra_string(_cs, &str[first_page_size], length - first_page_size);
-		if (page->right_page < 0) {
-			int right_page = page->right_page;
-			redislite_free(page);
-			return right_page;
-		}
-		char *data = redislite_malloc(sizeof(char) * db->page_size - 12);
-		if (data == NULL) {
-			redislite_free(page);
-			return REDISLITE_OOM;
-		}
-		memcpy(data, str, db->page_size - 12);
-		page->value = data;
-		*num = redislite_add_modified_page(cs, -1, REDISLITE_PAGE_TYPE_STRING, page);
-		if (*num < 0) {
-			redislite_free(page);
-			redislite_free(data);
-			return (*num);
+		int status = add_runs(cs, page, (length - first_page_size + db->page_size - 1) / db->page_size, &str[first_page_size], length - first_page_size);
+		if (status != REDISLITE_OK) {
+			redislite_free_string(db, page);
+			return status;
 		}
 	}
-	else {
-		page->right_page = 0;
-		char *data = redislite_malloc(sizeof(char) * db->page_size - 12);
-		if (data == NULL) {
-			redislite_free(page);
-			return REDISLITE_OOM;
-		}
-		memcpy(data, str, length);
-		page->value = data;
-		*num = redislite_add_modified_page(cs, -1, REDISLITE_PAGE_TYPE_STRING, page);
-		if (*num < 0) {
-			return (*num);
+	*num = redislite_add_modified_page(cs, -1, REDISLITE_PAGE_TYPE_STRING, page);
+	if (*num < 0) {
+		redislite_free_string(db, page);
+		return (*num);
+	}
+	return REDISLITE_OK;
+}
+
+// pages a string needs after its first one, in a single extent
+int redislite_string_extent_pages(void *_db, void *_page)
+{
+	redislite *db = (redislite *)_db;
+	redislite_page_string *page = (redislite_page_string *)_page;
+	size_t first = db->page_size - 12;
+	return page->size <= first ? 0 : (page->size - first + db->page_size - 1) / db->page_size;
+}
+
+/*
+ * Copies the rest of a string of `_db` onto a single extent from page `num`
+ * of the changeset's database, for VACUUM to store chains of overflow pages
+ * and strings with many runs in a row. The copy is read a few runs at a
+ * time; the string then points to it.
+ */
+int redislite_string_copy_extent(void *_db, void *_cs, void *_page, int num)
+{
+	redislite *db = (redislite *)_db;
+	changeset *cs = (changeset *)_cs;
+	redislite_page_string *page = (redislite_page_string *)_page;
+	int count = redislite_string_extent_pages(db, page), status = REDISLITE_OK;
+	char *buffer = redislite_malloc(sizeof(char) * db->page_size * MIN_RUN_PAGES);
+	if (buffer == NULL) {
+		return REDISLITE_OOM;
+	}
+	redislite_page_string_run run;
+	size_t pos = db->page_size - 12, size;
+	run.page = num;
+	while (run.page < num + count && status == REDISLITE_OK) {
+		run.count = MIN(MIN_RUN_PAGES, num + count - run.page);
+		size = MIN(page->size - pos, (size_t)run.count * db->page_size);
+		status = read_range(db, NULL, page, pos, size, buffer);
+		if (status == REDISLITE_OK) {
+			status = fill_run(cs, &run, buffer, size);
 		}
+		pos += size;
+		run.page += run.count;
 	}
+	redislite_free(buffer);
+	if (status != REDISLITE_OK) {
+		return status;
+	}
+	page->right_page = count == 0 ? 0 : num;
+	page->extent = count;
 	return REDISLITE_OK;
 }
 
 int redislite_page_string_get_by_keyname(void *_db, void *_cs, char *key_name, size_t key_length, char **str, size_t *length)
 {
 	redislite *db = (redislite *)_db;
-	char type;
-	void *_page = redislite_page_get_by_keyname(_db, _cs, key_name, key_length, &type);
-	if (_page == NULL) {
+	char type, *value;
+	size_t value_length;
+	int num = redislite_value_for_key(_db, _cs, db->root, key_name, key_length, &type, &value, &value_length);
+	if (num < 0) {
 		*length = 0;
-		return REDISLITE_NOT_FOUND;
+		return num;
 	}
-	if (type != REDISLITE_PAGE_TYPE_STRING) {
-		if (_cs == NULL) {
-			redislite_page_type *page_type = redislite_page_get_type(db, type);
-			page_type->free_function(db, _page);
+	if (is_small(type)) {
+		if (value_length == 0) {
+			redislite_free(value);
+			value = NULL;
 		}
-
+		*str = value;
+		*length = value_length;
+		return REDISLITE_OK;
+	}
+	if (type != REDISLITE_PAGE_TYPE_STRING) {
 		*length = 0;
 		return REDISLITE_WRONG_TYPE;
 	}
-	redislite_page_string *page = (redislite_page_string *)_page;
+	redislite_page_string *page = redislite_page_get(_db, _cs, num, type);
+	if (page == NULL) {
+		*length = 0;
+		return REDISLITE_OOM;
+	}
 	if (page->size == 0) {
 		*str = NULL;
 		*length = 0;
@@ -224,53 +762,210 @@ int redislite_page_string_get_by_keyname(void *_db, void *_cs, char *key_name, s
 		}
 		return REDISLITE_OOM;
 	}
-	memcpy(data, page->value, MIN(page->size, db->page_size - 12));
+	int status = read_range(db, _cs, page, 0, page->size, data);
+	*length = page->size;
+	if (_cs == NULL) {
+		redislite_free_string(db, page);
+	}
+	if (status != REDISLITE_OK) {
+		redislite_free(data);
+		*length = 0;
+		return status;
+	}
+	*str = data;
+	return REDISLITE_OK;
+}
+
+/*
+ * Hands the pages of a string after the first to `callback`, each run read
+ * a few pages at a time, so a long string is never held whole.
+ */
+static int stream_pages(redislite *db, changeset *cs, redislite_page_string *page, redislite_chunk_callback *callback, void *context)
+{
+	size_t size, length = page->size - (db->page_size - 12);
+	int status = REDISLITE_OK;
+	if (page->extent != 0) {
+		redislite_page_string_run extent;
+		redislite_page_string_directory *directory;
+		size_t i, pos, run_size, count;
+		redislite_page_string_run *runs = string_runs(db, cs, page, &extent, &count, &directory);
+		if (runs == NULL) {
+			return REDISLITE_OOM;
+		}
+		char *buffer = redislite_malloc(sizeof(char) * db->page_size * MIN_RUN_PAGES);
+		if (buffer == NULL) {
+			release_directory(db, cs, directory);
+			return REDISLITE_OOM;
+		}
+		for (i = 0; i < count && length > 0 && status == REDISLITE_OK; i++) {
+			run_size = (size_t)runs[i].count * db->page_size;
+			for (pos = 0; pos < run_size && length > 0 && status == REDISLITE_OK; pos += size) {
+				size = MIN(length, MIN(run_size - pos, db->page_size * MIN_RUN_PAGES));
+				status = redislite_read_run(db, cs, runs[i].page, pos, size, buffer);
+				if (status == REDISLITE_OK) {
+					status = callback(context, buffer, size);
+				}
+				length -= size;
+			}
+		}
+		redislite_free(buffer);
+		release_directory(db, cs, directory);
+		return status == REDISLITE_OK && length > 0 ? REDISLITE_ERR : status;
+	}
 
 	int next = page->right_page;
-	size_t i = 0;
-	size_t pos, size;
-	while (next != 0) {
-		void *_extra = redislite_page_get(_db, _cs, next, REDISLITE_PAGE_TYPE_STRING_OVERFLOW);
-		// TODO handle OOM
-		redislite_page_string_overflow *extra = (redislite_page_string_overflow *)_extra;
-		pos = db->page_size - 12 + i++ * (db->page_size - 8);
-		size = MIN(page->size - pos, db->page_size - 8);
-		memcpy(&data[pos], extra->value, size);
-		next = extra->right_page;
-		if (_cs == NULL) {
-			redislite_free_string_overflow(db, extra);
+	while (length > 0 && status == REDISLITE_OK) {
+		if (next == 0) {
+			return REDISLITE_ERR; // shorter than its size, the file is corrupted
+		}
+		redislite_page_string_overflow *overflow = redislite_page_get(db, cs, next, REDISLITE_PAGE_TYPE_STRING_OVERFLOW);
+		if (overflow == NULL) {
+			return REDISLITE_OOM;
+		}
+		size = MIN(length, db->page_size - 8);
+		status = callback(context, overflow->value, size);
+		length -= size;
+		next = overflow->right_page;
+		if (cs == NULL) {
+			redislite_free_string_overflow(db, overflow);
+		}
+	}
+	return status;
+}
+
+/*
+ * Like `get_by_keyname`, but the string is handed to `callback` in pieces
+ * of up to MIN_RUN_PAGES pages, in order; an empty one is not. A status
+ * other than REDISLITE_OK from `callback` stops it and is returned.
+ */
+int redislite_page_string_stream_by_keyname(void *_db, void *_cs, char *key_name, size_t key_length, redislite_chunk_callback *callback, void *context)
+{
+	redislite *db = (redislite *)_db;
+	char type, *value;
+	size_t value_length;
+	int status, num = redislite_value_for_key(_db, _cs, db->root, key_name, key_length, &type, &value, &value_length);
+	if (num < 0) {
+		return num;
+	}
+	if (is_small(type)) {
+		status = value_length > 0 ? callback(context, value, value_length) : REDISLITE_OK;
+		redislite_free(value);
+		return status;
+	}
+	if (type != REDISLITE_PAGE_TYPE_STRING) {
+		return REDISLITE_WRONG_TYPE;
+	}
+	redislite_page_string *page = redislite_page_get(_db, _cs, num, type);
+	if (page == NULL) {
+		return REDISLITE_OOM;
+	}
+	status = REDISLITE_OK;
+	if (page->size > 0) {
+		status = callback(context, page->value, MIN(page->size, db->page_size - 12));
+	}
+	if (status == REDISLITE_OK && page->size > db->page_size - 12) {
+		status = stream_pages(db, _cs, page, callback, context);
+	}
+	if (_cs == NULL) {
+		redislite_free_string(db, page);
+	}
+	return status;
+}
+
+
+int redislite_page_string_getset_key_string(void *_cs, char *key_name, size_t key_length, char *str, size_t length, char **previous_value, size_t *previous_value_length)
+{
+	changeset *cs = (changeset *)_cs;
+	int status = redislite_page_string_get_by_keyname(cs->db, _cs, key_name, key_length, previous_value, previous_value_length);
+	if (status != REDISLITE_OK && status != REDISLITE_NOT_FOUND) {
+		return status;
+	}
+	int _status = redislite_page_string_set_key_string(_cs, key_name, key_length, str, length);
+	if (_status != REDISLITE_OK) {
+		status = _status;
+	}
+	// FIXME: there should be a more efficient way to do this instead of two different calls
+	return status;
+}
+
+/*
+ * Writes `str` over the string of `key_name` when it needs all the pages
+ * that one has and no more, so neither its pages nor the index change.
+ * The bytes left past the end of the shorter one are zeroed. Returns
+ * REDISLITE_NOT_FOUND if the string has to be stored again instead.
+ */
+static int overwrite_string(changeset *cs, char *key_name, size_t key_length, char *str, size_t length)
+{
+	redislite *db = cs->db;
+	char type;
+	size_t bytes;
+	if (db->readonly) {
+		return REDISLITE_READONLY;
+	}
+	int num = redislite_value_page_for_key(db, cs, db->root, key_name, key_length, &type);
+	if (num < 0) {
+		return num;
+	}
+	if (type != REDISLITE_PAGE_TYPE_STRING) {
+		return REDISLITE_NOT_FOUND;
+	}
+	redislite_page_string *page = redislite_page_get(db, cs, num, type);
+	if (page == NULL) {
+		return REDISLITE_OOM;
+	}
+	if (page->extent == 0 && page->right_page != 0) {
+		return REDISLITE_NOT_FOUND; // a chain of overflow pages
+	}
+	int status = capacity(db, cs, page, &bytes);
+	if (status != REDISLITE_OK) {
+		return status;
+	}
+	if (length > bytes || bytes - length >= db->page_size) {
+		return REDISLITE_NOT_FOUND;
+	}
+	status = write_range(cs, page, 0, str, length);
+	if (status == REDISLITE_OK && page->size > length) {
+		// less than a page, the rest of the last one the string is on
+		char *zerofill = redislite_malloc(sizeof(char) * (page->size - length));
+		if (zerofill == NULL) {
+			return REDISLITE_OOM;
 		}
+		memset(zerofill, '\0', page->size - length);
+		status = write_range(cs, page, length, zerofill, page->size - length);
+		redislite_free(zerofill);
 	}
-
-	*length = page->size;
-	if (_cs == NULL) {
-		redislite_free_string(db, page);
+	if (status == REDISLITE_OK) {
+		page->size = length;
+		status = redislite_add_modified_page(cs, num, REDISLITE_PAGE_TYPE_STRING, page);
 	}
-	*str = data;
-	return REDISLITE_OK;
+	return status < 0 ? status : REDISLITE_OK;
 }
 
-
-int redislite_page_string_getset_key_string(void *_cs, char *key_name, size_t key_length, char *str, size_t length, char **previous_value, size_t *previous_value_length)
+int redislite_page_string_set_key_string(void *_cs, char *key_name, size_t key_length, char *str, size_t length)
 {
 	changeset *cs = (changeset *)_cs;
-	int status = redislite_page_string_get_by_keyname(cs->db, _cs, key_name, key_length, previous_value, previous_value_length);
-	if (status != REDISLITE_OK && status != REDISLITE_NOT_FOUND) {
-		return status;
+	long long value;
+	if (is_integer(str, length, &value)) {
+		return redislite_insert_integer_key(cs, cs->db->root, 0, key_name, key_length, value);
 	}
-	int _status = redislite_page_string_set_key_string(_cs, key_name, key_length, str, length);
-	if (_status != REDISLITE_OK) {
-		status = _status;
+	if (redislite_value_fits_inline(cs->db, key_length, length)) {
+		return redislite_insert_inline_key(cs, cs->db->root, 0, key_name, key_length, str, length);
 	}
-	// FIXME: there should be a more efficient way to do this instead of two different calls
-	return status;
-}
 
-int redislite_page_string_set_key_string(void *_cs, char *key_name, size_t key_length, char *str, size_t length)
-{
-	changeset *cs = (changeset *)_cs;
-	int left;
-	int status = redislite_insert_string(cs, str, length, &left);
+	int left, slot, status;
+	if (redislite_value_fits_heap(cs->db, key_length, length)) {
+		status = redislite_heap_insert(cs, key_name, key_length, str, length, &left, &slot);
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+		return redislite_insert_heap_key(cs, cs->db->root, 0, key_name, key_length, left, slot);
+	}
+
+	status = overwrite_string(cs, key_name, key_length, str, length);
+	if (status != REDISLITE_NOT_FOUND) {
+		return status;
+	}
+	status = redislite_insert_string(cs, str, length, &left);
 	if (status != REDISLITE_OK) {
 		return status;
 	}
@@ -305,14 +1000,19 @@ int redislite_page_string_setnx_key_string(void *_cs, char *key_name, size_t key
 int redislite_page_string_strlen_by_keyname(void *_db, void *_cs, char *key_name, size_t key_length)
 {
 	redislite *db = (redislite *)_db;
-	char type;
-	int page_num = redislite_value_page_for_key(_db, _cs, db->root, key_name, key_length, &type);
+	char type, *value;
+	size_t value_length;
+	int page_num = redislite_value_for_key(_db, _cs, db->root, key_name, key_length, &type, &value, &value_length);
 	if (page_num == REDISLITE_NOT_FOUND) {
 		return 0;
 	}
 	if (page_num < 0) {
 		return page_num;
 	}
+	if (is_small(type)) {
+		redislite_free(value);
+		return value_length;
+	}
 	if (type != REDISLITE_PAGE_TYPE_STRING) {
 		return REDISLITE_WRONG_TYPE;
 	}
@@ -320,6 +1020,89 @@ int redislite_page_string_strlen_by_keyname(void *_db, void *_cs, char *key_name
 	return page->size;
 }
 
+/*
+ * Writes `str` at `start` of a small string, padding it with zeros if it
+ * is shorter. It is stored again, wherever its new length fits.
+ */
+static int set_small_range(changeset *cs, char *key_name, size_t key_length, char *value, size_t value_length, size_t start, char *str, size_t length, size_t *new_length)
+{
+	size_t size = MAX(value_length, start + length);
+	char *data = redislite_malloc(sizeof(char) * (size + 1));
+	if (data == NULL) {
+		return REDISLITE_OOM;
+	}
+	memcpy(data, value, value_length);
+	if (start > value_length) {
+		memset(&data[value_length], '\0', start - value_length);
+	}
+	memcpy(&data[start], str, length);
+	int status = redislite_page_string_set_key_string(cs, key_name, key_length, data, size);
+	redislite_free(data);
+	if (status == REDISLITE_OK && new_length) {
+		*new_length = size;
+	}
+	return status;
+}
+
+/*
+ * Writes `str` at `start` of a string on pages, padding it with zeros if it
+ * is shorter. Its pages are written in place, and more are added after
+ * them when it grows; a chain of overflow pages is stored again instead,
+ * as an extent.
+ */
+static int set_page_range(changeset *cs, char *key_name, size_t key_length, int page_num, redislite_page_string *page, size_t start, char *str, size_t length, size_t *new_length)
+{
+	redislite *db = cs->db;
+	size_t size = MAX(page->size, start + length), bytes;
+	// a chain of overflow pages is walked to reach an offset, an extent is not
+	int status = page->extent == 0 && page->right_page != 0 ? REDISLITE_NOT_FOUND : capacity(db, cs, page, &bytes);
+	if (status == REDISLITE_OK && size > bytes) {
+		status = grow_string(cs, page, size, bytes);
+	}
+	if (status == REDISLITE_OK) {
+		// pages added are zeros already
+		size_t end = MIN(start, bytes);
+		if (end > page->size) {
+			char *zerofill = redislite_malloc(sizeof(char) * (end - page->size));
+			if (zerofill == NULL) {
+				return REDISLITE_OOM;
+			}
+			memset(zerofill, '\0', end - page->size);
+			status = write_range(cs, page, page->size, zerofill, end - page->size);
+			redislite_free(zerofill);
+		}
+		if (status == REDISLITE_OK) {
+			status = write_range(cs, page, start, str, length);
+		}
+		if (status == REDISLITE_OK) {
+			page->size = size;
+			status = redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_STRING, page);
+		}
+	}
+	else if (status == REDISLITE_NOT_FOUND) {
+		char *data = redislite_malloc(sizeof(char) * size);
+		if (data == NULL) {
+			return REDISLITE_OOM;
+		}
+		status = read_range(db, cs, page, 0, page->size, data);
+		if (status == REDISLITE_OK) {
+			if (start > page->size) {
+				memset(&data[page->size], '\0', start - page->size);
+			}
+			memcpy(&data[start], str, length);
+			status = redislite_page_string_set_key_string(cs, key_name, key_length, data, size);
+		}
+		redislite_free(data);
+	}
+	if (status < 0) {
+		return status;
+	}
+	if (new_length) {
+		*new_length = size;
+	}
+	return REDISLITE_OK;
+}
+
 int redislite_page_string_append_key_string(void *_cs, char *key_name, size_t key_length, char *str, size_t length, size_t *new_length)
 {
 	changeset *cs = (changeset *)_cs;
@@ -332,62 +1115,23 @@ int redislite_page_string_append_key_string(void *_cs, char *key_name, size_t ke
 		return REDISLITE_OK;
 	}
 
-	char type;
-	int page_num = redislite_value_page_for_key(cs->db, cs, cs->db->root, key_name, key_length, &type);
+	char type, *value;
+	size_t value_length;
+	int page_num = redislite_value_for_key(cs->db, cs, cs->db->root, key_name, key_length, &type, &value, &value_length);
 	if (page_num >= 0) {
+		if (is_small(type)) {
+			int status = set_small_range(cs, key_name, key_length, value, value_length, value_length, str, length, new_length);
+			redislite_free(value);
+			return status;
+		}
 		if (type != REDISLITE_PAGE_TYPE_STRING) {
 			return REDISLITE_WRONG_TYPE;
 		}
 		redislite_page_string *page = redislite_page_get(cs->db, _cs, page_num, type);
-		size_t previous_length = page->size;
-		if (page->right_page > 0) {
-			size_t pos = cs->db->page_size - 12;
-			int overflow_page_num = page->right_page;
-			redislite_page_string_overflow *overflow = redislite_page_get(cs->db, _cs, page->right_page, REDISLITE_PAGE_TYPE_STRING_OVERFLOW);
-			while (overflow->right_page != 0) {
-				overflow_page_num = overflow->right_page;
-				overflow = redislite_page_get(cs->db, _cs, overflow->right_page, REDISLITE_PAGE_TYPE_STRING_OVERFLOW);
-				pos += cs->db->page_size - 8;
-			}
-			size_t page_pos = previous_length - pos;
-			size_t free_bytes = 0;
-			if (cs->db->page_size > page_pos + 8) {
-				free_bytes = cs->db->page_size - page_pos - 8;
-			}
-
-			int new_in_page = length;
-			if (length > free_bytes) {
-				new_in_page = free_bytes;
-				overflow->right_page = add_extra_string(_cs, &str[free_bytes], length - free_bytes);
-			}
-			memcpy(&overflow->value[page_pos], str, new_in_page);
-			redislite_add_modified_page(cs, overflow_page_num, REDISLITE_PAGE_TYPE_STRING_OVERFLOW, overflow);
-			page->size += length;
-			redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_STRING, page);
-		}
-		else {
-			if (cs->db->page_size >= page->size + length + 8) {
-				memcpy(&page->value[page->size], str, length);
-				page->size += length;
-				redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_STRING, page);
-			}
-			else {
-				size_t first_page_size = db->page_size - 12;
-
-				page->right_page = add_extra_string(_cs, &str[first_page_size - page->size], length + page->size - first_page_size);
-				if (page->right_page < 0) {
-					redislite_free(page);
-					return page->right_page;
-				}
-				memcpy(&page->value[page->size], str, db->page_size - 12 - page->size);
-				page->size += length;
-				redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_STRING, page);
-			}
-		}
-		if (new_length) {
-			*new_length = page->size;
+		if (page == NULL) {
+			return REDISLITE_OOM;
 		}
-		return REDISLITE_OK;
+		return set_page_range(cs, key_name, key_length, page_num, page, page->size, str, length, new_length);
 	}
 	else {
 		if (new_length) {
@@ -402,8 +1146,9 @@ int redislite_page_string_incrbyfloat_by_key_string(void *_cs, char *key_name, s
 	changeset *cs = (changeset *)_cs;
 	redislite *db = cs->db;
 
-	char type;
-	int page_num = redislite_value_page_for_key(cs->db, cs, cs->db->root, key_name, key_length, &type);
+	char type, *small_value;
+	size_t small_length;
+	int page_num = redislite_value_for_key(cs->db, cs, cs->db->root, key_name, key_length, &type, &small_value, &small_length);
 	if (page_num < 0) {
 		char *s_value = redislite_malloc(256);
 		int size = snprintf(s_value, 256, "%.17Lg", incr);
@@ -419,26 +1164,40 @@ int redislite_page_string_incrbyfloat_by_key_string(void *_cs, char *key_name, s
 		return redislite_page_string_set_key_string(_cs, key_name, key_length, s_value, size);
 	}
 
-	if (type != REDISLITE_PAGE_TYPE_STRING) {
+	char *number;
+	size_t number_length;
+	if (is_small(type)) {
+		number = small_value;
+		number_length = small_length;
+	}
+	else if (type != REDISLITE_PAGE_TYPE_STRING) {
 		return REDISLITE_WRONG_TYPE;
 	}
-
-	redislite_page_string *page = redislite_page_get(cs->db, _cs, page_num, type);
-	if (page->right_page || page->size > db->page_size - 13) {
-		return REDISLITE_INVALID_FLOAT;
+	else {
+		redislite_page_string *page = redislite_page_get(cs->db, _cs, page_num, type);
+		if (page->right_page || page->size > db->page_size - 13) {
+			return REDISLITE_INVALID_FLOAT;
+		}
+		number = page->value;
+		number_length = page->size;
 	}
 
 	long double value;
-	char *eptr, *strvalue = redislite_malloc(256); // TODO: how long can a long double be?
+	char *eptr, *strvalue;
 	int len;
-	if (strvalue == NULL) {
-		return REDISLITE_OOM;
-	}
 
-	value = strtold(page->value, &eptr);
-	if (isspace(page->value[0]) || eptr[0] != '\0' || isnan(value)) {
+	value = strtold(number, &eptr);
+	int invalid = isspace(number[0]) || eptr[0] != '\0' || isnan(value);
+	if (is_small(type)) {
+		redislite_free(small_value);
+	}
+	if (invalid) {
 		return REDISLITE_INVALID_FLOAT;
 	}
+	strvalue = redislite_malloc(256); // TODO: how long can a long double be?
+	if (strvalue == NULL) {
+		return REDISLITE_OOM;
+	}
 	value += incr;
 	if (isnan(value) || isinf(value)) {
 		return REDISLITE_NAN_OR_INFINITY;
@@ -447,7 +1206,7 @@ int redislite_page_string_incrbyfloat_by_key_string(void *_cs, char *key_name, s
 	len = snprintf(strvalue, 256, "%.17Lg", value);
 	strvalue = redislite_realloc(strvalue, len + 1); // shrinking
 	strvalue[len] = '\0';
-	if (page->size > 0) {
+	if (number_length > 0) {
 		redislite_page_string_set_key_string(_cs, key_name, key_length, strvalue, len);
 		if (new_value) {
 			*new_value = strvalue;
@@ -463,18 +1222,27 @@ int redislite_page_string_incr_by_key_string(void *_cs, char *key_name, size_t k
 	changeset *cs = (changeset *)_cs;
 	redislite *db = cs->db;
 
-	char type;
-	int page_num = redislite_value_page_for_key(cs->db, cs, cs->db->root, key_name, key_length, &type);
-	if (page_num < 0) {
-		char s_value[21];
-		if (new_value) {
-			*new_value = incr;
+	char type, *small_value;
+	long long value = 0;
+	size_t small_length;
+	int status, page_num = redislite_integer_for_key(cs->db, cs, cs->db->root, key_name, key_length, &type, &value, &small_value, &small_length);
+	if (page_num == REDISLITE_NOT_FOUND || (page_num >= 0 && is_small(type))) {
+		// counters are kept as integers, whatever they were stored as
+		if (page_num >= 0 && type != REDISLITE_PAGE_TYPE_STRING_INTEGER) {
+			status = str_to_long_long(small_value, small_length, &value);
+			redislite_free(small_value);
+			if (status != REDISLITE_OK) {
+				return status;
+			}
 		}
-		int size = sprintf(s_value, "%lld", incr);
-		if (size < 0) {
-			return REDISLITE_EXPECT_INTEGER;
+		value += incr;
+		if (new_value) {
+			*new_value = value;
 		}
-		return redislite_page_string_set_key_string(_cs, key_name, key_length, s_value, size);
+		return redislite_insert_integer_key(cs, cs->db->root, 0, key_name, key_length, value);
+	}
+	if (page_num < 0) {
+		return page_num;
 	}
 
 	if (type != REDISLITE_PAGE_TYPE_STRING) {
@@ -486,8 +1254,7 @@ int redislite_page_string_incr_by_key_string(void *_cs, char *key_name, size_t k
 		return REDISLITE_EXPECT_INTEGER;
 	}
 
-	long long value;
-	int status = str_to_long_long(page->value, page->size, &value);
+	status = str_to_long_long(page->value, page->size, &value);
 	if (status != REDISLITE_OK) {
 		return status;
 	}
@@ -538,19 +1305,26 @@ int redislite_echo(char *src_name, size_t src_length, char **dst_name, size_t *d
 int redislite_page_string_strlen_key_string(void *_db, void *_cs, char *key_name, size_t key_length)
 {
 	redislite *db = (redislite *)_db;
-	char type;
-	void *_page = redislite_page_get_by_keyname(_db, _cs, key_name, key_length, &type);
-	if (_page == NULL) {
+	char type, *value;
+	size_t value_length;
+	int page_num = redislite_value_for_key(_db, _cs, db->root, key_name, key_length, &type, &value, &value_length);
+	if (page_num == REDISLITE_NOT_FOUND) {
 		return 0;    // this is what redis returns for strlen on unexisting keys
 	}
+	if (page_num < 0) {
+		return page_num;
+	}
+	if (is_small(type)) {
+		redislite_free(value);
+		return value_length;
+	}
 	if (type != REDISLITE_PAGE_TYPE_STRING) {
-		if (_cs == NULL) {
-			redislite_page_type *page_type = redislite_page_get_type(db, type);
-			page_type->free_function(db, _page);
-		}
 		return REDISLITE_WRONG_TYPE;
 	}
-	redislite_page_string *page = (redislite_page_string *)_page;
+	redislite_page_string *page = redislite_page_get(_db, _cs, page_num, type);
+	if (page == NULL) {
+		return REDISLITE_OOM;
+	}
 	size_t len = page->size;
 	if (_cs == NULL) {
 		redislite_free_string(db, page);
@@ -558,31 +1332,13 @@ int redislite_page_string_strlen_key_string(void *_db, void *_cs, char *key_name
 	return len;
 }
 
-int redislite_page_string_getrange_key_string(void *_db, void *_cs, char *key_name, size_t key_length, int _start, int _end, char **str, size_t *str_length)
+/*
+ * Turns the offsets given to GETRANGE, negative ones counting from the
+ * end, into the first and last byte of a string of `len` bytes. Returns 0
+ * if the range is empty.
+ */
+static int string_range(size_t len, int _start, int _end, size_t *start_p, size_t *end_p)
 {
-	redislite *db = (redislite *)_db;
-	char type;
-	void *_page = redislite_page_get_by_keyname(_db, _cs, key_name, key_length, &type);
-	if (_page == NULL) {
-		// redis returns an empty string
-		if (str) {
-			*str = 0;
-		}
-		if (str_length) {
-			*str_length = 0;
-		}
-		return REDISLITE_OK;
-	}
-	if (type != REDISLITE_PAGE_TYPE_STRING) {
-		if (_cs == NULL) {
-			redislite_page_type *page_type = redislite_page_get_type(db, type);
-			page_type->free_function(db, _page);
-		}
-		return REDISLITE_WRONG_TYPE;
-	}
-	redislite_page_string *page = (redislite_page_string *)_page;
-	size_t len = page->size;
-
 	long __start = _start, __end = _end;
 	if (__start < 0) {
 		__start = len + __start;
@@ -603,8 +1359,52 @@ int redislite_page_string_getrange_key_string(void *_db, void *_cs, char *key_na
 	if (len > 0 && end >= len) {
 		end = len - 1;
 	}
+	*start_p = start;
+	*end_p = end;
+	return len > 0 && start <= end;
+}
+
+int redislite_page_string_getrange_key_string(void *_db, void *_cs, char *key_name, size_t key_length, int _start, int _end, char **str, size_t *str_length)
+{
+	redislite *db = (redislite *)_db;
+	char type, *value;
+	size_t value_length, start, end;
+	int page_num = redislite_value_for_key(_db, _cs, db->root, key_name, key_length, &type, &value, &value_length);
+	if (page_num == REDISLITE_NOT_FOUND) {
+		// redis returns an empty string
+		if (str) {
+			*str = 0;
+		}
+		if (str_length) {
+			*str_length = 0;
+		}
+		return REDISLITE_OK;
+	}
+	if (page_num < 0) {
+		return page_num;
+	}
+	if (is_small(type)) {
+		if (string_range(value_length, _start, _end, &start, &end)) {
+			memmove(value, &value[start], end - start + 1);
+			*str = value;
+			*str_length = end - start + 1;
+		}
+		else {
+			redislite_free(value);
+			*str = NULL;
+			*str_length = 0;
+		}
+		return REDISLITE_OK;
+	}
+	if (type != REDISLITE_PAGE_TYPE_STRING) {
+		return REDISLITE_WRONG_TYPE;
+	}
+	redislite_page_string *page = redislite_page_get(_db, _cs, page_num, type);
+	if (page == NULL) {
+		return REDISLITE_OOM;
+	}
 
-	if (len == 0 || start > end) {
+	if (!string_range(page->size, _start, _end, &start, &end)) {
 		if (str) {
 			*str = NULL;
 		}
@@ -622,59 +1422,26 @@ int redislite_page_string_getrange_key_string(void *_db, void *_cs, char *key_na
 		return REDISLITE_OOM;
 	}
 
-	size_t page_end = db->page_size - 12;
-	size_t copied = 0;
-	if (start < page_end) {
-		copied += MIN(end + 1, page_end) - start;
-		memcpy(response, &page->value[start], copied);
+	int status = read_range(db, _cs, page, start, end - start + 1, response);
+	if (_cs == NULL) {
+		redislite_free_string(db, page);
 	}
-
-	int next = page->right_page;
-
-	int p = 0;
-	while (copied < end + 1 - start) {
-		redislite_page_string_overflow *page_overflow = redislite_page_get(_db, _cs, next, REDISLITE_PAGE_TYPE_STRING_OVERFLOW);
-		if (page_overflow == NULL) {
-			if (_cs == NULL) {
-				redislite_free_string(_db, page);
-			}
-			redislite_free(response);
-			return REDISLITE_OOM;
-		}
-		page_end = db->page_size - 8;
-
-		if (start < copied + page_end * (1 + p) + db->page_size + 12) {
-			int pos = 0;
-			if (copied == 0) {
-				pos = start - page_end * p - db->page_size + 12;
-			}
-			int size = MIN(end - copied - start + 1, page_end - pos);
-			memcpy(&response[copied], &page_overflow->value[pos], size);
-			copied += size;
-		}
-
-		next = page_overflow->right_page;
-		if (_cs == NULL) {
-			redislite_free_string_overflow(_db, page_overflow);
-		}
-
-		if (next == 0) {
-			break;
-		}
-		p++;
+	if (status != REDISLITE_OK) {
+		redislite_free(response);
+		return status;
 	}
 	*str = response;
-	*str_length = copied;
+	*str_length = end - start + 1;
 	return REDISLITE_OK;
 }
 
 int redislite_page_string_setrange_key_string(void *_cs, char *key_name, size_t key_length, size_t start, char *str, size_t length, size_t *new_length)
 {
 	changeset *cs = (changeset *)_cs;
-	size_t len_in_page;
 
-	char type;
-	int status, page_num = redislite_value_page_for_key(cs->db, cs, cs->db->root, key_name, key_length, &type);
+	char type, *value;
+	size_t value_length;
+	int status, page_num = redislite_value_for_key(cs->db, cs, cs->db->root, key_name, key_length, &type, &value, &value_length);
 
 	if (page_num < 0) {
 		if (start > 0) {
@@ -689,66 +1456,20 @@ int redislite_page_string_setrange_key_string(void *_cs, char *key_name, size_t
 		return redislite_page_string_append_key_string(_cs, key_name, key_length, str, length, new_length);
 	}
 
+	if (is_small(type)) {
+		status = set_small_range(cs, key_name, key_length, value, value_length, start, str, length, new_length);
+		redislite_free(value);
+		return status;
+	}
 	if (type != REDISLITE_PAGE_TYPE_STRING) {
 		return REDISLITE_WRONG_TYPE;
 	}
 
-	size_t copied = 0;
 	redislite_page_string *page = redislite_page_get(cs->db, _cs, page_num, type);
-	if (start < cs->db->page_size - 12) {
-		len_in_page = cs->db->page_size - 12 - start;
-		if (len_in_page > length) {
-			len_in_page = length;
-		}
-		memcpy(&page->value[start], str, len_in_page);
-		copied += len_in_page;
-	}
-
-	size_t page_pos, pos = cs->db->page_size - 12;
-	int next = page->right_page;
-	redislite_page_string_overflow *overflow = NULL;
-
-	while ((pos < start + length) && (next > 0) && (overflow = redislite_page_get(cs->db, _cs, next, REDISLITE_PAGE_TYPE_STRING_OVERFLOW))) {
-		if (pos + cs->db->page_size - 8 > start) {
-			if (pos >= start) {
-				page_pos = 0;
-			}
-			else {
-				page_pos = start - pos;
-			}
-			len_in_page = cs->db->page_size - 8;
-			if (pos + cs->db->page_size - 8 > length + start - pos) {
-				len_in_page = length + start - pos;
-			}
-			memcpy(&overflow->value[page_pos], &str[copied], len_in_page);
-			copied += len_in_page;
-		}
-		pos += cs->db->page_size - 8;
-		status = redislite_add_modified_page(cs, next, REDISLITE_PAGE_TYPE_STRING_OVERFLOW, overflow);
-		if (status < 0) {
-			return status;
-		}
-		next = overflow->right_page;
-	}
-	if (pos < start + length) {
-		next = add_extra_string(cs, &str[copied], length - copied);
-		if (overflow != NULL) {
-			overflow->right_page = next;
-		}
-		else {
-			page->right_page = next;
-		}
-	}
-
-	if (start + length > page->size) {
-		page->size = start + length;
-	}
-
-	status = redislite_add_modified_page(cs, page_num, REDISLITE_PAGE_TYPE_STRING, page);
-	if (new_length) {
-		*new_length = page->size;
+	if (page == NULL) {
+		return REDISLITE_OOM;
 	}
-	return status > 0 ? REDISLITE_OK : status;
+	return set_page_range(cs, key_name, key_length, page_num, page, start, str, length, new_length);
 }
 
 int redislite_page_string_getbit_key_string(void *_db, void *_cs, char *key_name, size_t key_length, long long bitoffset)
@@ -758,45 +1479,43 @@ int redislite_page_string_getbit_key_string(void *_db, void *_cs, char *key_name
 	}
 
 	redislite *db = (redislite *)_db;
-	char type;
-	void *_page = redislite_page_get_by_keyname(_db, _cs, key_name, key_length, &type);
-	if (_page == NULL) {
+	char type, *value;
+	size_t value_length;
+	size_t byte = bitoffset >> 3;
+	size_t bit = 7 - (bitoffset & 0x7);
+	size_t bitval = 0;
+	int page_num = redislite_value_for_key(_db, _cs, db->root, key_name, key_length, &type, &value, &value_length);
+	if (page_num < 0) {
 		// redis returns an empty string
 		return 0;
 	}
-	if (type != REDISLITE_PAGE_TYPE_STRING) {
-		if (_cs == NULL) {
-			redislite_page_type *page_type = redislite_page_get_type(_db, type);
-			page_type->free_function(_db, _page);
+	if (is_small(type)) {
+		if (byte < value_length) {
+			bitval = value[byte] & (1 << bit);
 		}
+		redislite_free(value);
+		return bitval == 0 ? 0 : 1;
+	}
+	if (type != REDISLITE_PAGE_TYPE_STRING) {
 		return REDISLITE_WRONG_TYPE;
 	}
 
-	redislite_page_string *page = (redislite_page_string *)_page;
-	size_t byte = bitoffset >> 3;
-	size_t bit = 7 - (bitoffset & 0x7);
-	size_t bitval = 0;
+	redislite_page_string *page = redislite_page_get(_db, _cs, page_num, type);
+	if (page == NULL) {
+		return REDISLITE_OOM;
+	}
 
+	int status = REDISLITE_OK;
 	if (byte < page->size) {
-		if (byte <= db->page_size - 12) {
-			bitval = ((char *)page->value)[byte] & (1 << bit);
-		}
-		else {
-			int next = page->right_page;
-			redislite_page_string_overflow *overflow;
-			int pos = db->page_size - 12;
-			while (next > 0) {
-				overflow = redislite_page_get(_db, _cs, next, REDISLITE_PAGE_TYPE_STRING_OVERFLOW);
-				if (byte <= pos + db->page_size - 8) {
-					bitval = ((char *)overflow->value)[byte - pos] & (1 << bit);
-					break;
-				}
-				pos += db->page_size - 8;
-				if (_cs == NULL) {
-					redislite_free_string_overflow(_db, overflow);
-				}
-			}
-		}
+		char byteval;
+		status = read_range(db, _cs, page, byte, 1, &byteval);
+		bitval = byteval & (1 << bit);
+	}
+	if (_cs == NULL) {
+		redislite_free_string(db, page);
+	}
+	if (status != REDISLITE_OK) {
+		return status;
 	}
 
 	return bitval == 0 ? 0 : 1;
@@ -810,9 +1529,11 @@ int redislite_page_string_setbit_key_string(void *_cs, char *key_name, size_t ke
 	}
 
 	redislite_page_string *page;
-	char type;
+	char type, *value;
+	size_t value_length;
 	size_t byte = bitoffset >> 3;
-	int page_num = redislite_value_page_for_key(cs->db, _cs, cs->db->root, key_name, key_length, &type);
+	size_t bit = 7 - (bitoffset & 0x7);
+	int page_num = redislite_value_for_key(cs->db, _cs, cs->db->root, key_name, key_length, &type, &value, &value_length);
 	if (page_num == REDISLITE_NOT_FOUND) {
 		page_num = -1;
 		page = redislite_malloc(sizeof(redislite_page_string));
@@ -829,11 +1550,24 @@ int redislite_page_string_setbit_key_string(void *_cs, char *key_name, size_t ke
 		page->size = byte + 1;
 		page->db = cs->db;
 		page->right_page = 0;
+		page->extent = 0;
 	}
 	else {
 		if (page_num < 0) {
 			return page_num;
 		}
+		if (is_small(type)) {
+			char byteval = byte < value_length ? value[byte] : '\0';
+			int bitval = byteval & (1 << bit);
+			byteval &= ~(1 << bit);
+			byteval |= ((on & 0x1) << bit);
+			int status = set_small_range(cs, key_name, key_length, value, value_length, byte, &byteval, 1, NULL);
+			redislite_free(value);
+			if (status != REDISLITE_OK) {
+				return status;
+			}
+			return bitval ? 1 : 0;
+		}
 		if (type != REDISLITE_PAGE_TYPE_STRING) {
 			return REDISLITE_WRONG_TYPE;
 		}
@@ -845,11 +1579,10 @@ int redislite_page_string_setbit_key_string(void *_cs, char *key_name, size_t ke
 	}
 
 	if (byte >= page->size) {
-		memset(page->value + page->size, '\0', byte - page->size);
+		memset(page->value + page->size, '\0', byte - page->size + 1);
 		page->size = byte + 1;
 	}
 	int byteval = page->value[byte];
-	size_t bit = 7 - (bitoffset & 0x7);
 	size_t bitval = byteval & (1 << bit);
 	byteval &= ~(1 << bit);
 	byteval |= ((on & 0x1) << bit);
@@ -4,9 +4,30 @@ typedef struct {
 	char *value;
 } redislite_page_string_overflow;
 
+typedef struct {
+	void *db;
+	char *value; // a whole page of the string
+} redislite_page_string_extent;
+
+typedef struct {
+	int page; // the first one
+	int count;
+} redislite_page_string_run;
+
+// the runs of a string that outgrew its extent
+typedef struct {
+	void *db;
+	size_t number_of_runs;
+	redislite_page_string_run *runs;
+} redislite_page_string_directory;
+
+// in place of the size of the extent, for a string whose right_page is a directory
+#define REDISLITE_STRING_RUNS -1
+
 typedef struct {
 	void *db;
 	int right_page;
+	int extent; // pages in the run starting at right_page, 0 for a chain of overflow pages
 	size_t size;
 	char *value;
 } redislite_page_string;
@@ -19,8 +40,17 @@ void redislite_write_string_overflow(void *_db, unsigned char *data, void *page)
 void *redislite_read_string_overflow(void *_db, unsigned char *data);
 void redislite_free_string_overflow(void *_db, void *page);
 void redislite_delete_string_overflow(void *_cs, void *page);
+void redislite_write_string_extent(void *_db, unsigned char *data, void *page);
+void *redislite_read_string_extent(void *_db, unsigned char *data);
+void redislite_free_string_extent(void *_db, void *page);
+void redislite_write_string_directory(void *_db, unsigned char *data, void *page);
+void *redislite_read_string_directory(void *_db, unsigned char *data);
+void redislite_free_string_directory(void *_db, void *page);
 int redislite_page_string_get_by_keyname(void *_db, void *_cs, char *key_name, size_t key_length, char **str, size_t *length);
+int redislite_page_string_stream_by_keyname(void *_db, void *_cs, char *key_name, size_t key_length, redislite_chunk_callback *callback, void *context);
 int redislite_insert_string(void *_cs, char *str, size_t length, int *num);
+int redislite_string_extent_pages(void *_db, void *page);
+int redislite_string_copy_extent(void *_db, void *_cs, void *page, int num);
 int redislite_page_string_getset_key_string(void *_cs, char *key_name, size_t key_length, char *str, size_t length, char **previous_value, size_t *previous_value_length);
 int redislite_page_string_set_key_string(void *_cs, char *key_name, size_t key_length, char *str, size_t length);
 int redislite_page_string_setnx_key_string(void *_cs, char *key_name, size_t key_length, char *str, size_t length);
@@ -7,10 +7,14 @@
 #include "page_string.h"
 #include "page_list.h"
 #include "page_set.h"
+#include "vacuum.h"
 #include "util.h"
 #include "version.h"
 #include <math.h>
 #include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
 
 char *redislite_git_SHA1();
 char *redislite_git_dirty();
@@ -106,6 +110,7 @@ static const char *key_not_found = "ERR no such key";
 static const char *syntax_error = "ERR syntax error";
 static const char *invalid_float = "value is not a valid float";
 static const char *nan_or_infinity = "increment would produce NaN or Infinity";
+static const char *key_too_long = "key is too long for the page size";
 static const char *ok = "OK";
 static const char *not_implemented_yet = "This command hasn't been implemented on redislite yet";
 static const char *implementation_not_planned = "This command hasn't been planned to be implemented on redislite";
@@ -205,6 +210,10 @@ static void set_error_message(int status, redislite_reply *reply)
 				error = nan_or_infinity;
 				break;
 			}
+		case REDISLITE_KEY_TOO_LONG: {
+				error = key_too_long;
+				break;
+			}
 
 		default: {
 				error = unknown_error;
@@ -230,6 +239,16 @@ static void set_error_message(int status, redislite_reply *reply)
 	reply->len = strlen(error) + 1;
 }
 
+// for the commands that only create their reply when they fail
+static redislite_reply *oom_reply()
+{
+	redislite_reply *reply = redislite_create_reply();
+	if (reply != NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+	}
+	return reply;
+}
+
 redislite_reply *redislite_strlen_command(redislite *db, redislite_params *params)
 {
 	char *key;
@@ -240,7 +259,13 @@ redislite_reply *redislite_strlen_command(redislite *db, redislite_params *param
 	}
 	key = params->argv[1];
 	len = params->argvlen[1];
-	int strlen = redislite_page_string_strlen_by_keyname(db, NULL, key, len);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	int strlen = redislite_page_string_strlen_by_keyname(db, cs, key, len);
+	redislite_free_changeset(cs);
 	if (strlen >= 0) {
 		reply->type = REDISLITE_REPLY_INTEGER;
 		reply->integer = strlen;
@@ -258,6 +283,10 @@ redislite_reply *redislite_getset_command(redislite *db, redislite_params *param
 		return NULL;
 	}
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	size_t len = 0;
 	int status = redislite_page_string_getset_key_string(cs, params->argv[1], params->argvlen[1], params->argv[2], params->argvlen[2], &reply->str, &len);
 	reply->len = (int)len;
@@ -292,7 +321,13 @@ redislite_reply *redislite_get_command(redislite *db, redislite_params *params)
 	key = params->argv[1];
 	len = params->argvlen[1];
 	size_t reply_len = 0;
-	int status = redislite_page_string_get_by_keyname(db, NULL, key, len, &reply->str, &reply_len);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	int status = redislite_page_string_get_by_keyname(db, cs, key, len, &reply->str, &reply_len);
+	redislite_free_changeset(cs);
 	reply->len = (int)reply_len;
 
 	if (status == REDISLITE_OK) {
@@ -304,6 +339,45 @@ redislite_reply *redislite_get_command(redislite *db, redislite_params *params)
 	return reply;
 }
 
+/*
+ * GET handing the string to `callback` a few pages at a time instead of
+ * copying it whole, for values too long to hold in memory.
+ */
+int redislite_get_stream(redislite *db, char *key, size_t key_length, redislite_chunk_callback *callback, void *context)
+{
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		return REDISLITE_OOM;
+	}
+	int status = redislite_page_string_stream_by_keyname(db, cs, key, key_length, callback, context);
+	redislite_free_changeset(cs);
+	return status;
+}
+
+static int write_chunk(void *context, const char *chunk, size_t length)
+{
+	int fd = *(int *)context;
+	ssize_t written;
+	while (length > 0) {
+		written = write(fd, chunk, length);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return REDISLITE_ERR;
+		}
+		chunk += written;
+		length -= written;
+	}
+	return REDISLITE_OK;
+}
+
+// writes the string of `key` to `fd`, which may be a pipe or a socket
+int redislite_get_to_fd(redislite *db, char *key, size_t key_length, int fd)
+{
+	return redislite_get_stream(db, key, key_length, write_chunk, &fd);
+}
+
 redislite_reply *redislite_set_command(redislite *db, redislite_params *params)
 {
 	char *key, *value;
@@ -317,6 +391,10 @@ redislite_reply *redislite_set_command(redislite *db, redislite_params *params)
 	value = params->argv[2];
 	value_len = params->argvlen[2];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = redislite_page_string_set_key_string(cs, key, len, value, value_len);
 	if (status >= 0) {
 		status = redislite_save_changeset(cs);
@@ -352,6 +430,10 @@ redislite_reply *redislite_mset_command(redislite *db, redislite_params *params)
 		return reply;
 	}
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = REDISLITE_OK;
 	for (i = 1; i < params->argc; i += 2) {
 		key = params->argv[i];
@@ -385,7 +467,13 @@ redislite_reply *redislite_randomkey_command(redislite *db, redislite_params *pa
 	}
 	char *value;
 	size_t value_len;
-	int status = redislite_get_random_key_name(db, NULL, &value, &value_len);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	int status = redislite_get_random_key_name(db, cs, &value, &value_len);
+	redislite_free_changeset(cs);
 	if (status == REDISLITE_NOT_FOUND) {
 		reply->type = REDISLITE_REPLY_NIL;
 	}
@@ -409,7 +497,13 @@ redislite_reply *redislite_keys_command(redislite *db, redislite_params *params)
 	int size, i = 0;
 	char **values;
 	int *values_len;
-	int status = redislite_get_keys(db, NULL, params->argv[1], params->argvlen[1], &size, &values, &values_len);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	int status = redislite_get_keys(db, cs, params->argv[1], params->argvlen[1], &size, &values, &values_len);
+	redislite_free_changeset(cs);
 	if (status < 0) {
 		set_error_message(status, reply);
 	}
@@ -494,6 +588,10 @@ redislite_reply *redislite_del_command(redislite *db, redislite_params *params)
 		return NULL;
 	}
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = redislite_delete_keys(cs, params->argc - 1, &params->argv[1], &params->argvlen[1]);
 	if (status >= 0) {
 		int ret = redislite_save_changeset(cs);
@@ -523,7 +621,13 @@ redislite_reply *redislite_exists_command(redislite *db, redislite_params *param
 	}
 	key = params->argv[1];
 	len = params->argvlen[1];
-	int status = redislite_value_page_for_key(db, NULL, db->root, key, len, NULL);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	int status = redislite_value_page_for_key(db, cs, db->root, key, len, NULL);
+	redislite_free_changeset(cs);
 	reply->type = REDISLITE_REPLY_INTEGER;
 	reply->integer = status >= 0;
 	return reply;
@@ -540,7 +644,13 @@ redislite_reply *redislite_type_command(redislite *db, redislite_params *params)
 	}
 	key = params->argv[1];
 	len = params->argvlen[1];
-	int status = redislite_page_index_type(db, NULL, db->root, key, len, &type);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	int status = redislite_page_index_type(db, cs, db->root, key, len, &type);
+	redislite_free_changeset(cs);
 	if (status == REDISLITE_NOT_FOUND) {
 		reply->str = redislite_malloc(sizeof(char) * 5);
 		if (reply->str == NULL) {
@@ -556,7 +666,10 @@ redislite_reply *redislite_type_command(redislite *db, redislite_params *params)
 	}
 	else {
 		switch (type) {
-			case REDISLITE_PAGE_TYPE_STRING: {
+			case REDISLITE_PAGE_TYPE_STRING:
+			case REDISLITE_PAGE_TYPE_STRING_INLINE:
+			case REDISLITE_PAGE_TYPE_STRING_INTEGER:
+			case REDISLITE_PAGE_TYPE_HEAP: {
 					reply->str = redislite_malloc(sizeof(char) * 7);
 					if (reply->str == NULL) {
 						redislite_free(reply);
@@ -597,6 +710,10 @@ redislite_reply *redislite_setnx_command(redislite *db, redislite_params *params
 	value = params->argv[2];
 	value_len = params->argvlen[2];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = redislite_page_string_setnx_key_string(cs, key, len, value, value_len);
 	if (status >= 0) {
 		int ret = redislite_save_changeset(cs);
@@ -636,6 +753,10 @@ redislite_reply *redislite_msetnx_command(redislite *db, redislite_params *param
 		return reply;
 	}
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 
 	unsigned char *data = malloc(sizeof(unsigned char) * db->page_size);
 	if (data == NULL) {
@@ -688,6 +809,10 @@ redislite_reply *redislite_append_command(redislite *db, redislite_params *param
 	value = params->argv[2];
 	value_len = params->argvlen[2];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	size_t new_len;
 	int status = redislite_page_string_append_key_string(cs, key, len, value, value_len, &new_len);
 	if (status != REDISLITE_OK) {
@@ -743,6 +868,10 @@ redislite_reply *redislite_setbit_command(redislite *db, redislite_params *param
 	}
 
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int response = status = redislite_page_string_setbit_key_string(cs, key, len, bit_offset, on);
 	if (status < REDISLITE_OK) {
 		set_error_message(status, reply);
@@ -779,7 +908,13 @@ redislite_reply *redislite_getbit_command(redislite *db, redislite_params *param
 		return reply;
 	}
 
-	status = redislite_page_string_getbit_key_string(db, NULL, key, len, bit_offset);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	status = redislite_page_string_getbit_key_string(db, cs, key, len, bit_offset);
+	redislite_free_changeset(cs);
 	if (status < REDISLITE_OK) {
 		set_error_message(status, reply);
 		return reply;
@@ -822,6 +957,10 @@ redislite_reply *redislite_setrange_command(redislite *db, redislite_params *par
 
 	size_t reply_len = 0;
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	status = redislite_page_string_setrange_key_string(cs, key, len, start, value, value_len, &reply_len);
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
@@ -867,7 +1006,13 @@ redislite_reply *redislite_getrange_command(redislite *db, redislite_params *par
 	}
 
 	size_t reply_len = 0;
-	status = redislite_page_string_getrange_key_string(db, NULL, key, len, start, end, &reply->str, &reply_len);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	status = redislite_page_string_getrange_key_string(db, cs, key, len, start, end, &reply->str, &reply_len);
+	redislite_free_changeset(cs);
 	reply->len = (int)reply_len;
 	if (status < REDISLITE_OK) {
 		set_error_message(status, reply);
@@ -888,6 +1033,10 @@ redislite_reply *redislite_incr_command(redislite *db, redislite_params *params)
 	key = params->argv[1];
 	len = params->argvlen[1];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = redislite_page_string_incr_key_string(cs, key, len, &reply->integer);
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
@@ -914,6 +1063,10 @@ redislite_reply *redislite_decr_command(redislite *db, redislite_params *params)
 	key = params->argv[1];
 	len = params->argvlen[1];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = redislite_page_string_decr_key_string(cs, key, len, &reply->integer);
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
@@ -940,6 +1093,10 @@ redislite_reply *redislite_incrbyfloat_command(redislite *db, redislite_params *
 	key = params->argv[1];
 	len = params->argvlen[1];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 
 	char *eptr;
 	long double incr = strtold(params->argv[2], &eptr);
@@ -973,6 +1130,10 @@ redislite_reply *redislite_incrby_command(redislite *db, redislite_params *param
 	key = params->argv[1];
 	len = params->argvlen[1];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	long long incr;
 	int status = str_to_long_long(params->argv[2], params->argvlen[2], &incr);
 	if (status != REDISLITE_OK) {
@@ -1011,6 +1172,10 @@ redislite_reply *redislite_rename_command(redislite *db, redislite_params *param
 	target = params->argv[2];
 	target_len = params->argvlen[2];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 
 	int status = redislite_page_index_rename_key(cs, cs->db->root, src, src_len, target, target_len);
 	if (status == REDISLITE_OK) {
@@ -1046,6 +1211,10 @@ redislite_reply *redislite_renamenx_command(redislite *db, redislite_params *par
 	target = params->argv[2];
 	target_len = params->argvlen[2];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 
 	int status = redislite_page_index_renamenx_key(cs, cs->db->root, src, src_len, target, target_len);
 	if (status == REDISLITE_OK) {
@@ -1084,6 +1253,10 @@ redislite_reply *redislite_decrby_command(redislite *db, redislite_params *param
 	key = params->argv[1];
 	len = params->argvlen[1];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	long long decr;
 	int status = str_to_long_long(params->argv[2], params->argvlen[2], &decr);
 	if (status != REDISLITE_OK) {
@@ -1119,7 +1292,13 @@ redislite_reply *redislite_llen_command(redislite *db, redislite_params *params)
 	}
 	key = params->argv[1];
 	len = params->argvlen[1];
-	int status = redislite_llen_by_keyname(db, NULL, key, len, &llen);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	int status = redislite_llen_by_keyname(db, cs, key, len, &llen);
+	redislite_free_changeset(cs);
 	if (status == REDISLITE_OK || status == REDISLITE_NOT_FOUND) {
 		reply->type = REDISLITE_REPLY_INTEGER;
 		reply->integer = llen;
@@ -1137,6 +1316,9 @@ redislite_reply *redislite_lpush_command(redislite *db, redislite_params *params
 	key = params->argv[1];
 	len = params->argvlen[1];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		return oom_reply();
+	}
 	int i, status = REDISLITE_OK;
 	for (i = 2; i < params->argc; i++) {
 		value = params->argv[i];
@@ -1169,6 +1351,9 @@ redislite_reply *redislite_rpush_command(redislite *db, redislite_params *params
 	key = params->argv[1];
 	len = params->argvlen[1];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		return oom_reply();
+	}
 	int i, status = REDISLITE_OK;
 	for (i = 2; i < params->argc; i++) {
 		value = params->argv[i];
@@ -1181,6 +1366,7 @@ redislite_reply *redislite_rpush_command(redislite *db, redislite_params *params
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
 	}
+	redislite_free_changeset(cs);
 
 	if (status != REDISLITE_OK) {
 		redislite_reply *reply = redislite_create_reply();
@@ -1190,7 +1376,6 @@ redislite_reply *redislite_rpush_command(redislite *db, redislite_params *params
 		set_error_message(status, reply);
 		return reply;
 	}
-	redislite_free_changeset(cs);
 	return redislite_llen_command(db, params);
 }
 
@@ -1203,10 +1388,14 @@ redislite_reply *redislite_rpushx_command(redislite *db, redislite_params *param
 	value = params->argv[2];
 	value_len = params->argvlen[2];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		return oom_reply();
+	}
 	int status = redislite_rpushx_by_keyname(cs, key, len, value, value_len);
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
 	}
+	redislite_free_changeset(cs);
 
 	if (status != REDISLITE_OK) {
 		redislite_reply *reply = redislite_create_reply();
@@ -1216,7 +1405,6 @@ redislite_reply *redislite_rpushx_command(redislite *db, redislite_params *param
 		set_error_message(status, reply);
 		return reply;
 	}
-	redislite_free_changeset(cs);
 	return redislite_llen_command(db, params);
 }
 
@@ -1229,10 +1417,14 @@ redislite_reply *redislite_lpushx_command(redislite *db, redislite_params *param
 	value = params->argv[2];
 	value_len = params->argvlen[2];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		return oom_reply();
+	}
 	int status = redislite_lpushx_by_keyname(cs, key, len, value, value_len);
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
 	}
+	redislite_free_changeset(cs);
 
 	if (status != REDISLITE_OK) {
 		redislite_reply *reply = redislite_create_reply();
@@ -1242,7 +1434,6 @@ redislite_reply *redislite_lpushx_command(redislite *db, redislite_params *param
 		set_error_message(status, reply);
 		return reply;
 	}
-	redislite_free_changeset(cs);
 	return redislite_llen_command(db, params);
 }
 
@@ -1257,6 +1448,10 @@ redislite_reply *redislite_rpop_command(redislite *db, redislite_params *params)
 	key = params->argv[1];
 	len = params->argvlen[1];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = redislite_rpop_by_keyname(cs, key, len, &value, &value_len);
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
@@ -1287,6 +1482,10 @@ redislite_reply *redislite_rpoplpush_command(redislite *db, redislite_params *pa
 	destination = params->argv[2];
 	destination_len = params->argvlen[2];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = redislite_rpoplpush_by_keyname(cs, source, source_len, destination, destination_len, &value, &value_len);
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
@@ -1315,6 +1514,10 @@ redislite_reply *redislite_lpop_command(redislite *db, redislite_params *params)
 	key = params->argv[1];
 	len = params->argvlen[1];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = redislite_lpop_by_keyname(cs, key, len, &value, &value_len);
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
@@ -1365,7 +1568,13 @@ redislite_reply *redislite_lrange_command(redislite *db, redislite_params *param
 	size_t size;
 	char **values = NULL;
 	size_t *values_len = NULL;
-	status = redislite_lrange_by_keyname(db, NULL, key, len, start, end, &size, &values, &values_len);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	status = redislite_lrange_by_keyname(db, cs, key, len, start, end, &size, &values, &values_len);
+	redislite_free_changeset(cs);
 	size_t i = 0;
 	if (status == REDISLITE_OK) {
 		reply->type = REDISLITE_REPLY_ARRAY;
@@ -1434,7 +1643,13 @@ redislite_reply *redislite_lindex_command(redislite *db, redislite_params *param
 	key = params->argv[1];
 	len = params->argvlen[1];
 
-	status = redislite_lindex_by_keyname(db, NULL, key, len, (int)pos, &value, &value_len);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	status = redislite_lindex_by_keyname(db, cs, key, len, (int)pos, &value, &value_len);
+	redislite_free_changeset(cs);
 	if (status == REDISLITE_OK) {
 		if (value_len > 0) {
 			reply->type = REDISLITE_REPLY_STRING;
@@ -1474,6 +1689,10 @@ redislite_reply *redislite_lset_command(redislite *db, redislite_params *params)
 	value_len = params->argvlen[3];
 
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	status = redislite_lset_by_keyname(cs, key, len, (int)pos, value, value_len);
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
@@ -1522,6 +1741,10 @@ redislite_reply *redislite_ltrim_command(redislite *db, redislite_params *params
 	len = params->argvlen[1];
 
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	status = redislite_ltrim_by_keyname(cs, key, len, (int)start, (int)end);
 	if (status == REDISLITE_OK) {
 		status = redislite_save_changeset(cs);
@@ -1566,6 +1789,10 @@ redislite_reply *redislite_linsert_command(redislite *db, redislite_params *para
 	value_len = params->argvlen[4];
 
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	reply->integer = redislite_linsert_by_keyname(cs, key, len, after, pivot, pivot_len, value, value_len);
 	if (reply->integer >= 0) {
 		status = redislite_save_changeset(cs);
@@ -1628,11 +1855,16 @@ redislite_reply *redislite_mget_command(redislite *db, redislite_params *params)
 		return NULL;
 	}
 
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	for (i = 1; i < params->argc; i++) {
 		key = params->argv[i];
 		len = params->argvlen[i];
 		reply_len = 0;
-		status = redislite_page_string_get_by_keyname(db, NULL, key, len, &reply->element[i - 1]->str, &reply_len);
+		status = redislite_page_string_get_by_keyname(db, cs, key, len, &reply->element[i - 1]->str, &reply_len);
 		reply->element[i - 1]->len = (int)reply_len;
 		if (status == REDISLITE_OK) {
 			reply->element[i - 1]->type = REDISLITE_REPLY_STRING;
@@ -1641,6 +1873,7 @@ redislite_reply *redislite_mget_command(redislite *db, redislite_params *params)
 			reply->element[i - 1]->type = REDISLITE_REPLY_NIL;
 		}
 	}
+	redislite_free_changeset(cs);
 	return reply;
 }
 
@@ -1648,18 +1881,60 @@ redislite_reply *redislite_mget_command(redislite *db, redislite_params *params)
 redislite_reply *redislite_flushall_command(redislite *db, redislite_params *params)
 {
 	params = params; // XXX: avoid unused-parameter warning; we are implementing a prototype
-	changeset *cs = redislite_create_changeset(db);
-
 	redislite_reply *reply = redislite_create_reply();
+	if (reply == NULL) {
+		return NULL;
+	}
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = redislite_flush(cs);
 	if (status < 0) {
 		set_error_message(status, reply);
 		goto cleanup;
 	}
 	status = redislite_save_changeset(cs);
-	redislite_free_changeset(cs);
 	set_status_message(status, reply);
 cleanup:
+	redislite_free_changeset(cs);
+	return reply;
+}
+
+redislite_reply *redislite_vacuum_command(redislite *db, redislite_params *params)
+{
+	redislite_reply *reply = redislite_create_reply();
+	if (reply == NULL) {
+		return NULL;
+	}
+	if (params->argc == 1) {
+		int status = redislite_vacuum(db);
+		if (status < 0) {
+			set_error_message(status, reply);
+			return reply;
+		}
+		set_status_message(status, reply);
+		return reply;
+	}
+
+	long long pages;
+	if (params->argc != 3 || params->argvlen[1] != 4 || strcasecmp(params->argv[1], "step") != 0) {
+		set_error_message(REDISLITE_SYNTAX_ERROR, reply);
+		return reply;
+	}
+	int status = str_to_long_long(params->argv[2], params->argvlen[2], &pages);
+	if (status != REDISLITE_OK || pages <= 0 || pages > INT_MAX) {
+		set_error_message(REDISLITE_EXPECT_INTEGER, reply);
+		return reply;
+	}
+	status = redislite_vacuum_step(db, (int)pages);
+	if (status < 0) {
+		set_error_message(status, reply);
+		return reply;
+	}
+	reply->type = REDISLITE_REPLY_INTEGER;
+	reply->integer = status;
 	return reply;
 }
 
@@ -1700,6 +1975,10 @@ redislite_reply *redislite_sadd_command(redislite *db, redislite_params *params)
 	value = params->argv[2];
 	value_len = params->argvlen[2];
 	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
 	int status = redislite_page_set_add(cs, key, len, value, value_len);
 	if (status >= 0) {
 		int _status = redislite_save_changeset(cs);
@@ -1730,7 +2009,13 @@ redislite_reply *redislite_sismember_command(redislite *db, redislite_params *pa
 	len = params->argvlen[1];
 	value = params->argv[2];
 	value_len = params->argvlen[2];
-	int status = redislite_page_set_contains(db, NULL, key, len, value, value_len);
+	changeset *cs = redislite_create_changeset(db);
+	if (cs == NULL) {
+		set_error_message(REDISLITE_OOM, reply);
+		return reply;
+	}
+	int status = redislite_page_set_contains(db, cs, key, len, value, value_len);
+	redislite_free_changeset(cs);
 	if (status < 0) {
 		set_error_message(status, reply);
 	}
@@ -1877,7 +2162,8 @@ struct redislite_command redislite_command_table[] = {
 	{"publish", redislite_command_implementation_not_planned, 3, 0},
 	{"watch", redislite_command_not_implemented_yet, 2, 0},
 	{"unwatch", redislite_command_not_implemented_yet, 1, 0},
-	{"incrbyfloat", redislite_incrbyfloat_command, 3, 0}
+	{"incrbyfloat", redislite_incrbyfloat_command, 3, 0},
+	{"vacuum", redislite_vacuum_command, -1, 0}
 };
 
 static int memcaseequal(const char *str1, const char *str2, size_t length)
@@ -1972,6 +2258,7 @@ struct redislite_command *redislite_command_lookup(char *command, size_t length)
 			break;
 
 		case 218: // 'I'+'N'+'C'
+			// 'V'+'A'+'C'
 			if (length == 4 && memcaseequal(command, "incr", 4)) {
 				return &redislite_command_table[13];
 			}
@@ -1981,6 +2268,9 @@ struct redislite_command *redislite_command_lookup(char *command, size_t length)
 			if (length == 11 && memcaseequal(command, "incrbyfloat", 11)) {
 				return &redislite_command_table[117];
 			}
+			if (length == 6 && memcaseequal(command, "vacuum", 6)) {
+				return &redislite_command_table[118];
+			}
 			break;
 
 		case 221: // 'L'+'L'+'E'
@@ -2434,6 +2724,10 @@ redislite_reply *redislite_execute_command(redislite *db, redislite_params *para
 		return reply;
 	}
 	redislite_reply *reply = cmd->proc(db, params);
+	if (db->auto_vacuum > 0 && db->first_freelist_page != 0 && !db->readonly) {
+		// the command already committed, a failed step is retried after the next one
+		redislite_vacuum_step(db, db->auto_vacuum);
+	}
 	return reply;
 }
 
@@ -32,6 +32,8 @@ void redislite_free_reply(redislite_reply *reply);
 redislite_params *redislite_create_params();
 void redislite_free_params(redislite_params *params);
 redislite_reply *redislite_get_command(redislite *db, redislite_params *params);
+int redislite_get_stream(redislite *db, char *key, size_t key_length, redislite_chunk_callback *callback, void *context);
+int redislite_get_to_fd(redislite *db, char *key, size_t key_length, int fd);
 redislite_reply *redislite_set_command(redislite *db, redislite_params *params);
 int redislitev_format_command(redislite_params **target, const char *format, va_list ap);
 int redislite_format_command(redislite_params **target, const char *format, ...);
@@ -58,6 +58,12 @@ static struct config {
 	char *historyfile;
 	int raw_output; /* output mode per command */
 	sds mb_delim;
+	int open_flags; /* REDISLITE_OPEN_* flags */
+	size_t page_size; /* page size for new databases (--page-size option) */
+	int synchronous; /* REDISLITE_SYNCHRONOUS_* (--sync option) */
+	int flush_interval; /* milliseconds, 0 disables the background flusher */
+	int auto_vacuum; /* pages per VACUUM STEP after every command, 0 disables it */
+	size_t extent_size; /* bytes the db file grows by at once, 0 for a page at a time */
 } config;
 
 static void usage();
@@ -288,13 +294,30 @@ static int cliConnect(int force)
 			redislite_close_database(db);
 		}
 
-		db = redislite_open_database(config.filename);
+		if (config.page_size && access(config.filename, F_OK) != 0) {
+			db = redislite_create_database_with_page_size(config.filename, config.page_size);
+			if (db == NULL) {
+				fprintf(stderr, "Could not create Redislite at %s with %lu bytes pages\n", config.filename, (unsigned long)config.page_size);
+				return REDISLITE_ERR;
+			}
+			redislite_close_database(db);
+		}
+		db = redislite_open_database_with_flags(config.filename, config.open_flags);
 
 		if (db == NULL) {
 			fprintf(stderr, "Could not open Redislite at %s\n", config.filename);
 			db = NULL;
 			return REDISLITE_ERR;
 		}
+		redislite_set_synchronous(db, config.synchronous);
+		if (redislite_set_flush_interval(db, config.flush_interval) != REDISLITE_OK) {
+			fprintf(stderr, "Could not start the background flusher\n");
+			redislite_close_database(db);
+			db = NULL;
+			return REDISLITE_ERR;
+		}
+		redislite_set_auto_vacuum(db, config.auto_vacuum);
+		redislite_set_extent_size(db, config.extent_size);
 	}
 	return REDISLITE_OK;
 }
@@ -441,6 +464,22 @@ static int cliReadReply(redislite_reply *reply, int output_raw_strings)
 	return REDISLITE_OK;
 }
 
+/*
+ * GET with raw output writes the string straight to stdout as it is read,
+ * so long values are piped without being held whole. Returns REDISLITE_SKIP
+ * when the reply is an error, for the command to run again and print it.
+ */
+static int cliStreamGet(char *key)
+{
+	fflush(stdout);
+	int status = redislite_get_to_fd(db, key, sdslen(key), fileno(stdout));
+	if (status != REDISLITE_OK && status != REDISLITE_NOT_FOUND) {
+		return status == REDISLITE_WRONG_TYPE ? REDISLITE_SKIP : status;
+	}
+	fwrite("\n", 1, 1, stdout);
+	return REDISLITE_OK;
+}
+
 static int cliSendCommand(int argc, char **argv, int repeat)
 {
 	char *command = argv[0];
@@ -458,6 +497,20 @@ static int cliSendCommand(int argc, char **argv, int repeat)
 		return REDISLITE_OK;
 	}
 
+	if (config.raw_output && argc == 2 && !strcasecmp(command, "get")) {
+		while (repeat > 0) {
+			int status = cliStreamGet(argv[1]);
+			if (status == REDISLITE_SKIP) {
+				break;
+			}
+			if (status != REDISLITE_OK) {
+				fprintf(stderr, "Error: could not read %s\n", argv[1]);
+				return REDISLITE_ERR;
+			}
+			repeat--;
+		}
+	}
+
 	/* Setup argument length */
 	argvlen = malloc(argc * sizeof(size_t));
 	for (j = 0; j < argc; j++) {
@@ -513,6 +566,43 @@ static int parseOptions(int argc, char **argv)
 		else if (!strcmp(argv[i], "--raw")) {
 			config.raw_output = 1;
 		}
+		else if (!strcmp(argv[i], "--mmap")) {
+			config.open_flags |= REDISLITE_OPEN_MMAP;
+		}
+		else if (!strcmp(argv[i], "--wal")) {
+			config.open_flags |= REDISLITE_OPEN_WAL;
+		}
+		else if (!strcmp(argv[i], "--page-size") && !lastarg) {
+			config.page_size = strtoul(argv[i + 1], NULL, 10);
+			i++;
+		}
+		else if (!strcmp(argv[i], "--sync") && !lastarg) {
+			if (!strcasecmp(argv[i + 1], "off")) {
+				config.synchronous = REDISLITE_SYNCHRONOUS_OFF;
+			}
+			else if (!strcasecmp(argv[i + 1], "normal")) {
+				config.synchronous = REDISLITE_SYNCHRONOUS_NORMAL;
+			}
+			else if (!strcasecmp(argv[i + 1], "full")) {
+				config.synchronous = REDISLITE_SYNCHRONOUS_FULL;
+			}
+			else {
+				usage();
+			}
+			i++;
+		}
+		else if (!strcmp(argv[i], "--flush-interval") && !lastarg) {
+			config.flush_interval = atoi(argv[i + 1]);
+			i++;
+		}
+		else if (!strcmp(argv[i], "--auto-vacuum") && !lastarg) {
+			config.auto_vacuum = atoi(argv[i + 1]);
+			i++;
+		}
+		else if (!strcmp(argv[i], "--extent-size") && !lastarg) {
+			config.extent_size = (size_t)atol(argv[i + 1]);
+			i++;
+		}
 		else if (!strcmp(argv[i], "-d") && !lastarg) {
 			sdsfree(config.mb_delim);
 			config.mb_delim = sdsnew(argv[i + 1]);
@@ -563,6 +653,13 @@ static void usage()
 	        "  -x               Read last argument from STDIN\n"
 	        "  -d <delimiter>   Multi-bulk delimiter in for raw formatting (default: \\n)\n"
 	        "  --raw            Use raw formatting for replies (default when STDOUT is not a tty)\n"
+	        "  --mmap           Read pages from a memory mapping of the db file\n"
+	        "  --wal            Commit to a write-ahead log (<filename>-wal)\n"
+	        "  --page-size <n>  Page size in bytes when creating the db, 512 to 65536 (default: 512)\n"
+	        "  --sync <mode>    off, normal (fsync in batches) or full (fsync every command) (default: normal)\n"
+	        "  --flush-interval <ms>  With --sync normal, fsync from a background thread at most <ms> after a write\n"
+	        "  --auto-vacuum <n>  Move up to <n> pages to shrink the db file after every command\n"
+	        "  --extent-size <n>  Grow the db file <n> bytes at a time, preallocated (default: a page at a time)\n"
 	        "  --help           Output this help and exit\n"
 	        "  --version        Output version and exit\n"
 	        "\n"
@@ -677,6 +774,12 @@ int main(int argc, char **argv)
 	config.historyfile = NULL;
 	config.raw_output = !isatty(fileno(stdout)) && (getenv("FAKETTY") == NULL);
 	config.mb_delim = sdsnew("\n");
+	config.open_flags = 0;
+	config.page_size = 0;
+	config.synchronous = REDISLITE_SYNCHRONOUS_NORMAL;
+	config.flush_interval = 0;
+	config.auto_vacuum = 0;
+	config.extent_size = 0;
 	cliInitHelp();
 
 	if (getenv("HOME") != NULL) {
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "redislite.h"
+#include "public_api.h"
+
+#define TEST_DB "redislite-test.db"
+
+static int failures = 0;
+
+static void expect(redislite *db, const char *command, const char *key, const char *value, int type)
+{
+	const char *argv[3] = {command, key, value};
+	size_t argvlen[3] = {strlen(command), strlen(key), value ? strlen(value) : 0};
+	redislite_reply *reply = redislite_command_argv(db, value ? 3 : 2, argv, argvlen);
+	if (reply == NULL || reply->type != type) {
+		printf("%s with a key of %zu bytes: expected reply type %d, got %d\n", command, strlen(key), type, reply ? reply->type : -1);
+		failures++;
+	}
+	else if (type == REDISLITE_REPLY_ERROR && strcmp(reply->str, "key is too long for the page size") != 0) {
+		printf("%s with a key of %zu bytes: unexpected error '%s'\n", command, strlen(key), reply->str);
+		failures++;
+	}
+	redislite_free_reply(reply);
+}
+
+// on 512 byte pages a key takes up to half of the 498 usable bytes with
+// its header and an eight byte payload, that is 238 bytes of name
+static void test_key_length_boundary()
+{
+	char key[241];
+	unlink(TEST_DB);
+	redislite *db = redislite_create_database_with_page_size(TEST_DB, 512);
+	if (db == NULL) {
+		printf("could not create %s\n", TEST_DB);
+		failures++;
+		return;
+	}
+
+	memset(key, 'k', 238);
+	key[238] = 0;
+	expect(db, "SET", key, "value", REDISLITE_REPLY_STATUS);
+	expect(db, "SET", key, "41", REDISLITE_REPLY_STATUS);
+	expect(db, "INCR", key, NULL, REDISLITE_REPLY_INTEGER);
+	expect(db, "GET", key, NULL, REDISLITE_REPLY_STRING);
+
+	memset(key, 'l', 239);
+	key[239] = 0;
+	expect(db, "SET", key, "value", REDISLITE_REPLY_ERROR);
+	expect(db, "INCR", key, NULL, REDISLITE_REPLY_ERROR);
+	expect(db, "RPUSH", key, "value", REDISLITE_REPLY_ERROR);
+	expect(db, "GET", key, NULL, REDISLITE_REPLY_NIL);
+
+	redislite_close_database(db);
+	unlink(TEST_DB);
+}
+
+int main()
+{
+	test_key_length_boundary();
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
@@ -1,22 +1,32 @@
+#include "fmacros.h"
 #include "redislite.h"
 #include "core.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "page.h"
 #include "page_index.h"
 #include "page_first.h"
 #include "page_string.h"
 #include "page_freelist.h"
 #include "page_list.h"
+#include "page_heap.h"
+#include "page_cache.h"
+#include "wal.h"
+#include "flusher.h"
+#include "vacuum.h"
 #include "util.h"
 
+// the caller closes the database if it fails
 static int init_db(redislite *db)
 {
 	{
 		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
 		if (type == NULL) {
-			redislite_close_database(db);
 			return REDISLITE_OOM;
 		}
 		type->identifier = REDISLITE_PAGE_TYPE_INDEX;
@@ -33,7 +43,6 @@ static int init_db(redislite *db)
 	{
 		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
 		if (type == NULL) {
-			redislite_close_database(db);
 			return REDISLITE_OOM;
 		}
 		type->identifier = REDISLITE_PAGE_TYPE_STRING;
@@ -50,7 +59,6 @@ static int init_db(redislite *db)
 	{
 		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
 		if (type == NULL) {
-			redislite_close_database(db);
 			return REDISLITE_OOM;
 		}
 		type->identifier = REDISLITE_PAGE_TYPE_STRING_OVERFLOW;
@@ -67,7 +75,38 @@ static int init_db(redislite *db)
 	{
 		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
 		if (type == NULL) {
-			redislite_close_database(db);
+			return REDISLITE_OOM;
+		}
+		type->identifier = REDISLITE_PAGE_TYPE_STRING_EXTENT;
+		type->write_function = &redislite_write_string_extent;
+		type->read_function = &redislite_read_string_extent;
+		type->free_function = &redislite_free_string_extent;
+		type->delete_function = NULL;
+		int status = redislite_page_register_type(db, type);
+		if (status != REDISLITE_OK) {
+			free(type);
+			return status;
+		}
+	}
+	{
+		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
+		if (type == NULL) {
+			return REDISLITE_OOM;
+		}
+		type->identifier = REDISLITE_PAGE_TYPE_STRING_DIRECTORY;
+		type->write_function = &redislite_write_string_directory;
+		type->read_function = &redislite_read_string_directory;
+		type->free_function = &redislite_free_string_directory;
+		type->delete_function = NULL;
+		int status = redislite_page_register_type(db, type);
+		if (status != REDISLITE_OK) {
+			free(type);
+			return status;
+		}
+	}
+	{
+		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
+		if (type == NULL) {
 			return REDISLITE_OOM;
 		}
 		type->identifier = REDISLITE_PAGE_TYPE_FIRST;
@@ -84,7 +123,6 @@ static int init_db(redislite *db)
 	{
 		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
 		if (type == NULL) {
-			redislite_close_database(db);
 			return REDISLITE_OOM;
 		}
 		type->identifier = REDISLITE_PAGE_TYPE_FREELIST;
@@ -101,7 +139,6 @@ static int init_db(redislite *db)
 	{
 		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
 		if (type == NULL) {
-			redislite_close_database(db);
 			return REDISLITE_OOM;
 		}
 		type->identifier = REDISLITE_PAGE_TYPE_LIST;
@@ -118,7 +155,6 @@ static int init_db(redislite *db)
 	{
 		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
 		if (type == NULL) {
-			redislite_close_database(db);
 			return REDISLITE_OOM;
 		}
 		type->identifier = REDISLITE_PAGE_TYPE_LIST_FIRST;
@@ -135,7 +171,6 @@ static int init_db(redislite *db)
 	{
 		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
 		if (type == NULL) {
-			redislite_close_database(db);
 			return REDISLITE_OOM;
 		}
 		type->identifier = REDISLITE_PAGE_TYPE_SET;
@@ -149,59 +184,179 @@ static int init_db(redislite *db)
 			return status;
 		}
 	}
+	{
+		redislite_page_type *type = redislite_malloc(sizeof(redislite_page_type));
+		if (type == NULL) {
+			return REDISLITE_OOM;
+		}
+		type->identifier = REDISLITE_PAGE_TYPE_HEAP;
+		type->write_function = &redislite_write_heap;
+		type->read_function = &redislite_read_heap;
+		type->free_function = &redislite_free_heap;
+		type->delete_function = NULL;
+		int status = redislite_page_register_type(db, type);
+		if (status != REDISLITE_OK) {
+			free(type);
+			return status;
+		}
+	}
+	db->page_cache = redislite_page_cache_create(db, DEFAULT_PAGE_CACHE_SIZE);
+	if (db->page_cache == NULL) {
+		return REDISLITE_OOM;
+	}
 	return REDISLITE_OK;
 }
 
 redislite *redislite_open_database(const char *filename)
 {
-	FILE *fp = fopen(filename, "r");
-	if (!fp) {
-		return redislite_create_database(filename);
-	}
-	unsigned char header[DEFAULT_PAGE_SIZE]; // TODO: read 100 header and then the rest
-	fread(header, sizeof(unsigned char), DEFAULT_PAGE_SIZE, fp);
-	// TODO: check fread result
+	return redislite_open_database_with_flags(filename, 0);
+}
+
+redislite *redislite_open_database_with_flags(const char *filename, int flags)
+{
+	int readonly = 0;
 	redislite *db = NULL;
-	if (memcmp(header, HEADER_STRING, sizeof(HEADER_STRING)) != 0) {
+	redislite_wal *wal = NULL;
+	int fd = open(filename, O_RDWR);
+	if (fd == -1 && errno == EACCES) {
+		fd = open(filename, O_RDONLY);
+		readonly = 1;
+	}
+	if (fd == -1) {
+		if (errno == ENOENT) {
+			db = redislite_create_database(filename);
+			if (db != NULL) {
+				db->flags = flags; // the file is mapped on the first read
+				if (flags & REDISLITE_OPEN_WAL) {
+					// a log left next to a database that no longer exists is not ours
+					db->wal = redislite_wal_open(filename, db->page_size, 0, 1);
+					if (db->wal == NULL) {
+						redislite_close_database(db);
+						return NULL;
+					}
+				}
+			}
+			return db;
+		}
+		return NULL;
+	}
+	unsigned char *header = NULL;
+	unsigned char prefix[100];
+	if (pread(fd, prefix, sizeof(prefix), 0) != sizeof(prefix)) {
+		goto cleanup;
+	}
+	if (memcmp(prefix, HEADER_STRING, sizeof(HEADER_STRING)) != 0) {
 		goto cleanup;    // file exist, but not as a redislite db
 	}
-	if (header[23] > READ_FORMAT_VERSION) {
+	if (prefix[23] > READ_FORMAT_VERSION) {
 		goto cleanup;    // newer format
 	}
+	size_t page_size = redislite_get_page_size(&prefix[20]);
+	if (!redislite_valid_page_size(page_size)) {
+		goto cleanup;
+	}
+	header = redislite_malloc(sizeof(unsigned char) * page_size);
+	if (header == NULL) {
+		goto cleanup;
+	}
+	if (redislite_read_fully(fd, header, page_size, 0) != (ssize_t)page_size) {
+		goto cleanup;
+	}
+	// a log left by a session with REDISLITE_OPEN_WAL holds commits the file may not have
+	int has_wal = flags & REDISLITE_OPEN_WAL ? 1 : redislite_wal_exists(filename);
+	if (has_wal < 0) {
+		goto cleanup;
+	}
+	if (has_wal) {
+		wal = redislite_wal_open(filename, page_size, readonly, 0);
+		if (wal == NULL) {
+			goto cleanup;
+		}
+		// the last committed header may not have been checkpointed yet
+		if (redislite_wal_read_page(wal, 0, header) == REDISLITE_ERR) {
+			goto cleanup;
+		}
+	}
 
 	db = redislite_malloc(sizeof(redislite));
 	if (db == NULL) {
 		goto cleanup;
 	}
+	db->page_size = page_size;
 	db->root = redislite_read_first(db, &header[100]);
 	if (db->root == NULL) {
 		free(db);
 		db = NULL;
 		goto cleanup;
 	}
-	db->page_size = header[21] + (header[20] << 8);
-	db->readonly = (header[22] > WRITE_FORMAT_VERSION);
+	db->readonly = readonly || (header[22] > WRITE_FORMAT_VERSION);
 	db->number_of_pages = redislite_get_4bytes(&header[28]);
+	struct stat st;
+	db->allocated_pages = fstat(fd, &st) == 0 ? (int)(st.st_size / page_size) : 0;
+	db->extent_size = 0;
 	db->first_freelist_page = redislite_get_4bytes(&header[32]);
 	db->number_of_freelist_pages = redislite_get_4bytes(&header[36]);
+	db->heap_page = redislite_get_4bytes(&header[40]);
+	db->format_version = header[23];
 	db->types = NULL;
 	db->filename = NULL;
+	db->page_cache = NULL;
+	db->fd = fd;
+	db->flags = flags;
+	db->map = NULL;
+	db->map_size = 0;
+	db->write_buffer = NULL;
+	db->write_buffer_size = 0;
+	db->synchronous = REDISLITE_SYNCHRONOUS_NORMAL;
+	db->flusher = NULL;
+	db->parents = NULL;
+	db->auto_vacuum = 0;
+	db->wal = wal;
+	redislite_free(header);
 	int init = init_db(db);
 	if (init != 0) {
-		goto cleanup;
+		redislite_close_database(db);
+		return NULL;
 	}
 	size_t size = strlen(filename) + 1;
 	db->filename = redislite_malloc(size);
+	if (db->filename == NULL) {
+		redislite_close_database(db);
+		return NULL;
+	}
 	memcpy(db->filename, filename, size);
+	if (wal && !(flags & REDISLITE_OPEN_WAL) && !db->readonly) {
+		// without the flag its commits are copied into the file, or it is not opened
+		if (redislite_wal_checkpoint(wal, fd) != REDISLITE_OK) {
+			redislite_close_database(db);
+			return NULL;
+		}
+		redislite_wal_close(wal);
+		db->wal = NULL;
+		redislite_wal_remove(filename); // if it stays, the checkpoint left nothing in it to replay
+	}
+	if ((flags & REDISLITE_OPEN_MMAP) && redislite_map_database(db) != REDISLITE_OK) {
+		db->flags &= ~REDISLITE_OPEN_MMAP; // keep going with plain reads
+	}
+	return db;
 
 cleanup:
-	fclose(fp);
+	redislite_free(header);
+	redislite_wal_close(wal);
+	close(fd);
 	return db;
 }
 
 redislite *redislite_create_database(const char *filename)
 {
-	size_t page_size = DEFAULT_PAGE_SIZE;
+	return redislite_create_database_with_page_size(filename, DEFAULT_PAGE_SIZE);
+}
+
+redislite *redislite_create_database_with_page_size(const char *filename, size_t page_size)
+{
+	if (!redislite_valid_page_size(page_size)) {
+		return NULL;
+	}
 
 	redislite *db = redislite_malloc(sizeof(redislite));
 	if (db == NULL) {
@@ -210,8 +365,21 @@ redislite *redislite_create_database(const char *filename)
 	db->root = NULL;
 	db->types = NULL;
 	db->filename = NULL;
+	db->page_cache = NULL;
+	db->fd = -1;
+	db->flags = 0;
+	db->map = NULL;
+	db->map_size = 0;
+	db->write_buffer = NULL;
+	db->write_buffer_size = 0;
+	db->synchronous = REDISLITE_SYNCHRONOUS_NORMAL;
+	db->flusher = NULL;
+	db->parents = NULL;
+	db->auto_vacuum = 0;
+	db->wal = NULL;
 	int init = init_db(db);
 	if (init != 0) {
+		redislite_close_database(db);
 		return NULL;
 	}
 
@@ -222,11 +390,26 @@ redislite *redislite_create_database(const char *filename)
 		return NULL;
 	}
 	memcpy(db->filename, filename, size);
+	db->fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (db->fd == -1) {
+		fprintf(stderr, "Unable to write to file '%s'\n", filename);
+		redislite_close_database(db);
+		return NULL;
+	}
+	// a log left next to a database that no longer exists is not ours
+	if (redislite_wal_remove(filename) != REDISLITE_OK) {
+		redislite_close_database(db);
+		return NULL;
+	}
 	db->page_size = page_size;
 	db->file_change_counter = 0;
 	db->number_of_pages = 0;
+	db->allocated_pages = 0;
+	db->extent_size = 0;
 	db->first_freelist_page = 0;
 	db->number_of_freelist_pages = 0;
+	db->heap_page = 0;
+	db->format_version = READ_FORMAT_VERSION;
 	db->readonly = 0;
 
 	redislite_page_index_first *first = (redislite_page_index_first *)create_page_index_first(db);
@@ -246,10 +429,25 @@ redislite *redislite_create_database(const char *filename)
 
 void redislite_close_database(redislite *db)
 {
+	redislite_flusher_stop(db->flusher);
+	if (db->wal) {
+		redislite_wal_checkpoint(db->wal, db->fd);
+		redislite_wal_close(db->wal);
+	}
+	redislite_unmap_database(db);
+	redislite_free(db->write_buffer);
+	if (db->fd != -1) {
+		if (!db->readonly && db->synchronous != REDISLITE_SYNCHRONOUS_OFF) {
+			fsync(db->fd);
+		}
+		close(db->fd);
+	}
 	if (db->filename) {
 		redislite_free(db->filename);
 	}
 	redislite_free_first(db, db->root);
+	redislite_page_cache_free(db->page_cache);
+	redislite_free_parent_map(db->parents);
 	int i;
 	if (db->types) {
 		for (i = 0; i < 256; i++)
@@ -260,3 +458,69 @@ void redislite_close_database(redislite *db)
 	}
 	redislite_free(db);
 }
+
+void redislite_set_page_cache_size(redislite *db, size_t pages)
+{
+	redislite_page_cache_resize(db->page_cache, pages);
+}
+
+int redislite_checkpoint(redislite *db)
+{
+	if (db->wal == NULL) {
+		return REDISLITE_OK;
+	}
+	return redislite_wal_checkpoint(db->wal, db->fd);
+}
+
+void redislite_set_wal_group_commit(redislite *db, int commits)
+{
+	if (db->wal) {
+		((redislite_wal *)db->wal)->group_commit = commits;
+	}
+}
+
+void redislite_set_wal_autocheckpoint(redislite *db, int frames)
+{
+	if (db->wal) {
+		((redislite_wal *)db->wal)->autocheckpoint = frames;
+	}
+}
+
+void redislite_set_synchronous(redislite *db, int mode)
+{
+	db->synchronous = mode;
+}
+
+/*
+ * Starts (or with 0, stops) a thread that fsyncs at most `milliseconds`
+ * after a commit. Only used in REDISLITE_SYNCHRONOUS_NORMAL mode.
+ */
+int redislite_set_flush_interval(redislite *db, int milliseconds)
+{
+	redislite_flusher_stop(db->flusher);
+	db->flusher = NULL;
+	if (milliseconds <= 0) {
+		return REDISLITE_OK;
+	}
+	int wal_fd = db->wal ? ((redislite_wal *)db->wal)->fd : -1;
+	db->flusher = redislite_flusher_start(db->fd, wal_fd, milliseconds);
+	return db->flusher ? REDISLITE_OK : REDISLITE_ERR;
+}
+
+/*
+ * Runs a VACUUM STEP of up to `pages` pages after every command while the
+ * database has free pages, so the file shrinks as keys are deleted.
+ */
+void redislite_set_auto_vacuum(redislite *db, int pages)
+{
+	db->auto_vacuum = pages > 0 ? pages : 0;
+}
+
+/*
+ * Makes the file grow `bytes` at a time (rounded to whole pages), with the
+ * space preallocated, instead of a page at a time. 0 disables it.
+ */
+void redislite_set_extent_size(redislite *db, size_t bytes)
+{
+	db->extent_size = (bytes + db->page_size - 1) / db->page_size * db->page_size;
+}
@@ -7,12 +7,28 @@
 
 typedef struct {
 	char *filename;
+	int fd;
+	int flags; // REDISLITE_OPEN_* flags the database was opened with
+	unsigned char *map; // read only mapping of the file, REDISLITE_OPEN_MMAP
+	size_t map_size;
 	size_t page_size;
 	int file_change_counter;
 	int number_of_pages;
+	int allocated_pages; // the file has room for these, more than number_of_pages after growing by an extent
+	size_t extent_size; // bytes the file grows by at once, 0 grows it a page at a time
 	int first_freelist_page;
 	int number_of_freelist_pages;
+	int heap_page; // where small strings go first, 0 if none has room
+	int format_version; // read format version of the file, raised by its first commit
 	void *root;
+	void *page_cache; // decoded pages shared across changesets
+	void *wal; // write-ahead log, REDISLITE_OPEN_WAL
+	int synchronous; // REDISLITE_SYNCHRONOUS_*
+	void *flusher; // background fsync thread, NULL if disabled
+	void *parents; // where each page hangs from, built by the first VACUUM STEP
+	int auto_vacuum; // pages moved by a VACUUM STEP after every command, 0 disables it
+	unsigned char *write_buffer; // reused by every commit
+	size_t write_buffer_size;
 
 	int readonly;
 
@@ -20,8 +36,28 @@ typedef struct {
 } redislite;
 
 redislite *redislite_create_database(const char *filename);
+redislite *redislite_create_database_with_page_size(const char *filename, size_t page_size);
 redislite *redislite_open_database(const char *filename);
+redislite *redislite_open_database_with_flags(const char *filename, int flags);
 void redislite_close_database(redislite *db);
+void redislite_set_page_cache_size(redislite *db, size_t pages);
+int redislite_checkpoint(redislite *db);
+void redislite_set_wal_group_commit(redislite *db, int commits);
+void redislite_set_wal_autocheckpoint(redislite *db, int frames);
+void redislite_set_synchronous(redislite *db, int mode);
+int redislite_set_flush_interval(redislite *db, int milliseconds);
+void redislite_set_auto_vacuum(redislite *db, int pages);
+void redislite_set_extent_size(redislite *db, size_t bytes);
+
+// takes a piece of a string being read, any status but REDISLITE_OK stops the reading
+typedef int redislite_chunk_callback(void *context, const char *chunk, size_t length);
+
+#define REDISLITE_OPEN_MMAP 1 // read pages straight from a shared mapping of the file
+#define REDISLITE_OPEN_WAL 2 // commit to a write-ahead log, see doc/file-format
+
+#define REDISLITE_SYNCHRONOUS_OFF 0 // never fsync
+#define REDISLITE_SYNCHRONOUS_NORMAL 1 // fsync in batches: group commit or the background flusher
+#define REDISLITE_SYNCHRONOUS_FULL 2 // fsync before a commit returns
 
 #define REDISLITE_OK 0
 #define REDISLITE_ERR -1
@@ -44,6 +80,7 @@ void redislite_close_database(redislite *db);
 #define REDISLITE_SYNTAX_ERROR -18
 #define REDISLITE_INVALID_FLOAT -19
 #define REDISLITE_NAN_OR_INFINITY -20
+#define REDISLITE_KEY_TOO_LONG -21
 
 
 #endif
@@ -1,3 +1,4 @@
+#include "fmacros.h"
 #include "core.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -6,6 +7,8 @@
 #include <limits.h>
 #include <math.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #define SLOT_2_0     0x001fc07f
 #define SLOT_4_2_0   0xf01fc07f
@@ -365,6 +368,12 @@ void redislite_put_4bytes(unsigned char *p, int v)
 	p[3] = (unsigned char)v;
 }
 
+void redislite_put_8bytes(unsigned char *p, long long v)
+{
+	redislite_put_4bytes(p, (int)((unsigned long long)v >> 32));
+	redislite_put_4bytes(&p[4], (int)v);
+}
+
 int redislite_get_2bytes(unsigned char *p)
 {
 	return p[1] + (p[0] << 8);
@@ -375,6 +384,11 @@ int redislite_get_4bytes(const unsigned char *p)
 	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
 }
 
+long long redislite_get_8bytes(const unsigned char *p)
+{
+	return (long long)(((unsigned long long)(unsigned int)redislite_get_4bytes(p) << 32) | (unsigned int)redislite_get_4bytes(&p[4]));
+}
+
 int intlen(int integer)
 {
 	return (int)floor(log10(integer)) + 1;
@@ -383,7 +397,10 @@ int intlen(int integer)
 int str_to_long_long(char *str, int len, long long *value)
 {
 	char *eptr;
-	char _str[20];
+	char _str[21];
+	if (len > 20) {
+		return REDISLITE_ERR; // longer than any long long
+	}
 	memcpy(_str, str, len);
 	_str[len] = '\0';
 	*value = strtoll(_str, &eptr, 10);
@@ -540,3 +557,72 @@ int redislite_stringmatch(const char *pattern, const char *string, int nocase)
 {
 	return redislite_stringmatchlen(pattern, strlen(pattern), string, strlen(string), nocase);
 }
+
+int redislite_write_fully(int fd, unsigned char *data, size_t size, off_t offset)
+{
+	ssize_t written;
+	while (size > 0) {
+		written = pwrite(fd, data, size, offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return REDISLITE_ERR;
+		}
+		data += written;
+		offset += written;
+		size -= written;
+	}
+	return REDISLITE_OK;
+}
+
+// returns the number of bytes read, less than size only on EOF, or -1
+ssize_t redislite_read_fully(int fd, unsigned char *data, size_t size, off_t offset)
+{
+	ssize_t bytes_read, total = 0;
+	while (size > 0) {
+		bytes_read = pread(fd, data, size, offset);
+		if (bytes_read < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (bytes_read == 0) {
+			break;
+		}
+		data += bytes_read;
+		offset += bytes_read;
+		size -= bytes_read;
+		total += bytes_read;
+	}
+	return total;
+}
+
+// makes a file created or renamed in the directory of `filename` durable
+int redislite_fsync_directory(const char *filename)
+{
+	const char *slash = strrchr(filename, '/');
+	size_t length = slash == NULL ? 1 : (size_t)(slash - filename) + 1;
+	char *directory = redislite_malloc(sizeof(char) * (length + 1));
+	if (directory == NULL) {
+		return REDISLITE_OOM;
+	}
+	if (slash == NULL) {
+		directory[0] = '.';
+	}
+	else {
+		memcpy(directory, filename, length); // keeps the slash, for the root
+	}
+	directory[length] = '\0';
+	int fd = open(directory, O_RDONLY), status = REDISLITE_OK;
+	redislite_free(directory);
+	if (fd == -1) {
+		return REDISLITE_ERR;
+	}
+	if (fsync(fd) != 0) {
+		status = REDISLITE_ERR;
+	}
+	close(fd);
+	return status;
+}
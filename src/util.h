@@ -1,6 +1,8 @@
 #ifndef _UTIL_H
 #define _UTIL_H
 
+#include <sys/types.h>
+
 // we are only going to support 32 bits right now
 
 int redislitePutVarint32(unsigned char *, int);
@@ -14,6 +16,8 @@ void redislite_put_4bytes(unsigned char *p, int v);
 int redislite_get_4bytes(const unsigned char *p);
 void redislite_put_2bytes(unsigned char *p, int v);
 int redislite_get_2bytes(const unsigned char *p);
+void redislite_put_8bytes(unsigned char *p, long long v);
+long long redislite_get_8bytes(const unsigned char *p);
 
 #define MIN(A,B) ((A) > (B) ? (B) : (A))
 #define MAX(A,B) ((A) < (B) ? (B) : (A))
@@ -24,4 +28,8 @@ int str_to_long_long(char *str, int len, long long *value);
 int redislite_stringmatchlen(const char *pattern, int patternLen, const char *string, int stringLen, int nocase);
 int redislite_stringmatch(const char *pattern, const char *string, int nocase);
 
+int redislite_write_fully(int fd, unsigned char *data, size_t size, off_t offset);
+ssize_t redislite_read_fully(int fd, unsigned char *data, size_t size, off_t offset);
+int redislite_fsync_directory(const char *filename);
+
 #endif
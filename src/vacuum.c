@@ -0,0 +1,1091 @@
+#include "fmacros.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "core.h"
+#include "page.h"
+#include "page_index.h"
+#include "page_first.h"
+#include "page_string.h"
+#include "page_list.h"
+#include "page_heap.h"
+#include "page_freelist.h"
+#include "page_cache.h"
+#include "flusher.h"
+#include "util.h"
+#include "vacuum.h"
+
+/*
+ * VACUUM copies the pages still reachable from the root into
+ * "<filename>-vacuum", numbered in key order so scans read the file
+ * front to back, and renames the copy over the database. Freed pages and
+ * whatever FLUSHALL left behind are not copied, so the file shrinks.
+ * Other handles open on the database keep the file it replaced: they read
+ * it as it was, and their commits fail instead of being lost with it.
+ */
+
+typedef struct {
+	int number; // in the original file
+	int parent; // the page holding its number, 0 for the root
+	char type;
+	char in_set; // index pages of a set hold members, not page numbers
+} vacuum_page;
+
+typedef struct {
+	redislite *db;
+	int *map; // original page number to its new one, 0 if not reached
+	vacuum_page *pages; // in their new order, the root first
+	int length;
+	int copy; // planned for a copy, where strings are stored again
+} vacuum;
+
+typedef struct {
+	int *num;
+	char type; // of the page pointed to, 0 for list pointers going backwards
+	int in_set;
+	int count; // pages in the run it points to, the extent of a string
+} pointer;
+
+typedef int (*pointer_visitor)(void *ctx, pointer *p);
+
+static int visit_run(pointer_visitor visit, void *ctx, int *num, char type, int in_set, int count)
+{
+	pointer p;
+	p.num = num;
+	p.type = type;
+	p.in_set = in_set;
+	p.count = count;
+	return visit(ctx, &p);
+}
+
+static int visit_pointer(pointer_visitor visit, void *ctx, int *num, char type, int in_set)
+{
+	return visit_run(visit, ctx, num, type, in_set, 1);
+}
+
+static int each_index_pointer(redislite_page_index *page, int in_set, pointer_visitor visit, void *ctx)
+{
+	int status = REDISLITE_OK;
+	size_t i;
+	for (i = 0; i < page->number_of_keys && status == REDISLITE_OK; i++) {
+		redislite_page_index_key *key = page->keys[i];
+		if (key->type == REDISLITE_PAGE_TYPE_INDEX) {
+			status = visit_pointer(visit, ctx, &key->left_page, REDISLITE_PAGE_TYPE_INDEX, in_set);
+		}
+		else if (!in_set && key->type != REDISLITE_PAGE_TYPE_STRING_INLINE && key->type != REDISLITE_PAGE_TYPE_STRING_INTEGER) {
+			status = visit_pointer(visit, ctx, &key->left_page, key->type, 0);
+		}
+	}
+	if (status == REDISLITE_OK && page->right_page) {
+		status = visit_pointer(visit, ctx, &page->right_page, REDISLITE_PAGE_TYPE_INDEX, in_set);
+	}
+	return status;
+}
+
+/*
+ * Calls `visit` on every page number stored in `page`, along with the type
+ * of the page it points to.
+ */
+static int each_pointer(void *page, char type, int in_set, pointer_visitor visit, void *ctx)
+{
+	redislite_page_list *list;
+	redislite_page_string *string;
+	redislite_page_string_directory *directory;
+	size_t i;
+	int *next = NULL;
+	char next_type = type;
+	switch (type) {
+		case REDISLITE_PAGE_TYPE_FIRST:
+			return each_index_pointer(((redislite_page_index_first *)page)->page, 0, visit, ctx);
+		case REDISLITE_PAGE_TYPE_INDEX:
+			return each_index_pointer(page, in_set, visit, ctx);
+		case REDISLITE_PAGE_TYPE_SET:
+			return each_index_pointer(((redislite_page_index_first *)page)->page, 1, visit, ctx);
+		case REDISLITE_PAGE_TYPE_STRING:
+			string = page;
+			next = &string->right_page;
+			if (*next != 0 && string->extent > 0) {
+				return visit_run(visit, ctx, next, REDISLITE_PAGE_TYPE_STRING_EXTENT, 0, string->extent);
+			}
+			next_type = string->extent == REDISLITE_STRING_RUNS ? REDISLITE_PAGE_TYPE_STRING_DIRECTORY : REDISLITE_PAGE_TYPE_STRING_OVERFLOW;
+			break;
+		case REDISLITE_PAGE_TYPE_STRING_DIRECTORY:
+			directory = page;
+			for (i = 0; i < directory->number_of_runs; i++) {
+				if (visit_run(visit, ctx, &directory->runs[i].page, REDISLITE_PAGE_TYPE_STRING_EXTENT, 0, directory->runs[i].count) != REDISLITE_OK) {
+					return REDISLITE_ERR;
+				}
+			}
+			return REDISLITE_OK;
+		case REDISLITE_PAGE_TYPE_STRING_OVERFLOW:
+			next = &((redislite_page_string_overflow *)page)->right_page;
+			break;
+		case REDISLITE_PAGE_TYPE_STRING_EXTENT:
+			return REDISLITE_OK;
+		case REDISLITE_PAGE_TYPE_HEAP:
+			return REDISLITE_OK; // the keys of its strings point to it
+		case REDISLITE_PAGE_TYPE_LIST_FIRST:
+		case REDISLITE_PAGE_TYPE_LIST:
+			list = type == REDISLITE_PAGE_TYPE_LIST ? page : ((redislite_page_list_first *)page)->list;
+			// the previous page, or from the first page the last one
+			if (list->left_page != 0 && visit_pointer(visit, ctx, &list->left_page, 0, 0) != REDISLITE_OK) {
+				return REDISLITE_ERR;
+			}
+			next = &list->right_page;
+			next_type = REDISLITE_PAGE_TYPE_LIST;
+			break;
+		default:
+			return REDISLITE_ERR;
+	}
+	return *next == 0 ? REDISLITE_OK : visit_pointer(visit, ctx, next, next_type, 0);
+}
+
+static int add_page(vacuum *v, int parent, int num, char type, int in_set)
+{
+	if (num <= 0 || num >= v->db->number_of_pages || v->map[num] != 0) {
+		return REDISLITE_ERR; // a page out of range or reached twice, the file is corrupted
+	}
+	v->map[num] = v->length;
+	v->pages[v->length].number = num;
+	v->pages[v->length].parent = parent;
+	v->pages[v->length].type = type;
+	v->pages[v->length].in_set = in_set;
+	v->length++;
+	return REDISLITE_OK;
+}
+
+/*
+ * Chains of overflow pages and strings with runs, or with more pages than
+ * they need, are copied onto a single extent, so an offset is a page away.
+ */
+static int stored_again(redislite *db, redislite_page_string *string)
+{
+	return string->right_page != 0 && string->extent != redislite_string_extent_pages(db, string);
+}
+
+// the pages of a string stored again, written along with it
+static void add_extent(vacuum *v, int parent, int count)
+{
+	int i;
+	for (i = 0; i < count; i++) {
+		v->pages[v->length].number = 0;
+		v->pages[v->length].parent = parent;
+		v->pages[v->length].type = REDISLITE_PAGE_TYPE_STRING_EXTENT;
+		v->pages[v->length].in_set = 0;
+		v->length++;
+	}
+}
+
+typedef struct {
+	vacuum *v;
+	int parent;
+	int next; // the following page of a string or a list
+	char next_type;
+} walk_state;
+
+static int walk(vacuum *v, int parent, int num, char type, int in_set);
+
+static int walk_pointer(void *ctx, pointer *p)
+{
+	walk_state *state = ctx;
+	if (p->type == 0) {
+		return REDISLITE_OK;
+	}
+	if (p->type == REDISLITE_PAGE_TYPE_STRING_OVERFLOW || p->type == REDISLITE_PAGE_TYPE_LIST) {
+		state->next = *p->num;
+		state->next_type = p->type;
+		return REDISLITE_OK;
+	}
+	if (p->type == REDISLITE_PAGE_TYPE_STRING_EXTENT) {
+		// numbered in a row, so they are still a run in the copy
+		int i, status = REDISLITE_OK;
+		for (i = 0; i < p->count && status == REDISLITE_OK; i++) {
+			status = add_page(state->v, state->parent, *p->num + i, p->type, 0);
+		}
+		return status;
+	}
+	if (p->type == REDISLITE_PAGE_TYPE_HEAP && *p->num > 0 && *p->num < state->v->db->number_of_pages && state->v->map[*p->num] != 0) {
+		return REDISLITE_OK; // shared by many keys, reached through the first one
+	}
+	return walk(state->v, state->parent, *p->num, p->type, p->in_set);
+}
+
+static int walk(vacuum *v, int parent, int num, char type, int in_set)
+{
+	redislite *db = v->db;
+	int status = REDISLITE_OK;
+	// strings and lists are chains, followed in a loop instead of recursing
+	while (num != 0 && status == REDISLITE_OK) {
+		status = add_page(v, parent, num, type, in_set);
+		if (status != REDISLITE_OK) {
+			break;
+		}
+		redislite_page_type *page_type = redislite_page_get_type(db, type);
+		void *page = page_type ? redislite_page_get(db, NULL, num, type) : NULL;
+		if (page == NULL) {
+			return page_type ? REDISLITE_OOM : REDISLITE_ERR;
+		}
+		if (v->copy && type == REDISLITE_PAGE_TYPE_STRING && stored_again(db, page)) {
+			add_extent(v, num, redislite_string_extent_pages(db, page));
+			page_type->free_function(db, page);
+			break;
+		}
+		walk_state state;
+		state.v = v;
+		state.parent = num;
+		state.next = 0;
+		status = each_pointer(page, type, in_set, walk_pointer, &state);
+		page_type->free_function(db, page);
+		parent = num;
+		num = state.next;
+		type = state.next_type;
+		in_set = 0;
+	}
+	return status;
+}
+
+/*
+ * Numbers every page reachable from the root in key order. For a copy,
+ * strings stored again are numbered with their new extent instead.
+ */
+static int plan(vacuum *v, redislite *db, int copy)
+{
+	v->db = db;
+	v->copy = copy;
+	v->length = 1; // the root keeps page 0
+	v->map = redislite_malloc(sizeof(int) * db->number_of_pages);
+	v->pages = redislite_malloc(sizeof(vacuum_page) * db->number_of_pages);
+	if (v->map == NULL || v->pages == NULL) {
+		return REDISLITE_OOM;
+	}
+	memset(v->map, 0, sizeof(int) * db->number_of_pages);
+
+	walk_state state;
+	state.v = v;
+	state.parent = 0;
+	return each_pointer(db->root, REDISLITE_PAGE_TYPE_FIRST, 0, walk_pointer, &state);
+}
+
+static void free_plan(vacuum *v)
+{
+	redislite_free(v->pages);
+	redislite_free(v->map);
+}
+
+static int remap(void *ctx, pointer *p)
+{
+	vacuum *v = ctx;
+	if (*p->num <= 0 || *p->num >= v->db->number_of_pages || v->map[*p->num] == 0) {
+		return REDISLITE_ERR;
+	}
+	*p->num = v->map[*p->num];
+	return REDISLITE_OK;
+}
+
+static int copy_page(vacuum *v, changeset *cs, int i)
+{
+	vacuum_page *p = &v->pages[i];
+	if (p->number == 0) {
+		return REDISLITE_OK; // the extent of a string stored again, copied with it
+	}
+	redislite_page_type *type = redislite_page_get_type(v->db, p->type);
+	void *page = redislite_page_get(v->db, NULL, p->number, p->type);
+	if (page == NULL) {
+		return REDISLITE_OOM;
+	}
+	int status;
+	if (p->type == REDISLITE_PAGE_TYPE_STRING && stored_again(v->db, page)) {
+		status = redislite_string_copy_extent(v->db, cs, page, i + 1);
+	}
+	else {
+		status = each_pointer(page, p->type, p->in_set, remap, v);
+	}
+	if (status == REDISLITE_OK) {
+		status = redislite_add_modified_page(cs, i, p->type, page);
+	}
+	if (status < 0) {
+		type->free_function(v->db, page);
+		return status;
+	}
+	return REDISLITE_OK;
+}
+
+static redislite_page_index_first *read_root(redislite *db, int fd)
+{
+	redislite_page_index_first *root = NULL;
+	unsigned char *data = redislite_malloc(sizeof(unsigned char) * db->page_size);
+	if (data == NULL) {
+		return NULL;
+	}
+	if (redislite_read_fully(fd, data, db->page_size, 0) == (ssize_t)db->page_size) {
+		root = redislite_read_first(db, &data[100]);
+	}
+	redislite_free(data);
+	return root;
+}
+
+/*
+ * Writes the pages listed in `v` to a new database at `filename`, a batch
+ * of pages per commit.
+ */
+static int write_copy(vacuum *v, const char *filename)
+{
+	redislite *db = v->db;
+	changeset *cs = NULL;
+	int status = REDISLITE_OK;
+	redislite *target = redislite_create_database_with_page_size(filename, db->page_size);
+	if (target == NULL) {
+		return REDISLITE_ERR;
+	}
+	redislite_set_page_cache_size(target, 0);
+	redislite_set_synchronous(target, REDISLITE_SYNCHRONOUS_OFF); // synced once at the end
+
+	// every commit below rewrites the header, with the final root from the start
+	redislite_page_index_first *root = read_root(db, db->fd);
+	if (root == NULL) {
+		status = REDISLITE_OOM;
+		goto cleanup;
+	}
+	redislite_free_first(target, target->root);
+	target->root = root;
+	status = each_pointer(root, REDISLITE_PAGE_TYPE_FIRST, 0, remap, v);
+	if (status != REDISLITE_OK) {
+		goto cleanup;
+	}
+
+	int i;
+	for (i = 1; i < v->length; i++) {
+		if (cs == NULL) {
+			cs = redislite_create_changeset(target);
+			if (cs == NULL) {
+				status = REDISLITE_OOM;
+				goto cleanup;
+			}
+		}
+		status = copy_page(v, cs, i);
+		if (status != REDISLITE_OK) {
+			goto cleanup;
+		}
+		if (i % VACUUM_BATCH_PAGES == 0) {
+			status = redislite_save_changeset(cs);
+			redislite_free_changeset(cs);
+			cs = NULL;
+			if (status != REDISLITE_OK) {
+				goto cleanup;
+			}
+		}
+	}
+
+	if (cs == NULL) {
+		cs = redislite_create_changeset(target);
+		if (cs == NULL) {
+			status = REDISLITE_OOM;
+			goto cleanup;
+		}
+	}
+	status = redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, root);
+	if (status == REDISLITE_OK) {
+		status = redislite_save_changeset(cs);
+	}
+	if (status == REDISLITE_OK && fsync(target->fd) != 0) {
+		status = REDISLITE_ERR;
+	}
+
+cleanup:
+	if (cs) {
+		redislite_free_changeset(cs);
+	}
+	redislite_close_database(target);
+	return status < 0 ? status : REDISLITE_OK;
+}
+
+/*
+ * Points `db` at the vacuumed file once it replaced the original one.
+ */
+static int reopen(redislite *db, int number_of_pages)
+{
+	int fd = open(db->filename, O_RDWR);
+	if (fd == -1) {
+		return REDISLITE_ERR;
+	}
+	redislite_page_index_first *root = read_root(db, fd);
+	if (root == NULL) {
+		close(fd);
+		return REDISLITE_ERR;
+	}
+
+	int flush_interval = db->flusher ? ((redislite_flusher *)db->flusher)->interval : 0;
+	redislite_set_flush_interval(db, 0);
+	redislite_unmap_database(db);
+	close(db->fd);
+	db->fd = fd;
+	redislite_free_first(db, db->root);
+	db->root = root;
+	db->number_of_pages = number_of_pages;
+	db->allocated_pages = number_of_pages;
+	db->first_freelist_page = 0;
+	db->number_of_freelist_pages = 0;
+	db->heap_page = 0;
+	redislite_page_cache_clear(db->page_cache);
+	redislite_free_parent_map(db->parents); // every page moved
+	db->parents = NULL;
+	if ((db->flags & REDISLITE_OPEN_MMAP) && redislite_map_database(db) != REDISLITE_OK) {
+		db->flags &= ~REDISLITE_OPEN_MMAP;
+	}
+	return redislite_set_flush_interval(db, flush_interval);
+}
+
+int redislite_vacuum(redislite *db)
+{
+	if (db->readonly) {
+		return REDISLITE_READONLY;
+	}
+	// with an empty log every page is read from the database file
+	int status = redislite_checkpoint(db);
+	if (status != REDISLITE_OK) {
+		return status;
+	}
+
+	vacuum v;
+	char *filename = NULL;
+	status = plan(&v, db, 1);
+	if (status != REDISLITE_OK) {
+		goto cleanup;
+	}
+	filename = redislite_malloc(sizeof(char) * (strlen(db->filename) + sizeof(VACUUM_FILENAME_SUFFIX)));
+	if (filename == NULL) {
+		status = REDISLITE_OOM;
+		goto cleanup;
+	}
+	sprintf(filename, "%s" VACUUM_FILENAME_SUFFIX, db->filename);
+
+	unlink(filename); // left behind by an interrupted vacuum
+	status = write_copy(&v, filename);
+	if (status != REDISLITE_OK) {
+		unlink(filename);
+		goto cleanup;
+	}
+	if (rename(filename, db->filename) != 0) {
+		unlink(filename);
+		status = REDISLITE_ERR;
+		goto cleanup;
+	}
+	// the rename survives a crash once the directory is on disk
+	int synced = redislite_fsync_directory(db->filename);
+	status = reopen(db, v.length);
+	if (status == REDISLITE_OK) {
+		status = synced;
+	}
+
+cleanup:
+	redislite_free(filename);
+	free_plan(&v);
+	return status;
+}
+
+/*
+ * VACUUM STEP moves pages from the end of the file into free pages closer
+ * to its start and truncates it, a few pages at a time. Moving a page means
+ * rewriting whatever points to it, so the parent of every page is kept in
+ * memory: built with one walk the first time it is needed, and kept up to
+ * date on every commit by redislite_vacuum_track.
+ */
+
+static int reserve_parents(redislite_parent_map *map, int number_of_pages)
+{
+	if (number_of_pages <= map->alloced) {
+		return REDISLITE_OK;
+	}
+	int alloced = map->alloced ? map->alloced : 64;
+	while (alloced < number_of_pages) {
+		alloced *= 2;
+	}
+	redislite_page_parent *pages = redislite_realloc(map->pages, sizeof(redislite_page_parent) * alloced);
+	if (pages == NULL) {
+		return REDISLITE_OOM;
+	}
+	memset(&pages[map->alloced], 0, sizeof(redislite_page_parent) * (alloced - map->alloced));
+	map->pages = pages;
+	map->alloced = alloced;
+	return REDISLITE_OK;
+}
+
+void redislite_free_parent_map(void *_map)
+{
+	redislite_parent_map *map = (redislite_parent_map *)_map;
+	if (map == NULL) {
+		return;
+	}
+	redislite_free(map->pages);
+	redislite_free(map);
+}
+
+static redislite_parent_map *parent_map(redislite *db)
+{
+	if (db->parents) {
+		return db->parents;
+	}
+	redislite_parent_map *map = redislite_malloc(sizeof(redislite_parent_map));
+	if (map == NULL) {
+		return NULL;
+	}
+	map->alloced = 0;
+	map->pages = NULL;
+
+	vacuum v;
+	int status = plan(&v, db, 0);
+	if (status == REDISLITE_OK) {
+		status = reserve_parents(map, db->number_of_pages);
+	}
+	if (status != REDISLITE_OK) {
+		free_plan(&v);
+		redislite_free_parent_map(map);
+		return NULL;
+	}
+	int i;
+	for (i = 1; i < v.length; i++) {
+		redislite_page_parent *entry = &map->pages[v.pages[i].number];
+		entry->parent = v.pages[i].parent;
+		entry->type = v.pages[i].type;
+		entry->in_set = v.pages[i].in_set;
+	}
+	free_plan(&v);
+	db->parents = map;
+	return map;
+}
+
+typedef struct {
+	redislite_parent_map *map;
+	int parent;
+	int changed;
+} track_state;
+
+static int track_pointer(void *ctx, pointer *p)
+{
+	track_state *state = ctx;
+	int i;
+	for (i = 0; i < p->count; i++) {
+		if (p->type == 0 || *p->num + i <= 0 || *p->num + i >= state->map->alloced) {
+			return REDISLITE_OK;
+		}
+		redislite_page_parent *entry = &state->map->pages[*p->num + i];
+		if (entry->parent != state->parent || entry->type != p->type || entry->in_set != p->in_set) {
+			entry->parent = state->parent;
+			entry->type = p->type;
+			entry->in_set = p->in_set;
+			state->changed = 1;
+		}
+	}
+	return REDISLITE_OK;
+}
+
+static void track_page(track_state *state, int num, char type, void *page)
+{
+	state->parent = num;
+	each_pointer(page, type, state->map->pages[num].in_set, track_pointer, state);
+}
+
+/*
+ * Records the parent of every page the saved changeset points to.
+ * Index pages learn from their parent whether they belong to a set, so
+ * they go after the other pages, until nothing changes.
+ */
+void redislite_vacuum_track(void *_cs)
+{
+	changeset *cs = (changeset *)_cs;
+	redislite *db = cs->db;
+	redislite_parent_map *map = db->parents;
+	if (map == NULL) {
+		return;
+	}
+	if (reserve_parents(map, db->number_of_pages) != REDISLITE_OK) {
+		// built again when needed
+		redislite_free_parent_map(map);
+		db->parents = NULL;
+		return;
+	}
+
+	track_state state;
+	state.map = map;
+	size_t i;
+	int round = 0;
+	do {
+		state.changed = 0;
+		for (i = 0; i < cs->modified_pages_length; i++) {
+			redislite_page *page = cs->modified_pages[i];
+			char type = page->number == 0 ? REDISLITE_PAGE_TYPE_FIRST : page->type->identifier;
+			if (page->number >= db->number_of_pages || type == REDISLITE_PAGE_TYPE_FREELIST ||
+			        (type == REDISLITE_PAGE_TYPE_INDEX) != (round > 0)) {
+				continue;
+			}
+			track_page(&state, page->number, type, page->data);
+		}
+		round++;
+	}
+	while (round == 1 || (state.changed && round <= (int)cs->modified_pages_length));
+}
+
+typedef struct {
+	int from;
+	int to;
+	int changed;
+	int owned; // pointers that own the page moved, not the ones going back
+} move_state;
+
+static int move_pointer(void *ctx, pointer *p)
+{
+	move_state *state = ctx;
+	if (*p->num == state->from) {
+		*p->num = state->to;
+		state->changed++;
+		if (p->type != 0) {
+			state->owned++;
+		}
+	}
+	return REDISLITE_OK;
+}
+
+/*
+ * Points page `num` to `to` wherever it pointed to `from`. Returns how many
+ * of the pointers changed own the page, 0 if `num` does not own it; with
+ * `from` equal to `to` it only counts them.
+ */
+static int repoint(changeset *cs, redislite_parent_map *map, int num, int from, int to)
+{
+	redislite *db = cs->db;
+	char type = num == 0 ? REDISLITE_PAGE_TYPE_FIRST : map->pages[num].type;
+	void *page = num == 0 ? db->root : redislite_page_get(db, cs, num, type);
+	if (page == NULL) {
+		return REDISLITE_ERR;
+	}
+	move_state state;
+	state.from = from;
+	state.to = to;
+	state.changed = 0;
+	state.owned = 0;
+	int status = each_pointer(page, type, map->pages[num].in_set, move_pointer, &state);
+	if (status == REDISLITE_OK && state.changed > 0 && from != to) {
+		status = redislite_add_modified_page(cs, num, type, page);
+	}
+	return status < 0 ? status : state.owned;
+}
+
+static void *copy_object(redislite *db, unsigned char *buffer, redislite_page_type *type, void *page)
+{
+	memset(buffer, 0, db->page_size);
+	type->write_function(db, buffer, page);
+	return type->read_function(db, buffer);
+}
+
+/*
+ * Moves page `from` to the free page `to`: a copy of it is written there
+ * and its parent, its neighbours in a list, and its children are updated.
+ */
+static int move_page(changeset *cs, redislite_parent_map *map, unsigned char *buffer, int from, int to)
+{
+	redislite *db = cs->db;
+	redislite_page_parent entry = map->pages[from];
+	redislite_page_type *type = redislite_page_get_type(db, entry.type);
+	void *page = redislite_page_get(db, cs, from, entry.type);
+	if (page == NULL) {
+		return REDISLITE_ERR;
+	}
+	void *copy = copy_object(db, buffer, type, page);
+	if (copy == NULL) {
+		return REDISLITE_OOM;
+	}
+	move_state state;
+	state.from = from;
+	state.to = to;
+	state.changed = 0;
+	state.owned = 0;
+	each_pointer(copy, entry.type, entry.in_set, move_pointer, &state); // a list pointing to itself
+	int status = redislite_add_modified_page(cs, to, entry.type, copy);
+	if (status < 0) {
+		type->free_function(db, copy);
+		return status;
+	}
+	if (entry.type == REDISLITE_PAGE_TYPE_HEAP) {
+		status = redislite_heap_repoint(cs, copy, from, to);
+	}
+	else {
+		status = repoint(cs, map, entry.parent, from, to);
+	}
+
+	if (status >= 0 && (entry.type == REDISLITE_PAGE_TYPE_LIST || entry.type == REDISLITE_PAGE_TYPE_LIST_FIRST)) {
+		redislite_page_list *list = entry.type == REDISLITE_PAGE_TYPE_LIST ? copy : ((redislite_page_list_first *)copy)->list;
+		if (list->right_page != 0) {
+			status = repoint(cs, map, list->right_page, from, to);
+		}
+		else if (entry.type == REDISLITE_PAGE_TYPE_LIST) {
+			// the last page, the first one points to it
+			int first = entry.parent, i;
+			for (i = 0; first != 0 && map->pages[first].type == REDISLITE_PAGE_TYPE_LIST && i < map->alloced; i++) {
+				first = map->pages[first].parent;
+			}
+			if (first != 0 && map->pages[first].type == REDISLITE_PAGE_TYPE_LIST_FIRST) {
+				status = repoint(cs, map, first, from, to);
+			}
+		}
+	}
+	if (status < 0) {
+		return status;
+	}
+
+	track_state track;
+	track.map = map;
+	track.changed = 0;
+	map->pages[to] = entry;
+	track_page(&track, to, entry.type, copy);
+	memset(&map->pages[from], 0, sizeof(redislite_page_parent));
+	return REDISLITE_OK;
+}
+
+typedef struct {
+	int *pages; // sorted
+	int length;
+	int alloced;
+	int used; // the first ones, taken by pages moved down
+} free_pages;
+
+static int compare_pages(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static int add_free_page(free_pages *f, int num)
+{
+	if (f->length == f->alloced) {
+		int alloced = f->alloced ? f->alloced * 2 : 64;
+		int *pages = redislite_realloc(f->pages, sizeof(int) * alloced);
+		if (pages == NULL) {
+			return REDISLITE_OOM;
+		}
+		f->pages = pages;
+		f->alloced = alloced;
+	}
+	f->pages[f->length++] = num;
+	return REDISLITE_OK;
+}
+
+static int is_free(free_pages *f, int num)
+{
+	if (f->length == 0) {
+		return 0;
+	}
+	int *found = bsearch(&num, f->pages, f->length, sizeof(int), compare_pages);
+	return found != NULL && found - f->pages >= f->used;
+}
+
+/*
+ * Lists every free page, the trunks included.
+ */
+static int read_freelist(changeset *cs, free_pages *f)
+{
+	redislite *db = cs->db;
+	int trunk = db->first_freelist_page;
+	while (trunk != 0) {
+		if (trunk < 0 || trunk >= db->number_of_pages || f->length >= db->number_of_pages) {
+			return REDISLITE_ERR;
+		}
+		redislite_page_freelist *page = redislite_page_get(db, cs, trunk, REDISLITE_PAGE_TYPE_FREELIST);
+		if (page == NULL) {
+			return REDISLITE_ERR;
+		}
+		int status = add_free_page(f, trunk);
+		size_t i;
+		for (i = 0; i < page->number_of_pages && status == REDISLITE_OK; i++) {
+			if (page->pages[i] <= 0 || page->pages[i] >= db->number_of_pages) {
+				return REDISLITE_ERR;
+			}
+			status = add_free_page(f, page->pages[i]);
+		}
+		if (status != REDISLITE_OK) {
+			return status;
+		}
+		trunk = page->right_page;
+	}
+	if (f->length == 0) {
+		return REDISLITE_OK;
+	}
+	qsort(f->pages, f->length, sizeof(int), compare_pages);
+	int i;
+	for (i = 1; i < f->length; i++) {
+		if (f->pages[i] == f->pages[i - 1]) {
+			return REDISLITE_ERR; // listed twice
+		}
+	}
+	return REDISLITE_OK;
+}
+
+/*
+ * Writes the free pages left before `end` as new trunks. Leaves are listed
+ * highest first, the lowest ones are reused first.
+ */
+static int write_freelist(changeset *cs, free_pages *f, int end)
+{
+	redislite *db = cs->db;
+	size_t capacity = redislite_freelist_capacity(db);
+	redislite_page_freelist *previous = NULL;
+	int i, status;
+	db->first_freelist_page = 0;
+	db->number_of_freelist_pages = 0;
+	for (i = f->used; i < f->length && f->pages[i] < end; i++) {
+		int num = f->pages[i];
+		db->number_of_freelist_pages++;
+		if (previous && previous->number_of_pages < capacity) {
+			memmove(&previous->pages[1], &previous->pages[0], sizeof(int) * previous->number_of_pages);
+			previous->pages[0] = num;
+			previous->number_of_pages++;
+			continue;
+		}
+		redislite_page_freelist *trunk = redislite_create_freelist(db, 0);
+		if (trunk == NULL) {
+			return REDISLITE_OOM;
+		}
+		status = redislite_add_modified_page(cs, num, REDISLITE_PAGE_TYPE_FREELIST, trunk);
+		if (status < 0) {
+			redislite_free_freelist(db, trunk);
+			return status;
+		}
+		if (previous) {
+			previous->right_page = num;
+		}
+		else {
+			db->first_freelist_page = num;
+		}
+		previous = trunk;
+	}
+	return REDISLITE_OK;
+}
+
+typedef struct {
+	int page;
+	int *run; // the pointer to the run holding `page`
+	int count;
+} run_state;
+
+static int find_run(void *ctx, pointer *p)
+{
+	run_state *state = ctx;
+	if (p->type == REDISLITE_PAGE_TYPE_STRING_EXTENT && *p->num <= state->page && state->page < *p->num + p->count) {
+		state->run = p->num;
+		state->count = p->count;
+	}
+	return REDISLITE_OK;
+}
+
+/*
+ * Moves the run of a string ending at page `last` into the first run of as
+ * many free pages before it, and points the string or its directory there.
+ * Returns how many pages it has, 0 if nothing reaches `last` anymore, or
+ * REDISLITE_NOT_FOUND if there is no such run.
+ */
+static int move_extent(changeset *cs, redislite_parent_map *map, free_pages *f, unsigned char *buffer, int last, int end)
+{
+	redislite *db = cs->db;
+	int parent = map->pages[last].parent;
+	char parent_type = parent > 0 && parent < end && !is_free(f, parent) ? map->pages[parent].type : 0;
+	if (parent_type != REDISLITE_PAGE_TYPE_STRING && parent_type != REDISLITE_PAGE_TYPE_STRING_DIRECTORY) {
+		return 0;
+	}
+	void *owner = redislite_page_get(db, cs, parent, parent_type);
+	if (owner == NULL) {
+		return REDISLITE_OOM;
+	}
+	run_state state;
+	state.page = last;
+	state.run = NULL;
+	each_pointer(owner, parent_type, 0, find_run, &state);
+	if (state.run == NULL) {
+		return 0;
+	}
+	int start = *state.run, count = state.count;
+	if (last != start + count - 1) {
+		return REDISLITE_NOT_FOUND; // the pages after it were not moved
+	}
+
+	int i, to = 0, status;
+	for (i = f->used; i + count <= f->length && f->pages[i + count - 1] < start && to == 0; i++) {
+		if (f->pages[i + count - 1] - f->pages[i] == count - 1) {
+			to = f->pages[i];
+		}
+	}
+	if (to == 0) {
+		return REDISLITE_NOT_FOUND;
+	}
+	i--;
+
+	redislite_page_type *type = redislite_page_get_type(db, REDISLITE_PAGE_TYPE_STRING_EXTENT);
+	int j;
+	for (j = 0; j < count; j++) {
+		void *page = redislite_page_get(db, cs, start + j, REDISLITE_PAGE_TYPE_STRING_EXTENT);
+		if (page == NULL) {
+			return REDISLITE_ERR;
+		}
+		void *copy = copy_object(db, buffer, type, page);
+		if (copy == NULL) {
+			return REDISLITE_OOM;
+		}
+		status = redislite_add_modified_page(cs, to + j, REDISLITE_PAGE_TYPE_STRING_EXTENT, copy);
+		if (status < 0) {
+			type->free_function(db, copy);
+			return status;
+		}
+		map->pages[to + j] = map->pages[start + j];
+		memset(&map->pages[start + j], 0, sizeof(redislite_page_parent));
+	}
+	*state.run = to;
+	status = redislite_add_modified_page(cs, parent, parent_type, owner);
+	if (status < 0) {
+		return status;
+	}
+	// taken out of the free pages, which stay sorted
+	memmove(&f->pages[i], &f->pages[i + count], sizeof(int) * (f->length - i - count));
+	f->length -= count;
+	return count;
+}
+
+/*
+ * Moves up to `pages` pages from the end of the file into free pages and
+ * truncates it. Returns how many pages the file shrank by.
+ */
+int redislite_vacuum_step(redislite *db, int pages)
+{
+	if (db->readonly) {
+		return REDISLITE_READONLY;
+	}
+	if (pages <= 0) {
+		return 0;
+	}
+	redislite_parent_map *map = parent_map(db);
+	if (map == NULL) {
+		return REDISLITE_OOM;
+	}
+	int number_of_pages = db->number_of_pages;
+	int first_freelist_page = db->first_freelist_page;
+	int number_of_freelist_pages = db->number_of_freelist_pages;
+	free_pages f;
+	f.pages = NULL;
+	f.length = f.alloced = f.used = 0;
+	unsigned char *buffer = redislite_malloc(sizeof(unsigned char) * db->page_size);
+	changeset *cs = redislite_create_changeset(db);
+	int status = REDISLITE_OK, saved = 0;
+	if (cs == NULL || buffer == NULL) {
+		status = REDISLITE_OOM;
+		goto cleanup;
+	}
+	status = read_freelist(cs, &f);
+	if (status != REDISLITE_OK) {
+		goto cleanup;
+	}
+
+	int end = number_of_pages, moved = 0;
+	while (end > 1 && moved < pages) {
+		int num = end - 1;
+		if (is_free(&f, num)) {
+			end--;
+			continue;
+		}
+		redislite_page_parent *entry = &map->pages[num];
+		if (entry->type == REDISLITE_PAGE_TYPE_STRING_EXTENT) {
+			// moved whole, even past `pages`, to stay a run
+			int count = move_extent(cs, map, &f, buffer, num, end);
+			if (count == REDISLITE_NOT_FOUND) {
+				break;
+			}
+			if (count < 0) {
+				status = count;
+				goto cleanup;
+			}
+			if (count == 0) {
+				memset(entry, 0, sizeof(redislite_page_parent));
+				count = 1;
+			}
+			end -= count;
+			moved += count;
+			continue;
+		}
+		int parent = entry->parent;
+		int reached = entry->type != 0 && (parent == 0 || (parent < end && !is_free(&f, parent) && map->pages[parent].type != 0));
+		if (entry->type == REDISLITE_PAGE_TYPE_HEAP) {
+			// its parent is only one of the pages with keys on it, the keys tell
+			void *page = redislite_page_get(db, cs, num, REDISLITE_PAGE_TYPE_HEAP);
+			reached = page ? redislite_heap_repoint(cs, page, num, num) : REDISLITE_OOM;
+		}
+		else if (reached) {
+			reached = repoint(cs, map, parent, num, num);
+		}
+		if (reached < 0) {
+			status = reached;
+			goto cleanup;
+		}
+		if (!reached) {
+			// leaked, nothing points to it anymore
+			memset(entry, 0, sizeof(redislite_page_parent));
+			end--;
+			moved++;
+			continue;
+		}
+		if (f.used == f.length || f.pages[f.used] >= num) {
+			break; // no free page before it
+		}
+		status = move_page(cs, map, buffer, num, f.pages[f.used]);
+		if (status != REDISLITE_OK) {
+			goto cleanup;
+		}
+		f.used++;
+		end--;
+		moved++;
+	}
+	if (end == number_of_pages) {
+		goto cleanup;
+	}
+
+	status = write_freelist(cs, &f, end);
+	if (status == REDISLITE_OK) {
+		db->number_of_pages = end;
+		status = redislite_add_modified_page(cs, 0, REDISLITE_PAGE_TYPE_FIRST, db->root);
+	}
+	if (status >= 0) {
+		status = redislite_save_changeset(cs);
+		saved = status == REDISLITE_OK;
+	}
+	if (saved && db->wal == NULL) {
+		// with a log, the next checkpoint truncates the file
+		redislite_unmap_database(db);
+		if (ftruncate(db->fd, (off_t)db->page_size * end) != 0) {
+			// committed anyway, the pages past the end are only unused
+			status = REDISLITE_ERR;
+		}
+		else {
+			db->allocated_pages = end;
+		}
+	}
+
+cleanup:
+	if (cs) {
+		redislite_free_changeset(cs);
+	}
+	redislite_free(f.pages);
+	redislite_free(buffer);
+	if (status != REDISLITE_OK && !saved) {
+		db->number_of_pages = number_of_pages;
+		db->first_freelist_page = first_freelist_page;
+		db->number_of_freelist_pages = number_of_freelist_pages;
+		// it may have recorded moves for a commit that never happened
+		redislite_free_parent_map(db->parents);
+		db->parents = NULL;
+		return status;
+	}
+	// after the changeset handed its pages to the cache
+	redislite_page_cache_truncate(db->page_cache, db->number_of_pages);
+	// the commit frees the map if it cannot keep it up to date
+	map = db->parents;
+	if (map != NULL) {
+		memset(&map->pages[db->number_of_pages], 0, sizeof(redislite_page_parent) * (map->alloced - db->number_of_pages));
+	}
+	return status == REDISLITE_OK ? number_of_pages - db->number_of_pages : status;
+}
@@ -0,0 +1,28 @@
+#ifndef _VACUUM_H
+#define _VACUUM_H
+
+#include "redislite.h"
+
+#define VACUUM_FILENAME_SUFFIX "-vacuum"
+#define VACUUM_BATCH_PAGES 256
+
+/*
+ * The page holding the number of another one, 0 for the root, and the
+ * type that page was written with; for VACUUM STEP.
+ */
+typedef struct {
+	int parent;
+	char type; // 0 if unknown: free, or nothing reaches it
+	char in_set;
+} redislite_page_parent;
+
+typedef struct {
+	int alloced;
+	redislite_page_parent *pages; // by page number
+} redislite_parent_map;
+
+int redislite_vacuum(redislite *db);
+int redislite_vacuum_step(redislite *db, int pages);
+void redislite_vacuum_track(void *_cs);
+void redislite_free_parent_map(void *_map);
+#endif
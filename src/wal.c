@@ -0,0 +1,459 @@
+#include "fmacros.h"
+#include "redislite.h"
+#include "wal.h"
+#include "util.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define DEFAULT_WAL_INDEX_SIZE 64
+
+static unsigned int checksum(unsigned int seed, const unsigned char *data, size_t size)
+{
+	// FNV-1a, chained through the frames so stale frames never validate
+	unsigned int hash = seed ^ 2166136261U;
+	size_t i;
+	for (i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static unsigned int frame_checksum(redislite_wal *wal, unsigned int seed, const unsigned char *frame)
+{
+	unsigned int hash = checksum(seed, frame, 12);
+	return checksum(hash, &frame[WAL_FRAME_HEADER_SIZE], wal->page_size);
+}
+
+static size_t index_slot(redislite_wal *wal, int page_number)
+{
+	size_t mask = wal->index_alloced - 1;
+	size_t i = ((size_t)(unsigned int)page_number * 2654435761U) & mask;
+	while (wal->index_pages[i] != -1 && wal->index_pages[i] != page_number) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+static int index_alloc(redislite_wal *wal, size_t alloced)
+{
+	int *pages = redislite_malloc(sizeof(int) * alloced);
+	off_t *offsets = redislite_malloc(sizeof(off_t) * alloced);
+	if (pages == NULL || offsets == NULL) {
+		redislite_free(pages);
+		redislite_free(offsets);
+		return REDISLITE_OOM;
+	}
+	size_t i;
+	for (i = 0; i < alloced; i++) {
+		pages[i] = -1;
+	}
+
+	int *old_pages = wal->index_pages;
+	off_t *old_offsets = wal->index_offsets;
+	size_t old_alloced = wal->index_alloced;
+	wal->index_pages = pages;
+	wal->index_offsets = offsets;
+	wal->index_alloced = alloced;
+	for (i = 0; i < old_alloced; i++) {
+		if (old_pages[i] != -1) {
+			size_t slot = index_slot(wal, old_pages[i]);
+			wal->index_pages[slot] = old_pages[i];
+			wal->index_offsets[slot] = old_offsets[i];
+		}
+	}
+	redislite_free(old_pages);
+	redislite_free(old_offsets);
+	return REDISLITE_OK;
+}
+
+static int index_reserve(redislite_wal *wal, size_t count)
+{
+	size_t alloced = wal->index_alloced;
+	while ((wal->index_used + count) * 2 > alloced) {
+		alloced *= 2;
+	}
+	if (alloced != wal->index_alloced) {
+		return index_alloc(wal, alloced);
+	}
+	return REDISLITE_OK;
+}
+
+static int index_set(redislite_wal *wal, int page_number, off_t offset)
+{
+	int status = index_reserve(wal, 1);
+	if (status != REDISLITE_OK) {
+		return status;
+	}
+	size_t slot = index_slot(wal, page_number);
+	if (wal->index_pages[slot] == -1) {
+		wal->index_pages[slot] = page_number;
+		wal->index_used++;
+	}
+	wal->index_offsets[slot] = offset;
+	return REDISLITE_OK;
+}
+
+static void index_clear(redislite_wal *wal)
+{
+	size_t i;
+	for (i = 0; i < wal->index_alloced; i++) {
+		wal->index_pages[i] = -1;
+	}
+	wal->index_used = 0;
+}
+
+static int write_header(redislite_wal *wal)
+{
+	unsigned char header[WAL_HEADER_SIZE];
+	memset(header, 0, WAL_HEADER_SIZE);
+	memcpy(header, WAL_HEADER_STRING, sizeof(WAL_HEADER_STRING));
+	redislite_put_4bytes(&header[16], (int)wal->page_size);
+	redislite_put_4bytes(&header[20], (int)wal->salt);
+	if (redislite_write_fully(wal->fd, header, WAL_HEADER_SIZE, 0) != REDISLITE_OK) {
+		return REDISLITE_ERR;
+	}
+	if (ftruncate(wal->fd, WAL_HEADER_SIZE) != 0) {
+		return REDISLITE_ERR;
+	}
+	wal->size = WAL_HEADER_SIZE;
+	wal->frames = 0;
+	wal->last_checksum = wal->salt;
+	index_clear(wal);
+	return REDISLITE_OK;
+}
+
+/*
+ * Replays the committed frames into the index. Frames after the last
+ * valid commit record (a crash in the middle of an append) are ignored
+ * and overwritten by the next commit.
+ */
+static int recover(redislite_wal *wal)
+{
+	size_t frame_size = redislite_wal_frame_size(wal);
+	unsigned char *frame = redislite_malloc(frame_size);
+	int *pending_pages = NULL;
+	off_t *pending_offsets = NULL;
+	size_t pending = 0, pending_alloced = 0;
+	int status = REDISLITE_OK;
+	if (frame == NULL) {
+		return REDISLITE_OOM;
+	}
+
+	off_t offset = WAL_HEADER_SIZE;
+	unsigned int seed = wal->salt;
+	while (redislite_read_fully(wal->fd, frame, frame_size, offset) == (ssize_t)frame_size) {
+		if ((unsigned int)redislite_get_4bytes(&frame[8]) != wal->salt) {
+			break;
+		}
+		unsigned int hash = frame_checksum(wal, seed, frame);
+		if ((unsigned int)redislite_get_4bytes(&frame[12]) != hash) {
+			break;
+		}
+		if (pending == pending_alloced) {
+			pending_alloced = pending_alloced ? pending_alloced * 2 : 16;
+			int *pages = redislite_realloc(pending_pages, sizeof(int) * pending_alloced);
+			if (pages == NULL) {
+				status = REDISLITE_OOM;
+				goto cleanup;
+			}
+			pending_pages = pages;
+			off_t *offsets = redislite_realloc(pending_offsets, sizeof(off_t) * pending_alloced);
+			if (offsets == NULL) {
+				status = REDISLITE_OOM;
+				goto cleanup;
+			}
+			pending_offsets = offsets;
+		}
+		pending_pages[pending] = redislite_get_4bytes(&frame[0]);
+		pending_offsets[pending] = offset;
+		pending++;
+		seed = hash;
+		offset += frame_size;
+
+		if (redislite_get_4bytes(&frame[4]) != 0) {
+			size_t i;
+			for (i = 0; i < pending; i++) {
+				status = index_set(wal, pending_pages[i], pending_offsets[i]);
+				if (status != REDISLITE_OK) {
+					goto cleanup;
+				}
+			}
+			wal->frames += pending;
+			wal->db_pages = redislite_get_4bytes(&frame[4]);
+			wal->size = offset;
+			wal->last_checksum = hash;
+			pending = 0;
+		}
+	}
+
+cleanup:
+	redislite_free(pending_pages);
+	redislite_free(pending_offsets);
+	redislite_free(frame);
+	return status;
+}
+
+static char *wal_filename(const char *db_filename)
+{
+	size_t len = strlen(db_filename);
+	char *filename = redislite_malloc(len + sizeof("-wal"));
+	if (filename == NULL) {
+		return NULL;
+	}
+	memcpy(filename, db_filename, len);
+	memcpy(&filename[len], "-wal", sizeof("-wal"));
+	return filename;
+}
+
+/*
+ * Whether a log is next to the database, from a session with
+ * REDISLITE_OPEN_WAL; an error other than OOM counts as one, so it is
+ * looked at.
+ */
+int redislite_wal_exists(const char *db_filename)
+{
+	char *filename = wal_filename(db_filename);
+	if (filename == NULL) {
+		return REDISLITE_OOM;
+	}
+	struct stat st;
+	int exists = stat(filename, &st) == 0 || errno != ENOENT;
+	redislite_free(filename);
+	return exists;
+}
+
+// deletes the log next to the database, once it was copied or is not its own
+int redislite_wal_remove(const char *db_filename)
+{
+	char *filename = wal_filename(db_filename);
+	if (filename == NULL) {
+		return REDISLITE_OOM;
+	}
+	int status = unlink(filename) == 0 || errno == ENOENT ? REDISLITE_OK : REDISLITE_ERR;
+	redislite_free(filename);
+	return status;
+}
+
+redislite_wal *redislite_wal_open(const char *db_filename, size_t page_size, int readonly, int reset)
+{
+	redislite_wal *wal = redislite_malloc(sizeof(redislite_wal));
+	if (wal == NULL) {
+		return NULL;
+	}
+	wal->fd = -1;
+	wal->page_size = page_size;
+	wal->readonly = readonly;
+	wal->size = WAL_HEADER_SIZE;
+	wal->frames = 0;
+	wal->db_pages = 0;
+	wal->pending_commits = 0;
+	wal->group_commit = DEFAULT_WAL_GROUP_COMMIT;
+	wal->autocheckpoint = DEFAULT_WAL_AUTOCHECKPOINT;
+	wal->index_alloced = 0;
+	wal->index_used = 0;
+	wal->index_pages = NULL;
+	wal->index_offsets = NULL;
+
+	wal->filename = wal_filename(db_filename);
+	if (wal->filename == NULL) {
+		goto cleanup;
+	}
+
+	if (index_alloc(wal, DEFAULT_WAL_INDEX_SIZE) != REDISLITE_OK) {
+		goto cleanup;
+	}
+
+	wal->fd = open(wal->filename, readonly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+	if (wal->fd == -1) {
+		if (readonly && errno == ENOENT) {
+			// nothing to replay
+			wal->last_checksum = wal->salt = 0;
+			return wal;
+		}
+		fprintf(stderr, "Unable to open file '%s'\n", wal->filename);
+		goto cleanup;
+	}
+
+	unsigned char header[WAL_HEADER_SIZE];
+	if (!reset && redislite_read_fully(wal->fd, header, WAL_HEADER_SIZE, 0) == WAL_HEADER_SIZE &&
+	        memcmp(header, WAL_HEADER_STRING, sizeof(WAL_HEADER_STRING)) == 0 &&
+	        (size_t)redislite_get_4bytes(&header[16]) == page_size) {
+		wal->salt = (unsigned int)redislite_get_4bytes(&header[20]);
+		wal->last_checksum = wal->salt;
+		if (recover(wal) != REDISLITE_OK) {
+			goto cleanup;
+		}
+	}
+	else if (readonly) {
+		wal->last_checksum = wal->salt = 0;
+	}
+	else {
+		wal->salt = (unsigned int)time(NULL);
+		if (write_header(wal) != REDISLITE_OK) {
+			fprintf(stderr, "Unable to write to file '%s'\n", wal->filename);
+			goto cleanup;
+		}
+	}
+	return wal;
+
+cleanup:
+	redislite_wal_close(wal);
+	return NULL;
+}
+
+void redislite_wal_close(redislite_wal *wal)
+{
+	if (wal == NULL) {
+		return;
+	}
+	if (wal->fd != -1) {
+		if (!wal->readonly && wal->pending_commits > 0) {
+			redislite_wal_sync(wal);
+		}
+		close(wal->fd);
+	}
+	redislite_free(wal->filename);
+	redislite_free(wal->index_pages);
+	redislite_free(wal->index_offsets);
+	redislite_free(wal);
+}
+
+/*
+ * Returns REDISLITE_NOT_FOUND when the page has no committed frame in the
+ * log, and the database file has to be read instead.
+ */
+int redislite_wal_read_page(redislite_wal *wal, int num, unsigned char *data)
+{
+	if (wal->index_used == 0) {
+		return REDISLITE_NOT_FOUND;
+	}
+	size_t slot = index_slot(wal, num);
+	if (wal->index_pages[slot] == -1) {
+		return REDISLITE_NOT_FOUND;
+	}
+	off_t offset = wal->index_offsets[slot] + WAL_FRAME_HEADER_SIZE;
+	if (redislite_read_fully(wal->fd, data, wal->page_size, offset) != (ssize_t)wal->page_size) {
+		return REDISLITE_ERR;
+	}
+	return REDISLITE_OK;
+}
+
+size_t redislite_wal_frame_size(redislite_wal *wal)
+{
+	return WAL_FRAME_HEADER_SIZE + wal->page_size;
+}
+
+/*
+ * Fills in the header of a frame whose page image has already been
+ * written after its first WAL_FRAME_HEADER_SIZE bytes. The last frame of a
+ * commit carries the number of pages of the database, the others 0.
+ */
+void redislite_wal_frame(redislite_wal *wal, unsigned char *frame, int page_number, int commit_pages)
+{
+	redislite_put_4bytes(&frame[0], page_number);
+	redislite_put_4bytes(&frame[4], commit_pages);
+	redislite_put_4bytes(&frame[8], (int)wal->salt);
+}
+
+/*
+ * Appends a whole commit with a single write. Checksums are computed here
+ * because they depend on the frames written before.
+ */
+int redislite_wal_append(redislite_wal *wal, unsigned char *frames, int count)
+{
+	if (wal->readonly) {
+		return REDISLITE_READONLY;
+	}
+	// make room in the index first, it cannot fail once the frames are written
+	int status = index_reserve(wal, count);
+	if (status != REDISLITE_OK) {
+		return status;
+	}
+	size_t frame_size = redislite_wal_frame_size(wal);
+	unsigned int seed = wal->last_checksum;
+	int i;
+	for (i = 0; i < count; i++) {
+		unsigned char *frame = &frames[frame_size * i];
+		seed = frame_checksum(wal, seed, frame);
+		redislite_put_4bytes(&frame[12], (int)seed);
+	}
+	if (redislite_write_fully(wal->fd, frames, frame_size * count, wal->size) != REDISLITE_OK) {
+		fprintf(stderr, "Unable to write to file '%s'\n", wal->filename);
+		return REDISLITE_ERR;
+	}
+
+	for (i = 0; i < count; i++) {
+		index_set(wal, redislite_get_4bytes(&frames[frame_size * i]), wal->size + frame_size * i);
+	}
+	wal->size += frame_size * count;
+	wal->frames += count;
+	wal->db_pages = redislite_get_4bytes(&frames[frame_size * (count - 1) + 4]);
+	wal->last_checksum = seed;
+	wal->pending_commits++; // the caller decides when to sync, see redislite_save_changeset
+	return REDISLITE_OK;
+}
+
+int redislite_wal_sync(redislite_wal *wal)
+{
+	if (fsync(wal->fd) != 0) {
+		return REDISLITE_ERR;
+	}
+	wal->pending_commits = 0;
+	return REDISLITE_OK;
+}
+
+int redislite_wal_needs_checkpoint(redislite_wal *wal)
+{
+	return !wal->readonly && wal->autocheckpoint > 0 && wal->frames >= wal->autocheckpoint;
+}
+
+/*
+ * Copies the last committed image of every page in the log into the
+ * database file and starts the log over. Replaying a log that was already
+ * copied is harmless, so a crash at any point leaves a consistent database.
+ * Pages past the end of a database that shrank are dropped, and so is the
+ * tail of the file.
+ */
+int redislite_wal_checkpoint(redislite_wal *wal, int db_fd)
+{
+	if (wal->readonly || wal->fd == -1 || wal->frames == 0) {
+		return REDISLITE_OK;
+	}
+	if (redislite_wal_sync(wal) != REDISLITE_OK) {
+		return REDISLITE_ERR;
+	}
+
+	unsigned char *data = redislite_malloc(wal->page_size);
+	if (data == NULL) {
+		return REDISLITE_OOM;
+	}
+	size_t i;
+	int status = REDISLITE_OK;
+	for (i = 0; i < wal->index_alloced; i++) {
+		if (wal->index_pages[i] == -1 || (wal->db_pages > 0 && wal->index_pages[i] >= wal->db_pages)) {
+			continue;
+		}
+		if (redislite_read_fully(wal->fd, data, wal->page_size, wal->index_offsets[i] + WAL_FRAME_HEADER_SIZE) != (ssize_t)wal->page_size ||
+		        redislite_write_fully(db_fd, data, wal->page_size, (off_t)wal->page_size * wal->index_pages[i]) != REDISLITE_OK) {
+			status = REDISLITE_ERR;
+			break;
+		}
+	}
+	redislite_free(data);
+	if (status == REDISLITE_OK && wal->db_pages > 0 && ftruncate(db_fd, (off_t)wal->page_size * wal->db_pages) != 0) {
+		status = REDISLITE_ERR;
+	}
+	if (status != REDISLITE_OK || fsync(db_fd) != 0) {
+		return REDISLITE_ERR;
+	}
+
+	wal->salt++;
+	return write_header(wal);
+}
@@ -0,0 +1,50 @@
+#ifndef _WAL_H
+#define _WAL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define WAL_HEADER_STRING "Redislite WAL 1"
+#define WAL_HEADER_SIZE 32
+#define WAL_FRAME_HEADER_SIZE 16
+#define DEFAULT_WAL_GROUP_COMMIT 8
+#define DEFAULT_WAL_AUTOCHECKPOINT 1000
+
+/*
+ * Write-ahead log kept next to the database file as "<filename>-wal".
+ * Committed page images are appended to it and read back from it until a
+ * checkpoint copies them into the database file.
+ */
+typedef struct {
+	int fd;
+	char *filename;
+	size_t page_size;
+	int readonly;
+	unsigned int salt; // changes on every checkpoint, frames from older runs are ignored
+	unsigned int last_checksum; // checksum of the last committed frame, seeds the next one
+	off_t size; // end of the last committed frame
+	int frames;
+	int db_pages; // pages in the database as of the last commit, 0 if unknown
+	int pending_commits; // commits written since the last fsync
+	int group_commit; // commits sharing one fsync
+	int autocheckpoint; // frames after which the log is copied back, 0 disables it
+
+	// page number to offset of its last committed frame, open addressing
+	size_t index_alloced;
+	size_t index_used;
+	int *index_pages;
+	off_t *index_offsets;
+} redislite_wal;
+
+redislite_wal *redislite_wal_open(const char *db_filename, size_t page_size, int readonly, int reset);
+void redislite_wal_close(redislite_wal *wal);
+int redislite_wal_exists(const char *db_filename);
+int redislite_wal_remove(const char *db_filename);
+int redislite_wal_read_page(redislite_wal *wal, int num, unsigned char *data);
+size_t redislite_wal_frame_size(redislite_wal *wal);
+void redislite_wal_frame(redislite_wal *wal, unsigned char *frame, int page_number, int commit_pages);
+int redislite_wal_append(redislite_wal *wal, unsigned char *frames, int count);
+int redislite_wal_sync(redislite_wal *wal);
+int redislite_wal_checkpoint(redislite_wal *wal, int db_fd);
+int redislite_wal_needs_checkpoint(redislite_wal *wal);
+#endif